@@ -36,137 +36,155 @@
 			if (w == 7) { printf(" },   // U+00%.2X (%c)\n", code, code); }
 		}
 	}
+
+   The rows below are that output with each { ... } written as GLYPH(...),
+   so the flipped table is generated from the same list at compile time.
 */
 
+// Glyph list, expanded once per table below
+#define FONT8X8_BASIC_TR(GLYPH) \
+    GLYPH(0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00)   /* U+0000 (nul) */ \
+    GLYPH(0x00, 0x04, 0x02, 0xFF, 0x02, 0x04, 0x00, 0x00)   /* U+0001 (Up Allow) */ \
+    GLYPH(0x00, 0x20, 0x40, 0xFF, 0x40, 0x20, 0x00, 0x00)   /* U+0002 (Down Allow) */ \
+    GLYPH(0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00)   /* U+0003 */ \
+    GLYPH(0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00)   /* U+0004 */ \
+    GLYPH(0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00)   /* U+0005 */ \
+    GLYPH(0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00)   /* U+0006 */ \
+    GLYPH(0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00)   /* U+0007 */ \
+    GLYPH(0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00)   /* U+0008 */ \
+    GLYPH(0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00)   /* U+0009 */ \
+    GLYPH(0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00)   /* U+000A */ \
+    GLYPH(0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00)   /* U+000B */ \
+    GLYPH(0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00)   /* U+000C */ \
+    GLYPH(0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00)   /* U+000D */ \
+    GLYPH(0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00)   /* U+000E */ \
+    GLYPH(0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00)   /* U+000F */ \
+    GLYPH(0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00)   /* U+0010 */ \
+    GLYPH(0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00)   /* U+0011 */ \
+    GLYPH(0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00)   /* U+0012 */ \
+    GLYPH(0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00)   /* U+0013 */ \
+    GLYPH(0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00)   /* U+0014 */ \
+    GLYPH(0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00)   /* U+0015 */ \
+    GLYPH(0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00)   /* U+0016 */ \
+    GLYPH(0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00)   /* U+0017 */ \
+    GLYPH(0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00)   /* U+0018 */ \
+    GLYPH(0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00)   /* U+0019 */ \
+    GLYPH(0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00)   /* U+001A */ \
+    GLYPH(0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00)   /* U+001B */ \
+    GLYPH(0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00)   /* U+001C */ \
+    GLYPH(0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00)   /* U+001D */ \
+    GLYPH(0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00)   /* U+001E */ \
+    GLYPH(0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00)   /* U+001F */ \
+    GLYPH(0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00)   /* U+0020 (space) */ \
+    GLYPH(0x00, 0x00, 0x06, 0x5F, 0x5F, 0x06, 0x00, 0x00)   /* U+0021 (!) */ \
+    GLYPH(0x00, 0x03, 0x03, 0x00, 0x03, 0x03, 0x00, 0x00)   /* U+0022 (") */ \
+    GLYPH(0x14, 0x7F, 0x7F, 0x14, 0x7F, 0x7F, 0x14, 0x00)   /* U+0023 (#) */ \
+    GLYPH(0x24, 0x2E, 0x6B, 0x6B, 0x3A, 0x12, 0x00, 0x00)   /* U+0024 ($) */ \
+    GLYPH(0x46, 0x66, 0x30, 0x18, 0x0C, 0x66, 0x62, 0x00)   /* U+0025 (%) */ \
+    GLYPH(0x30, 0x7A, 0x4F, 0x5D, 0x37, 0x7A, 0x48, 0x00)   /* U+0026 (&) */ \
+    GLYPH(0x04, 0x07, 0x03, 0x00, 0x00, 0x00, 0x00, 0x00)   /* U+0027 (') */ \
+    GLYPH(0x00, 0x1C, 0x3E, 0x63, 0x41, 0x00, 0x00, 0x00)   /* U+0028 (() */ \
+    GLYPH(0x00, 0x41, 0x63, 0x3E, 0x1C, 0x00, 0x00, 0x00)   /* U+0029 ()) */ \
+    GLYPH(0x08, 0x2A, 0x3E, 0x1C, 0x1C, 0x3E, 0x2A, 0x08)   /* U+002A (*) */ \
+    GLYPH(0x08, 0x08, 0x3E, 0x3E, 0x08, 0x08, 0x00, 0x00)   /* U+002B (+) */ \
+    GLYPH(0x00, 0x80, 0xE0, 0x60, 0x00, 0x00, 0x00, 0x00)   /* U+002C (,) */ \
+    GLYPH(0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x00, 0x00)   /* U+002D (-) */ \
+    GLYPH(0x00, 0x00, 0x60, 0x60, 0x00, 0x00, 0x00, 0x00)   /* U+002E (.) */ \
+    GLYPH(0x60, 0x30, 0x18, 0x0C, 0x06, 0x03, 0x01, 0x00)   /* U+002F (/) */ \
+    GLYPH(0x3E, 0x7F, 0x71, 0x59, 0x4D, 0x7F, 0x3E, 0x00)   /* U+0030 (0) */ \
+    GLYPH(0x40, 0x42, 0x7F, 0x7F, 0x40, 0x40, 0x00, 0x00)   /* U+0031 (1) */ \
+    GLYPH(0x62, 0x73, 0x59, 0x49, 0x6F, 0x66, 0x00, 0x00)   /* U+0032 (2) */ \
+    GLYPH(0x22, 0x63, 0x49, 0x49, 0x7F, 0x36, 0x00, 0x00)   /* U+0033 (3) */ \
+    GLYPH(0x18, 0x1C, 0x16, 0x53, 0x7F, 0x7F, 0x50, 0x00)   /* U+0034 (4) */ \
+    GLYPH(0x27, 0x67, 0x45, 0x45, 0x7D, 0x39, 0x00, 0x00)   /* U+0035 (5) */ \
+    GLYPH(0x3C, 0x7E, 0x4B, 0x49, 0x79, 0x30, 0x00, 0x00)   /* U+0036 (6) */ \
+    GLYPH(0x03, 0x03, 0x71, 0x79, 0x0F, 0x07, 0x00, 0x00)   /* U+0037 (7) */ \
+    GLYPH(0x36, 0x7F, 0x49, 0x49, 0x7F, 0x36, 0x00, 0x00)   /* U+0038 (8) */ \
+    GLYPH(0x06, 0x4F, 0x49, 0x69, 0x3F, 0x1E, 0x00, 0x00)   /* U+0039 (9) */ \
+    GLYPH(0x00, 0x00, 0x66, 0x66, 0x00, 0x00, 0x00, 0x00)   /* U+003A (:) */ \
+    GLYPH(0x00, 0x80, 0xE6, 0x66, 0x00, 0x00, 0x00, 0x00)   /* U+003B (;) */ \
+    GLYPH(0x08, 0x1C, 0x36, 0x63, 0x41, 0x00, 0x00, 0x00)   /* U+003C (<) */ \
+    GLYPH(0x24, 0x24, 0x24, 0x24, 0x24, 0x24, 0x00, 0x00)   /* U+003D (=) */ \
+    GLYPH(0x00, 0x41, 0x63, 0x36, 0x1C, 0x08, 0x00, 0x00)   /* U+003E (>) */ \
+    GLYPH(0x02, 0x03, 0x51, 0x59, 0x0F, 0x06, 0x00, 0x00)   /* U+003F (?) */ \
+    GLYPH(0x3E, 0x7F, 0x41, 0x5D, 0x5D, 0x1F, 0x1E, 0x00)   /* U+0040 (@) */ \
+    GLYPH(0x7C, 0x7E, 0x13, 0x13, 0x7E, 0x7C, 0x00, 0x00)   /* U+0041 (A) */ \
+    GLYPH(0x41, 0x7F, 0x7F, 0x49, 0x49, 0x7F, 0x36, 0x00)   /* U+0042 (B) */ \
+    GLYPH(0x1C, 0x3E, 0x63, 0x41, 0x41, 0x63, 0x22, 0x00)   /* U+0043 (C) */ \
+    GLYPH(0x41, 0x7F, 0x7F, 0x41, 0x63, 0x3E, 0x1C, 0x00)   /* U+0044 (D) */ \
+    GLYPH(0x41, 0x7F, 0x7F, 0x49, 0x5D, 0x41, 0x63, 0x00)   /* U+0045 (E) */ \
+    GLYPH(0x41, 0x7F, 0x7F, 0x49, 0x1D, 0x01, 0x03, 0x00)   /* U+0046 (F) */ \
+    GLYPH(0x1C, 0x3E, 0x63, 0x41, 0x51, 0x73, 0x72, 0x00)   /* U+0047 (G) */ \
+    GLYPH(0x7F, 0x7F, 0x08, 0x08, 0x7F, 0x7F, 0x00, 0x00)   /* U+0048 (H) */ \
+    GLYPH(0x00, 0x41, 0x7F, 0x7F, 0x41, 0x00, 0x00, 0x00)   /* U+0049 (I) */ \
+    GLYPH(0x30, 0x70, 0x40, 0x41, 0x7F, 0x3F, 0x01, 0x00)   /* U+004A (J) */ \
+    GLYPH(0x41, 0x7F, 0x7F, 0x08, 0x1C, 0x77, 0x63, 0x00)   /* U+004B (K) */ \
+    GLYPH(0x41, 0x7F, 0x7F, 0x41, 0x40, 0x60, 0x70, 0x00)   /* U+004C (L) */ \
+    GLYPH(0x7F, 0x7F, 0x0E, 0x1C, 0x0E, 0x7F, 0x7F, 0x00)   /* U+004D (M) */ \
+    GLYPH(0x7F, 0x7F, 0x06, 0x0C, 0x18, 0x7F, 0x7F, 0x00)   /* U+004E (N) */ \
+    GLYPH(0x1C, 0x3E, 0x63, 0x41, 0x63, 0x3E, 0x1C, 0x00)   /* U+004F (O) */ \
+    GLYPH(0x41, 0x7F, 0x7F, 0x49, 0x09, 0x0F, 0x06, 0x00)   /* U+0050 (P) */ \
+    GLYPH(0x1E, 0x3F, 0x21, 0x71, 0x7F, 0x5E, 0x00, 0x00)   /* U+0051 (Q) */ \
+    GLYPH(0x41, 0x7F, 0x7F, 0x09, 0x19, 0x7F, 0x66, 0x00)   /* U+0052 (R) */ \
+    GLYPH(0x26, 0x6F, 0x4D, 0x59, 0x73, 0x32, 0x00, 0x00)   /* U+0053 (S) */ \
+    GLYPH(0x03, 0x41, 0x7F, 0x7F, 0x41, 0x03, 0x00, 0x00)   /* U+0054 (T) */ \
+    GLYPH(0x7F, 0x7F, 0x40, 0x40, 0x7F, 0x7F, 0x00, 0x00)   /* U+0055 (U) */ \
+    GLYPH(0x1F, 0x3F, 0x60, 0x60, 0x3F, 0x1F, 0x00, 0x00)   /* U+0056 (V) */ \
+    GLYPH(0x7F, 0x7F, 0x30, 0x18, 0x30, 0x7F, 0x7F, 0x00)   /* U+0057 (W) */ \
+    GLYPH(0x43, 0x67, 0x3C, 0x18, 0x3C, 0x67, 0x43, 0x00)   /* U+0058 (X) */ \
+    GLYPH(0x07, 0x4F, 0x78, 0x78, 0x4F, 0x07, 0x00, 0x00)   /* U+0059 (Y) */ \
+    GLYPH(0x47, 0x63, 0x71, 0x59, 0x4D, 0x67, 0x73, 0x00)   /* U+005A (Z) */ \
+    GLYPH(0x00, 0x7F, 0x7F, 0x41, 0x41, 0x00, 0x00, 0x00)   /* U+005B ([) */ \
+    GLYPH(0x01, 0x03, 0x06, 0x0C, 0x18, 0x30, 0x60, 0x00)   /* U+005C (\) */ \
+    GLYPH(0x00, 0x41, 0x41, 0x7F, 0x7F, 0x00, 0x00, 0x00)   /* U+005D (]) */ \
+    GLYPH(0x08, 0x0C, 0x06, 0x03, 0x06, 0x0C, 0x08, 0x00)   /* U+005E (^) */ \
+    GLYPH(0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80)   /* U+005F (_) */ \
+    GLYPH(0x00, 0x00, 0x03, 0x07, 0x04, 0x00, 0x00, 0x00)   /* U+0060 (`) */ \
+    GLYPH(0x20, 0x74, 0x54, 0x54, 0x3C, 0x78, 0x40, 0x00)   /* U+0061 (a) */ \
+    GLYPH(0x41, 0x7F, 0x3F, 0x48, 0x48, 0x78, 0x30, 0x00)   /* U+0062 (b) */ \
+    GLYPH(0x38, 0x7C, 0x44, 0x44, 0x6C, 0x28, 0x00, 0x00)   /* U+0063 (c) */ \
+    GLYPH(0x30, 0x78, 0x48, 0x49, 0x3F, 0x7F, 0x40, 0x00)   /* U+0064 (d) */ \
+    GLYPH(0x38, 0x7C, 0x54, 0x54, 0x5C, 0x18, 0x00, 0x00)   /* U+0065 (e) */ \
+    GLYPH(0x48, 0x7E, 0x7F, 0x49, 0x03, 0x02, 0x00, 0x00)   /* U+0066 (f) */ \
+    GLYPH(0x98, 0xBC, 0xA4, 0xA4, 0xF8, 0x7C, 0x04, 0x00)   /* U+0067 (g) */ \
+    GLYPH(0x41, 0x7F, 0x7F, 0x08, 0x04, 0x7C, 0x78, 0x00)   /* U+0068 (h) */ \
+    GLYPH(0x00, 0x44, 0x7D, 0x7D, 0x40, 0x00, 0x00, 0x00)   /* U+0069 (i) */ \
+    GLYPH(0x60, 0xE0, 0x80, 0x80, 0xFD, 0x7D, 0x00, 0x00)   /* U+006A (j) */ \
+    GLYPH(0x41, 0x7F, 0x7F, 0x10, 0x38, 0x6C, 0x44, 0x00)   /* U+006B (k) */ \
+    GLYPH(0x00, 0x41, 0x7F, 0x7F, 0x40, 0x00, 0x00, 0x00)   /* U+006C (l) */ \
+    GLYPH(0x7C, 0x7C, 0x18, 0x38, 0x1C, 0x7C, 0x78, 0x00)   /* U+006D (m) */ \
+    GLYPH(0x7C, 0x7C, 0x04, 0x04, 0x7C, 0x78, 0x00, 0x00)   /* U+006E (n) */ \
+    GLYPH(0x38, 0x7C, 0x44, 0x44, 0x7C, 0x38, 0x00, 0x00)   /* U+006F (o) */ \
+    GLYPH(0x84, 0xFC, 0xF8, 0xA4, 0x24, 0x3C, 0x18, 0x00)   /* U+0070 (p) */ \
+    GLYPH(0x18, 0x3C, 0x24, 0xA4, 0xF8, 0xFC, 0x84, 0x00)   /* U+0071 (q) */ \
+    GLYPH(0x44, 0x7C, 0x78, 0x4C, 0x04, 0x1C, 0x18, 0x00)   /* U+0072 (r) */ \
+    GLYPH(0x48, 0x5C, 0x54, 0x54, 0x74, 0x24, 0x00, 0x00)   /* U+0073 (s) */ \
+    GLYPH(0x00, 0x04, 0x3E, 0x7F, 0x44, 0x24, 0x00, 0x00)   /* U+0074 (t) */ \
+    GLYPH(0x3C, 0x7C, 0x40, 0x40, 0x3C, 0x7C, 0x40, 0x00)   /* U+0075 (u) */ \
+    GLYPH(0x1C, 0x3C, 0x60, 0x60, 0x3C, 0x1C, 0x00, 0x00)   /* U+0076 (v) */ \
+    GLYPH(0x3C, 0x7C, 0x70, 0x38, 0x70, 0x7C, 0x3C, 0x00)   /* U+0077 (w) */ \
+    GLYPH(0x44, 0x6C, 0x38, 0x10, 0x38, 0x6C, 0x44, 0x00)   /* U+0078 (x) */ \
+    GLYPH(0x9C, 0xBC, 0xA0, 0xA0, 0xFC, 0x7C, 0x00, 0x00)   /* U+0079 (y) */ \
+    GLYPH(0x4C, 0x64, 0x74, 0x5C, 0x4C, 0x64, 0x00, 0x00)   /* U+007A (z) */ \
+    GLYPH(0x08, 0x08, 0x3E, 0x77, 0x41, 0x41, 0x00, 0x00)   /* U+007B ({) */ \
+    GLYPH(0x00, 0x00, 0x00, 0x77, 0x77, 0x00, 0x00, 0x00)   /* U+007C (|) */ \
+    GLYPH(0x41, 0x41, 0x77, 0x3E, 0x08, 0x08, 0x00, 0x00)   /* U+007D (}) */ \
+    GLYPH(0x02, 0x03, 0x01, 0x03, 0x02, 0x03, 0x01, 0x00)   /* U+007E (~) */ \
+    GLYPH(0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00)   /* U+007F */
+
+#define FONT8X8_GLYPH(a, b, c, d, e, f, g, h) { a, b, c, d, e, f, g, h },
+// Bit order reversed for flipped panels, same as ssd1306_flip
+#define FONT8X8_REVERSE(x) ((((x) >> 7) & 0x01) | (((x) >> 5) & 0x02) | (((x) >> 3) & 0x04) | (((x) >> 1) & 0x08) | \
+                            (((x) << 1) & 0x10) | (((x) << 3) & 0x20) | (((x) << 5) & 0x40) | (((x) << 7) & 0x80))
+#define FONT8X8_GLYPH_FLIP(a, b, c, d, e, f, g, h) { FONT8X8_REVERSE(a), FONT8X8_REVERSE(b), FONT8X8_REVERSE(c), \
+    FONT8X8_REVERSE(d), FONT8X8_REVERSE(e), FONT8X8_REVERSE(f), FONT8X8_REVERSE(g), FONT8X8_REVERSE(h) },
+
 static const uint8_t font8x8_basic_tr[128][8] = {
-    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },   // U+0000 (nul)
-    { 0x00, 0x04, 0x02, 0xFF, 0x02, 0x04, 0x00, 0x00 },   // U+0001 (Up Allow)
-    { 0x00, 0x20, 0x40, 0xFF, 0x40, 0x20, 0x00, 0x00 },   // U+0002 (Down Allow)
-    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },   // U+0003
-    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },   // U+0004
-    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },   // U+0005
-    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },   // U+0006
-    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },   // U+0007
-    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },   // U+0008
-    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },   // U+0009
-    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },   // U+000A
-    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },   // U+000B
-    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },   // U+000C
-    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },   // U+000D
-    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },   // U+000E
-    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },   // U+000F
-    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },   // U+0010
-    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },   // U+0011
-    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },   // U+0012
-    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },   // U+0013
-    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },   // U+0014
-    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },   // U+0015
-    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },   // U+0016
-    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },   // U+0017
-    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },   // U+0018
-    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },   // U+0019
-    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },   // U+001A
-    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },   // U+001B
-    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },   // U+001C
-    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },   // U+001D
-    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },   // U+001E
-    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },   // U+001F
-    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },   // U+0020 (space)
-    { 0x00, 0x00, 0x06, 0x5F, 0x5F, 0x06, 0x00, 0x00 },   // U+0021 (!)
-    { 0x00, 0x03, 0x03, 0x00, 0x03, 0x03, 0x00, 0x00 },   // U+0022 (")
-    { 0x14, 0x7F, 0x7F, 0x14, 0x7F, 0x7F, 0x14, 0x00 },   // U+0023 (#)
-    { 0x24, 0x2E, 0x6B, 0x6B, 0x3A, 0x12, 0x00, 0x00 },   // U+0024 ($)
-    { 0x46, 0x66, 0x30, 0x18, 0x0C, 0x66, 0x62, 0x00 },   // U+0025 (%)
-    { 0x30, 0x7A, 0x4F, 0x5D, 0x37, 0x7A, 0x48, 0x00 },   // U+0026 (&)
-    { 0x04, 0x07, 0x03, 0x00, 0x00, 0x00, 0x00, 0x00 },   // U+0027 (')
-    { 0x00, 0x1C, 0x3E, 0x63, 0x41, 0x00, 0x00, 0x00 },   // U+0028 (()
-    { 0x00, 0x41, 0x63, 0x3E, 0x1C, 0x00, 0x00, 0x00 },   // U+0029 ())
-    { 0x08, 0x2A, 0x3E, 0x1C, 0x1C, 0x3E, 0x2A, 0x08 },   // U+002A (*)
-    { 0x08, 0x08, 0x3E, 0x3E, 0x08, 0x08, 0x00, 0x00 },   // U+002B (+)
-    { 0x00, 0x80, 0xE0, 0x60, 0x00, 0x00, 0x00, 0x00 },   // U+002C (,)
-    { 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x00, 0x00 },   // U+002D (-)
-    { 0x00, 0x00, 0x60, 0x60, 0x00, 0x00, 0x00, 0x00 },   // U+002E (.)
-    { 0x60, 0x30, 0x18, 0x0C, 0x06, 0x03, 0x01, 0x00 },   // U+002F (/)
-    { 0x3E, 0x7F, 0x71, 0x59, 0x4D, 0x7F, 0x3E, 0x00 },   // U+0030 (0)
-    { 0x40, 0x42, 0x7F, 0x7F, 0x40, 0x40, 0x00, 0x00 },   // U+0031 (1)
-    { 0x62, 0x73, 0x59, 0x49, 0x6F, 0x66, 0x00, 0x00 },   // U+0032 (2)
-    { 0x22, 0x63, 0x49, 0x49, 0x7F, 0x36, 0x00, 0x00 },   // U+0033 (3)
-    { 0x18, 0x1C, 0x16, 0x53, 0x7F, 0x7F, 0x50, 0x00 },   // U+0034 (4)
-    { 0x27, 0x67, 0x45, 0x45, 0x7D, 0x39, 0x00, 0x00 },   // U+0035 (5)
-    { 0x3C, 0x7E, 0x4B, 0x49, 0x79, 0x30, 0x00, 0x00 },   // U+0036 (6)
-    { 0x03, 0x03, 0x71, 0x79, 0x0F, 0x07, 0x00, 0x00 },   // U+0037 (7)
-    { 0x36, 0x7F, 0x49, 0x49, 0x7F, 0x36, 0x00, 0x00 },   // U+0038 (8)
-    { 0x06, 0x4F, 0x49, 0x69, 0x3F, 0x1E, 0x00, 0x00 },   // U+0039 (9)
-    { 0x00, 0x00, 0x66, 0x66, 0x00, 0x00, 0x00, 0x00 },   // U+003A (:)
-    { 0x00, 0x80, 0xE6, 0x66, 0x00, 0x00, 0x00, 0x00 },   // U+003B (;)
-    { 0x08, 0x1C, 0x36, 0x63, 0x41, 0x00, 0x00, 0x00 },   // U+003C (<)
-    { 0x24, 0x24, 0x24, 0x24, 0x24, 0x24, 0x00, 0x00 },   // U+003D (=)
-    { 0x00, 0x41, 0x63, 0x36, 0x1C, 0x08, 0x00, 0x00 },   // U+003E (>)
-    { 0x02, 0x03, 0x51, 0x59, 0x0F, 0x06, 0x00, 0x00 },   // U+003F (?)
-    { 0x3E, 0x7F, 0x41, 0x5D, 0x5D, 0x1F, 0x1E, 0x00 },   // U+0040 (@)
-    { 0x7C, 0x7E, 0x13, 0x13, 0x7E, 0x7C, 0x00, 0x00 },   // U+0041 (A)
-    { 0x41, 0x7F, 0x7F, 0x49, 0x49, 0x7F, 0x36, 0x00 },   // U+0042 (B)
-    { 0x1C, 0x3E, 0x63, 0x41, 0x41, 0x63, 0x22, 0x00 },   // U+0043 (C)
-    { 0x41, 0x7F, 0x7F, 0x41, 0x63, 0x3E, 0x1C, 0x00 },   // U+0044 (D)
-    { 0x41, 0x7F, 0x7F, 0x49, 0x5D, 0x41, 0x63, 0x00 },   // U+0045 (E)
-    { 0x41, 0x7F, 0x7F, 0x49, 0x1D, 0x01, 0x03, 0x00 },   // U+0046 (F)
-    { 0x1C, 0x3E, 0x63, 0x41, 0x51, 0x73, 0x72, 0x00 },   // U+0047 (G)
-    { 0x7F, 0x7F, 0x08, 0x08, 0x7F, 0x7F, 0x00, 0x00 },   // U+0048 (H)
-    { 0x00, 0x41, 0x7F, 0x7F, 0x41, 0x00, 0x00, 0x00 },   // U+0049 (I)
-    { 0x30, 0x70, 0x40, 0x41, 0x7F, 0x3F, 0x01, 0x00 },   // U+004A (J)
-    { 0x41, 0x7F, 0x7F, 0x08, 0x1C, 0x77, 0x63, 0x00 },   // U+004B (K)
-    { 0x41, 0x7F, 0x7F, 0x41, 0x40, 0x60, 0x70, 0x00 },   // U+004C (L)
-    { 0x7F, 0x7F, 0x0E, 0x1C, 0x0E, 0x7F, 0x7F, 0x00 },   // U+004D (M)
-    { 0x7F, 0x7F, 0x06, 0x0C, 0x18, 0x7F, 0x7F, 0x00 },   // U+004E (N)
-    { 0x1C, 0x3E, 0x63, 0x41, 0x63, 0x3E, 0x1C, 0x00 },   // U+004F (O)
-    { 0x41, 0x7F, 0x7F, 0x49, 0x09, 0x0F, 0x06, 0x00 },   // U+0050 (P)
-    { 0x1E, 0x3F, 0x21, 0x71, 0x7F, 0x5E, 0x00, 0x00 },   // U+0051 (Q)
-    { 0x41, 0x7F, 0x7F, 0x09, 0x19, 0x7F, 0x66, 0x00 },   // U+0052 (R)
-    { 0x26, 0x6F, 0x4D, 0x59, 0x73, 0x32, 0x00, 0x00 },   // U+0053 (S)
-    { 0x03, 0x41, 0x7F, 0x7F, 0x41, 0x03, 0x00, 0x00 },   // U+0054 (T)
-    { 0x7F, 0x7F, 0x40, 0x40, 0x7F, 0x7F, 0x00, 0x00 },   // U+0055 (U)
-    { 0x1F, 0x3F, 0x60, 0x60, 0x3F, 0x1F, 0x00, 0x00 },   // U+0056 (V)
-    { 0x7F, 0x7F, 0x30, 0x18, 0x30, 0x7F, 0x7F, 0x00 },   // U+0057 (W)
-    { 0x43, 0x67, 0x3C, 0x18, 0x3C, 0x67, 0x43, 0x00 },   // U+0058 (X)
-    { 0x07, 0x4F, 0x78, 0x78, 0x4F, 0x07, 0x00, 0x00 },   // U+0059 (Y)
-    { 0x47, 0x63, 0x71, 0x59, 0x4D, 0x67, 0x73, 0x00 },   // U+005A (Z)
-    { 0x00, 0x7F, 0x7F, 0x41, 0x41, 0x00, 0x00, 0x00 },   // U+005B ([)
-    { 0x01, 0x03, 0x06, 0x0C, 0x18, 0x30, 0x60, 0x00 },   // U+005C (\)
-    { 0x00, 0x41, 0x41, 0x7F, 0x7F, 0x00, 0x00, 0x00 },   // U+005D (])
-    { 0x08, 0x0C, 0x06, 0x03, 0x06, 0x0C, 0x08, 0x00 },   // U+005E (^)
-    { 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 },   // U+005F (_)
-    { 0x00, 0x00, 0x03, 0x07, 0x04, 0x00, 0x00, 0x00 },   // U+0060 (`)
-    { 0x20, 0x74, 0x54, 0x54, 0x3C, 0x78, 0x40, 0x00 },   // U+0061 (a)
-    { 0x41, 0x7F, 0x3F, 0x48, 0x48, 0x78, 0x30, 0x00 },   // U+0062 (b)
-    { 0x38, 0x7C, 0x44, 0x44, 0x6C, 0x28, 0x00, 0x00 },   // U+0063 (c)
-    { 0x30, 0x78, 0x48, 0x49, 0x3F, 0x7F, 0x40, 0x00 },   // U+0064 (d)
-    { 0x38, 0x7C, 0x54, 0x54, 0x5C, 0x18, 0x00, 0x00 },   // U+0065 (e)
-    { 0x48, 0x7E, 0x7F, 0x49, 0x03, 0x02, 0x00, 0x00 },   // U+0066 (f)
-    { 0x98, 0xBC, 0xA4, 0xA4, 0xF8, 0x7C, 0x04, 0x00 },   // U+0067 (g)
-    { 0x41, 0x7F, 0x7F, 0x08, 0x04, 0x7C, 0x78, 0x00 },   // U+0068 (h)
-    { 0x00, 0x44, 0x7D, 0x7D, 0x40, 0x00, 0x00, 0x00 },   // U+0069 (i)
-    { 0x60, 0xE0, 0x80, 0x80, 0xFD, 0x7D, 0x00, 0x00 },   // U+006A (j)
-    { 0x41, 0x7F, 0x7F, 0x10, 0x38, 0x6C, 0x44, 0x00 },   // U+006B (k)
-    { 0x00, 0x41, 0x7F, 0x7F, 0x40, 0x00, 0x00, 0x00 },   // U+006C (l)
-    { 0x7C, 0x7C, 0x18, 0x38, 0x1C, 0x7C, 0x78, 0x00 },   // U+006D (m)
-    { 0x7C, 0x7C, 0x04, 0x04, 0x7C, 0x78, 0x00, 0x00 },   // U+006E (n)
-    { 0x38, 0x7C, 0x44, 0x44, 0x7C, 0x38, 0x00, 0x00 },   // U+006F (o)
-    { 0x84, 0xFC, 0xF8, 0xA4, 0x24, 0x3C, 0x18, 0x00 },   // U+0070 (p)
-    { 0x18, 0x3C, 0x24, 0xA4, 0xF8, 0xFC, 0x84, 0x00 },   // U+0071 (q)
-    { 0x44, 0x7C, 0x78, 0x4C, 0x04, 0x1C, 0x18, 0x00 },   // U+0072 (r)
-    { 0x48, 0x5C, 0x54, 0x54, 0x74, 0x24, 0x00, 0x00 },   // U+0073 (s)
-    { 0x00, 0x04, 0x3E, 0x7F, 0x44, 0x24, 0x00, 0x00 },   // U+0074 (t)
-    { 0x3C, 0x7C, 0x40, 0x40, 0x3C, 0x7C, 0x40, 0x00 },   // U+0075 (u)
-    { 0x1C, 0x3C, 0x60, 0x60, 0x3C, 0x1C, 0x00, 0x00 },   // U+0076 (v)
-    { 0x3C, 0x7C, 0x70, 0x38, 0x70, 0x7C, 0x3C, 0x00 },   // U+0077 (w)
-    { 0x44, 0x6C, 0x38, 0x10, 0x38, 0x6C, 0x44, 0x00 },   // U+0078 (x)
-    { 0x9C, 0xBC, 0xA0, 0xA0, 0xFC, 0x7C, 0x00, 0x00 },   // U+0079 (y)
-    { 0x4C, 0x64, 0x74, 0x5C, 0x4C, 0x64, 0x00, 0x00 },   // U+007A (z)
-    { 0x08, 0x08, 0x3E, 0x77, 0x41, 0x41, 0x00, 0x00 },   // U+007B ({)
-    { 0x00, 0x00, 0x00, 0x77, 0x77, 0x00, 0x00, 0x00 },   // U+007C (|)
-    { 0x41, 0x41, 0x77, 0x3E, 0x08, 0x08, 0x00, 0x00 },   // U+007D (})
-    { 0x02, 0x03, 0x01, 0x03, 0x02, 0x03, 0x01, 0x00 },   // U+007E (~)
-    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 }    // U+007F
+    FONT8X8_BASIC_TR(FONT8X8_GLYPH)
+};
+
+static const uint8_t font8x8_basic_tr_flip[128][8] = {
+    FONT8X8_BASIC_TR(FONT8X8_GLYPH_FLIP)
 };
 
 #endif /* MAIN_FONT8X8_BASIC_H_ */
@@ -20,11 +20,7 @@ typedef union out_column_t {
 } PACK8 out_column_t;
 
 inline void ssd1306_init(SSD1306_t *dev, int width, int height) {
-#ifdef CONFIG_SPI_INTERFACE
-    spi_init(dev, width, height);
-#else
-    i2c_init(dev, width, height);
-#endif
+    dev->_transport->init(dev, width, height);
     // Initialize internal buffer
     for (int i = 0; i < dev->_pages; i++) {
         memset(dev->_page[i]._segs, 0, 128);
@@ -44,23 +40,28 @@ inline int ssd1306_get_pages(SSD1306_t *dev) {
 }
 
 inline void ssd1306_show_buffer(SSD1306_t *dev) {
-#ifdef CONFIG_SPI_INTERFACE
-    for (int page = 0; page < dev->_pages; page++) {
-        spi_display_image(dev, page, 0, dev->_page[page]._segs, dev->_width);
+    if (dev->_transport->show_buffer) {
+        dev->_transport->show_buffer(dev);
+        return;
     }
-#else
+    ssd1306_batch_begin(dev);
     for (int page = 0; page < dev->_pages; page++) {
-        i2c_display_image(dev, page, 0, dev->_page[page]._segs, dev->_width);
+        dev->_transport->display_image(dev, page, 0, dev->_page[page]._segs, dev->_width);
     }
-#endif
+    ssd1306_batch_end(dev);
 }
 
 inline void ssd1306_show_buffer_page(SSD1306_t *dev, int page, int seg) {
-#ifdef CONFIG_SPI_INTERFACE
-    spi_display_image(dev, page, seg, dev->_page[page]._segs, dev->_width);
-#else
-    i2c_display_image(dev, page, seg, dev->_page[page]._segs, dev->_width);
-#endif
+    dev->_transport->display_image(dev, page, seg, dev->_page[page]._segs, dev->_width);
+}
+
+// Batches nest, the backend sends the held back writes when the outermost one ends
+inline void ssd1306_batch_begin(SSD1306_t *dev) {
+    if (dev->_transport->batch_begin) dev->_transport->batch_begin(dev);
+}
+
+inline void ssd1306_batch_end(SSD1306_t *dev) {
+    if (dev->_transport->batch_end) dev->_transport->batch_end(dev);
 }
 
 void ssd1306_set_buffer(SSD1306_t *dev, uint8_t *buffer) {
@@ -88,25 +89,35 @@ inline void ssd1306_get_page(SSD1306_t *dev, int page, uint8_t *buffer) {
 }
 
 inline void ssd1306_display_image(SSD1306_t *dev, int page, int seg, uint8_t *images, int width) {
-#ifdef CONFIG_SPI_INTERFACE
-    spi_display_image(dev, page, seg, images, width);
-#else
-    i2c_display_image(dev, page, seg, images, width);
-#endif
+    dev->_transport->display_image(dev, page, seg, images, width);
     // Set to internal buffer
     memcpy(&dev->_page[page]._segs[seg], images, width);
 }
 
+// Set text to internal buffer. Not show it.
+// Returns the segment after the last character
+int _ssd1306_text(SSD1306_t *dev, int offset, int page, char *text, bool invert) {
+    if (page >= dev->_pages) return offset << 3;
+
+    const uint8_t(*font)[8] = dev->_flip ? font8x8_basic_tr_flip : font8x8_basic_tr;
+    uint8_t mask = invert ? 0xFF : 0x00;
+    int i = offset;
+    for (; i < 16 && *text; i++, text++) {
+        const uint8_t *glyph = font[(uint8_t)*text & 0x7F];
+        uint8_t *segs = &dev->_page[page]._segs[i << 3];
+        for (int x = 0; x < 8; x++) segs[x] = glyph[x] ^ mask;
+    }
+    return i << 3;
+}
+
+// The whole text goes out as one write
 void ssd1306_display_text(SSD1306_t *dev, int offset, int page, char *text, bool invert) {
     if (page >= dev->_pages) return;
 
-    uint8_t image[8];
-    for (int i = offset; i < 16 && *text; i++, text++) {
-        memcpy(image, font8x8_basic_tr[(uint8_t)*text], 8);
-        if (invert) ssd1306_invert(image, 8);
-        if (dev->_flip) ssd1306_flip(image, 8);
-        ssd1306_display_image(dev, page, i << 3, image, 8);
-    }
+    int seg = offset << 3;
+    int end = _ssd1306_text(dev, offset, page, text, invert);
+    if (end > seg)
+        dev->_transport->display_image(dev, page, seg, &dev->_page[page]._segs[seg], end - seg);
 }
 
 void ssd1306_display_text_box1(SSD1306_t *dev, int page, int seg, char *text, int box_width, int text_len, bool invert, int delay) {
@@ -202,6 +213,7 @@ void ssd1306_display_text_x3(SSD1306_t *dev, int page, char *text, int text_len,
 
     int seg = 0;
 
+    ssd1306_batch_begin(dev);
     for (int nn = 0; nn < _text_len; nn++) {
         uint8_t const *const in_columns = font8x8_basic_tr[(uint8_t)text[nn]];
 
@@ -234,47 +246,28 @@ void ssd1306_display_text_x3(SSD1306_t *dev, int page, char *text, int text_len,
             }
             if (invert) ssd1306_invert(image, 24);
             if (dev->_flip) ssd1306_flip(image, 24);
-#ifdef CONFIG_SPI_INTERFACE
-            spi_display_image(dev, page + yy, seg, image, 24);
-#else
-            i2c_display_image(dev, page + yy, seg, image, 24);
-#endif
+            dev->_transport->display_image(dev, page + yy, seg, image, 24);
             memcpy(&dev->_page[page + yy]._segs[seg], image, 24);
         }
         seg = seg + 24;
     }
+    ssd1306_batch_end(dev);
 }
 
 void ssd1306_clear_screen(SSD1306_t *dev, bool invert) {
-#ifdef CONFIG_SPI_INTERFACE
-    for (int page = 0; page < dev->_pages; page++) {
-        memset(dev->_page[page]._segs, invert ? 0xFF : 0x00, sizeof(dev->_page[page]._segs));
-        spi_display_image(dev, page, 0, dev->_page[page]._segs, dev->_width);
-    }
-#else
     for (int page = 0; page < dev->_pages; page++) {
         memset(dev->_page[page]._segs, invert ? 0xFF : 0x00, sizeof(dev->_page[page]._segs));
-        i2c_display_image(dev, page, 0, dev->_page[page]._segs, dev->_width);
     }
-#endif
+    ssd1306_show_buffer(dev);
 }
 
 void ssd1306_clear_line(SSD1306_t *dev, int page, bool invert) {
-#ifdef CONFIG_SPI_INTERFACE
     memset(dev->_page[page]._segs, invert ? 0xFF : 0x00, sizeof(dev->_page[page]._segs));
-    spi_display_image(dev, page, 0, dev->_page[page]._segs, dev->_width);
-#else
-    memset(dev->_page[page]._segs, invert ? 0xFF : 0x00, sizeof(dev->_page[page]._segs));
-    i2c_display_image(dev, page, 0, dev->_page[page]._segs, dev->_width);
-#endif
+    dev->_transport->display_image(dev, page, 0, dev->_page[page]._segs, dev->_width);
 }
 
 void ssd1306_contrast(SSD1306_t *dev, int contrast) {
-#ifdef CONFIG_SPI_INTERFACE
-    spi_contrast(dev, contrast);
-#else
-    i2c_contrast(dev, contrast);
-#endif
+    dev->_transport->contrast(dev, contrast);
 }
 
 void ssd1306_software_scroll(SSD1306_t *dev, int start, int end) {
@@ -297,12 +290,9 @@ void ssd1306_scroll_text(SSD1306_t *dev, char *text, bool invert) {
     if (dev->_scEnable == false) return;
 
     void (*func)(SSD1306_t *dev, int page, int seg, uint8_t *images, int width);
-#ifdef CONFIG_SPI_INTERFACE
-    func = spi_display_image;
-#else
-    func = i2c_display_image;
-#endif
+    func = dev->_transport->display_image;
 
+    ssd1306_batch_begin(dev);
     int srcIndex = dev->_scEnd - dev->_scDirection;
     while (1) {
         int dstIndex = srcIndex + dev->_scDirection;
@@ -316,12 +306,14 @@ void ssd1306_scroll_text(SSD1306_t *dev, char *text, bool invert) {
     }
 
     ssd1306_display_text(dev, 0, srcIndex, text, invert);
+    ssd1306_batch_end(dev);
 }
 
 void ssd1306_scroll_clear(SSD1306_t *dev) {
     ESP_LOGD(TAG, "dev->_scEnable=%d", dev->_scEnable);
     if (dev->_scEnable == false) return;
 
+    ssd1306_batch_begin(dev);
     int srcIndex = dev->_scEnd - dev->_scDirection;
     while (1) {
         int dstIndex = srcIndex + dev->_scDirection;
@@ -330,14 +322,11 @@ void ssd1306_scroll_clear(SSD1306_t *dev) {
         if (dstIndex == dev->_scStart) break;
         srcIndex = srcIndex - dev->_scDirection;
     }
+    ssd1306_batch_end(dev);
 }
 
 void ssd1306_hardware_scroll(SSD1306_t *dev, ssd1306_scroll_type_t scroll) {
-#ifdef CONFIG_SPI_INTERFACE
-    spi_hardware_scroll(dev, scroll);
-#else
-    i2c_hardware_scroll(dev, scroll);
-#endif
+    dev->_transport->hardware_scroll(dev, scroll);
 }
 
 // delay = 0 : display with no wait
@@ -507,14 +496,12 @@ void ssd1306_wrap_arround(SSD1306_t *dev, ssd1306_scroll_type_t scroll, int star
         }
     }
 
-    if (delay >= 0) {
+    if (delay == 0) {
+        ssd1306_show_buffer(dev);
+    } else if (delay > 0) {
         for (int page = 0; page < dev->_pages; page++) {
-#ifdef CONFIG_SPI_INTERFACE
-            spi_display_image(dev, page, 0, dev->_page[page]._segs, 128);
-#else
-            i2c_display_image(dev, page, 0, dev->_page[page]._segs, 128);
-#endif
-            if (delay) vTaskDelay(delay);
+            dev->_transport->display_image(dev, page, 0, dev->_page[page]._segs, 128);
+            vTaskDelay(delay);
         }
     }
 }
@@ -706,11 +693,7 @@ static inline uint8_t ssd1306_rotate_byte(uint8_t ch1) {
 
 void ssd1306_fadeout(SSD1306_t *dev) {
     void (*func)(SSD1306_t *dev, int page, int seg, uint8_t *images, int width);
-#ifdef CONFIG_SPI_INTERFACE
-    func = spi_display_image;
-#else
-    func = i2c_display_image;
-#endif
+    func = dev->_transport->display_image;
 
     uint8_t image[1];
     for (int page = 0; page < dev->_pages; page++) {
@@ -721,10 +704,12 @@ void ssd1306_fadeout(SSD1306_t *dev) {
             } else {
                 image[0] = image[0] << 1;
             }
+            ssd1306_batch_begin(dev);
             for (int seg = 0; seg < 128; seg++) {
                 (*func)(dev, page, seg, image, 1);
                 dev->_page[page]._segs[seg] = image[0];
             }
+            ssd1306_batch_end(dev);
         }
     }
 }
@@ -764,6 +749,7 @@ void ssd1306_display_rotate_text(SSD1306_t *dev, int seg, char *text, int text_l
     if (_text_len > 8) _text_len = 8;
     uint8_t image[8];
     int _page = dev->_pages - 1;
+    ssd1306_batch_begin(dev);
     for (uint8_t i = 0; i < _text_len; i++) {
         memcpy(image, font8x8_basic_tr[(uint8_t)text[i]], 8);
         ssd1306_rotate_image(image, dev->_flip);
@@ -771,8 +757,9 @@ void ssd1306_display_rotate_text(SSD1306_t *dev, int seg, char *text, int text_l
         if (invert) ssd1306_invert(image, 8);
         ssd1306_display_image(dev, _page, seg, image, 8);
         _page--;
-        if (_page < 0) return;
+        if (_page < 0) break;
     }
+    ssd1306_batch_end(dev);
 }
 
 void ssd1306_dump(SSD1306_t dev) {
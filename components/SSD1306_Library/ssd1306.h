@@ -1,12 +1,19 @@
 #ifndef MAIN_SSD1306_H_
 #define MAIN_SSD1306_H_
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "sdkconfig.h"
+#include "esp_idf_version.h"
+#if !CONFIG_IDF_TARGET_LINUX
 #include "driver/spi_master.h"
 #if (ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 2, 0))
 #include "driver/i2c_master.h"
 #else
 #include "driver/i2c.h"
 #endif
+#endif
 
 // Following definitions are bollowed from 
 // http://robotcantalk.blogspot.com/2015/03/interfacing-arduino-with-ssd1306-driven.html
@@ -92,7 +99,22 @@ typedef struct {
 	uint8_t _segs[128];
 } PAGE_t;
 
+typedef struct SSD1306_t SSD1306_t;
+
+// Bus backend of a panel, set by i2c_master_init, spi_master_init or mock_master_init
 typedef struct {
+	void (*init)(SSD1306_t * dev, int width, int height);
+	void (*display_image)(SSD1306_t * dev, int page, int seg, uint8_t * images, int width);
+	void (*contrast)(SSD1306_t * dev, int contrast);
+	void (*hardware_scroll)(SSD1306_t * dev, ssd1306_scroll_type_t scroll);
+	// Optional whole frame write of _page, NULL sends it page by page through display_image
+	void (*show_buffer)(SSD1306_t * dev);
+	// Optional, writes between begin and end may be held back and sent as one transaction
+	void (*batch_begin)(SSD1306_t * dev);
+	void (*batch_end)(SSD1306_t * dev);
+} ssd1306_transport_t;
+
+struct SSD1306_t {
 	int _address;
 	int _width;
 	int _height;
@@ -104,13 +126,72 @@ typedef struct {
 	int _scDirection;
 	PAGE_t _page[8];
 	bool _flip;
+#if !CONFIG_IDF_TARGET_LINUX
 	i2c_port_t _i2c_num;
+	uint32_t _i2c_clk_hz; // Drops back to 400 kHz after repeated bus errors
+	int _i2c_errors;
 	spi_device_handle_t _spi_device_handle;
 #if (ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 2, 0))
 	i2c_master_bus_handle_t _i2c_bus_handle;
 	i2c_master_dev_handle_t _i2c_dev_handle;
 #endif
-} SSD1306_t;
+#endif
+	const ssd1306_transport_t * _transport;
+	void * _transport_ctx; // Backend state, e.g. ssd1306_mock_t
+};
+
+typedef enum {
+	MOCK_BUS_I2C = 0,
+	MOCK_BUS_SPI = 1
+} ssd1306_mock_bus_t;
+
+// Called for every command or data block the mock sees, buf holds the bytes after the control
+// byte or D/C pin. An i2c transaction can hold several blocks
+typedef void (*ssd1306_mock_record_t)(void * arg, bool data, const uint8_t * buf, size_t len);
+
+// Stream limits of the legacy i2c backend
+#define MOCK_I2C_STREAM_BLOCKS 24
+#define MOCK_I2C_STREAM_BYTES (128 * 8 + 64)
+
+typedef struct {
+	bool data;
+	uint16_t offset;
+	uint16_t len;
+} ssd1306_mock_block_t;
+
+// Recording transport with a bus time model and a GDDRAM model of the panel
+typedef struct {
+	ssd1306_mock_bus_t bus;
+	uint32_t clock_hz;
+	uint32_t transaction_overhead_ns; // Driver setup per transaction, 0 for wire time only
+
+	uint32_t transactions;
+	uint32_t command_bytes;
+	uint32_t data_bytes;
+	uint64_t bus_time_ns;
+
+	ssd1306_mock_record_t record;
+	void * record_arg;
+
+	// Panel state rebuilt from the command stream
+	uint8_t gddram[8][128];
+	uint8_t contrast;
+	uint8_t addr_mode;
+	uint8_t col, col_start, col_end;
+	uint8_t page, page_start, page_end;
+	uint8_t cmd[8];
+	uint8_t cmd_len;
+	uint8_t cmd_need;
+
+	// i2c stream held back until flush, like the legacy backend
+	uint8_t stream[MOCK_I2C_STREAM_BYTES];
+	ssd1306_mock_block_t blocks[MOCK_I2C_STREAM_BLOCKS];
+	int block_count;
+	int used;
+	int depth;
+	int cursor_page; // Panel column pointer after the staged writes, -1 if unknown
+	int cursor_seg;
+} ssd1306_mock_t;
 
 #ifdef __cplusplus
 extern "C"
@@ -123,11 +204,14 @@ int ssd1306_get_height(SSD1306_t * dev);
 int ssd1306_get_pages(SSD1306_t * dev);
 void ssd1306_show_buffer(SSD1306_t * dev);
 void ssd1306_show_buffer_page(SSD1306_t *dev, int page, int seg);
+void ssd1306_batch_begin(SSD1306_t * dev);
+void ssd1306_batch_end(SSD1306_t * dev);
 void ssd1306_set_buffer(SSD1306_t * dev, uint8_t * buffer);
 void ssd1306_get_buffer(SSD1306_t * dev, uint8_t * buffer);
 void ssd1306_set_page(SSD1306_t * dev, int page, uint8_t * buffer);
 void ssd1306_get_page(SSD1306_t * dev, int page, uint8_t * buffer);
 void ssd1306_display_image(SSD1306_t * dev, int page, int seg, uint8_t * images, int width);
+int _ssd1306_text(SSD1306_t * dev, int offset, int page, char * text, bool invert);
 void ssd1306_display_text(SSD1306_t *dev, int offset, int page, char *text, bool invert);
 void ssd1306_display_text_box1(SSD1306_t * dev, int page, int seg, char * text, int box_width, int text_len, bool invert, int delay);
 void ssd1306_display_text_box2(SSD1306_t * dev, int page, int seg, char * text, int box_width, int text_len, bool invert, int delay);
@@ -155,24 +239,40 @@ void ssd1306_display_rotate_text(SSD1306_t * dev, int seg, char * text, int text
 void ssd1306_dump(SSD1306_t dev);
 void ssd1306_dump_page(SSD1306_t * dev, int page, int seg);
 
+// Bus backends are not built for the linux target, only the mock transport
+#if !CONFIG_IDF_TARGET_LINUX
 void i2c_master_init(SSD1306_t * dev, int16_t sda, int16_t scl, int16_t reset);
 void i2c_device_add(SSD1306_t * dev, i2c_port_t i2c_num, int16_t reset, uint16_t i2c_address);
 void i2c_init(SSD1306_t * dev, int width, int height);
 void i2c_display_image(SSD1306_t * dev, int page, int seg, uint8_t * images, int width);
 void i2c_contrast(SSD1306_t * dev, int contrast);
 void i2c_hardware_scroll(SSD1306_t * dev, ssd1306_scroll_type_t scroll);
+void i2c_batch_begin(SSD1306_t * dev);
+void i2c_batch_end(SSD1306_t * dev);
+esp_err_t i2c_clock_speed(SSD1306_t * dev, uint32_t clk_hz);
+int i2c_clock_probe(SSD1306_t * dev, int count);
 
 void spi_clock_speed(int speed);
 void spi_master_init(SSD1306_t * dev, int16_t mosi, int16_t sclk, int16_t cs, int16_t dc, int16_t reset);
 void spi_device_add(SSD1306_t * dev, int16_t cs, int16_t dc, int16_t reset);
-bool spi_master_write_byte(spi_device_handle_t SPIHandle, const uint8_t* Data, size_t DataLength );
 bool spi_master_write_command(SSD1306_t * dev, uint8_t Command );
+bool spi_master_write_commands(SSD1306_t * dev, const uint8_t* Commands, size_t Length );
 bool spi_master_write_data(SSD1306_t * dev, const uint8_t* Data, size_t DataLength );
 void spi_init(SSD1306_t * dev, int width, int height);
 void spi_display_image(SSD1306_t * dev, int page, int seg, uint8_t * images, int width);
+void spi_show_buffer(SSD1306_t * dev);
 void spi_contrast(SSD1306_t * dev, int contrast);
 void spi_hardware_scroll(SSD1306_t * dev, ssd1306_scroll_type_t scroll);
 
+extern const ssd1306_transport_t ssd1306_i2c_transport;
+extern const ssd1306_transport_t ssd1306_spi_transport;
+#endif
+
+void mock_master_init(SSD1306_t * dev, ssd1306_mock_t * mock, ssd1306_mock_bus_t bus, uint32_t clock_hz);
+void mock_reset_stats(ssd1306_mock_t * mock);
+
+extern const ssd1306_transport_t ssd1306_mock_transport;
+
 #ifdef __cplusplus
 }
 #endif
@@ -1,3 +1,6 @@
+#include <assert.h>
+#include <inttypes.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "freertos/FreeRTOS.h"
@@ -20,6 +23,116 @@
 
 #define I2C_MASTER_FREQ_HZ 400000 // I2C clock of SSD1306 can run at 400 kHz max.
 #define I2C_TICKS_TO_WAIT 100	  // Maximum ticks to wait before issuing a timeout.
+#define I2C_FALLBACK_ERRORS 3	  // Failed writes in a row before going back to I2C_MASTER_FREQ_HZ
+#define I2C_PROBE_SIZE 128		  // Bytes per probe transaction, as long as a page write
+
+// Command stream builder.
+// Command and data blocks are staged and sent as one i2c_master_cmd_begin, each block after a
+// repeated start with its own control byte. The link is built on a static buffer at flush time,
+// so no heap allocation per transaction.
+#define I2C_STREAM_BLOCKS 24
+#define I2C_STREAM_BYTES (128 * 8 + 64) // Whole frame with its page addresses
+// Start, address, control byte and payload per block, one stop
+#define I2C_STREAM_LINK_SIZE I2C_LINK_RECOMMENDED_SIZE(I2C_STREAM_BLOCKS)
+
+typedef struct {
+	uint8_t control;
+	uint16_t offset;
+	uint16_t len;
+} i2c_stream_block_t;
+
+typedef struct {
+	uint8_t link[I2C_STREAM_LINK_SIZE];
+	uint8_t bytes[I2C_STREAM_BYTES];
+	i2c_stream_block_t blocks[I2C_STREAM_BLOCKS];
+	int block_count;
+	int used;
+	int depth; // Open batches, flushed when the last one ends
+	// Panel column pointer after the staged writes, -1 if unknown
+	int cursor_page;
+	int cursor_seg;
+	// Bus pins for a clock change, -1 if the driver was installed by someone else
+	int16_t sda;
+	int16_t scl;
+	bool probing; // Probe errors don't count for the fallback
+} i2c_stream_t;
+
+static void i2c_stream_init(SSD1306_t * dev, int16_t sda, int16_t scl)
+{
+	i2c_stream_t * stream = calloc(1, sizeof(i2c_stream_t));
+	assert(stream);
+	stream->cursor_page = -1;
+	stream->cursor_seg = -1;
+	stream->sda = sda;
+	stream->scl = scl;
+	dev->_transport_ctx = stream;
+	dev->_i2c_clk_hz = I2C_MASTER_FREQ_HZ;
+}
+
+static esp_err_t i2c_stream_flush(SSD1306_t * dev)
+{
+	i2c_stream_t * stream = dev->_transport_ctx;
+	if (stream->block_count == 0) return ESP_OK;
+
+	i2c_cmd_handle_t cmd = i2c_cmd_link_create_static(stream->link, sizeof(stream->link));
+	for (int i = 0; i < stream->block_count; i++) {
+		i2c_stream_block_t * block = &stream->blocks[i];
+		i2c_master_start(cmd);
+		i2c_master_write_byte(cmd, (dev->_address << 1) | I2C_MASTER_WRITE, true);
+		i2c_master_write_byte(cmd, block->control, true);
+		i2c_master_write(cmd, &stream->bytes[block->offset], block->len, true);
+	}
+	i2c_master_stop(cmd);
+
+	esp_err_t res = i2c_master_cmd_begin(dev->_i2c_num, cmd, I2C_TICKS_TO_WAIT);
+	i2c_cmd_link_delete_static(cmd);
+	stream->block_count = 0;
+	stream->used = 0;
+	if (res == ESP_OK) {
+		if (!stream->probing) dev->_i2c_errors = 0;
+		return res;
+	}
+
+	ESP_LOGE(TAG, "Stream command failed. code: 0x%.2X", res);
+	// Panel state unknown, address again on the next write
+	stream->cursor_page = -1;
+	stream->cursor_seg = -1;
+	// A raised clock that keeps failing goes back to the default
+	if (!stream->probing && ++dev->_i2c_errors >= I2C_FALLBACK_ERRORS && dev->_i2c_clk_hz > I2C_MASTER_FREQ_HZ) {
+		ESP_LOGW(TAG, "Too many errors at %"PRIu32" Hz, back to %d Hz", dev->_i2c_clk_hz, I2C_MASTER_FREQ_HZ);
+		i2c_clock_speed(dev, I2C_MASTER_FREQ_HZ);
+	}
+	return res;
+}
+
+// Stage a command or data block, extends the last block if it has the same control byte
+static void i2c_stream_append(SSD1306_t * dev, uint8_t control, const uint8_t * buf, int len)
+{
+	i2c_stream_t * stream = dev->_transport_ctx;
+	while (len > 0) {
+		i2c_stream_block_t * last = stream->block_count ? &stream->blocks[stream->block_count - 1] : NULL;
+		bool extend = last && last->control == control;
+		// Data may be split across flushes, commands stay together with their arguments
+		bool full = stream->used == I2C_STREAM_BYTES || (!extend && stream->block_count == I2C_STREAM_BLOCKS) ||
+			(control == OLED_CONTROL_BYTE_CMD_STREAM && stream->used + len > I2C_STREAM_BYTES);
+		if (full) {
+			i2c_stream_flush(dev);
+			continue;
+		}
+
+		int n = I2C_STREAM_BYTES - stream->used;
+		if (n > len) n = len;
+		memcpy(&stream->bytes[stream->used], buf, n);
+		if (extend) {
+			last->len += n;
+		} else {
+			stream->blocks[stream->block_count++] = (i2c_stream_block_t){control, stream->used, n};
+		}
+		stream->used += n;
+		buf += n;
+		len -= n;
+	}
+}
 
 void i2c_master_init(SSD1306_t * dev, int16_t sda, int16_t scl, int16_t reset)
 {
@@ -47,6 +160,8 @@ void i2c_master_init(SSD1306_t * dev, int16_t sda, int16_t scl, int16_t reset)
 	dev->_address = I2C_ADDRESS;
 	dev->_flip = false;
 	dev->_i2c_num = I2C_NUM;
+	dev->_transport = &ssd1306_i2c_transport;
+	i2c_stream_init(dev, sda, scl);
 }
 
 void i2c_device_add(SSD1306_t * dev, i2c_port_t i2c_num, int16_t reset, uint16_t i2c_address)
@@ -78,6 +193,8 @@ void i2c_device_add(SSD1306_t * dev, i2c_port_t i2c_num, int16_t reset, uint16_t
 	dev->_address = i2c_address;
 	dev->_flip = false;
 	dev->_i2c_num = i2c_num;
+	dev->_transport = &ssd1306_i2c_transport;
+	i2c_stream_init(dev, -1, -1);
 }
 
 void i2c_init(SSD1306_t * dev, int width, int height) {
@@ -85,59 +202,51 @@ void i2c_init(SSD1306_t * dev, int width, int height) {
 	dev->_height = height;
 	dev->_pages = 8;
 	if (dev->_height == 32) dev->_pages = 4;
-	
-	i2c_cmd_handle_t cmd = i2c_cmd_link_create();
-
-	i2c_master_start(cmd);
-	i2c_master_write_byte(cmd, (dev->_address << 1) | I2C_MASTER_WRITE, true);
-	i2c_master_write_byte(cmd, OLED_CONTROL_BYTE_CMD_STREAM, true);
-	i2c_master_write_byte(cmd, OLED_CMD_DISPLAY_OFF, true);				// AE
-	i2c_master_write_byte(cmd, OLED_CMD_SET_MUX_RATIO, true);			// A8
-	if (dev->_height == 64) i2c_master_write_byte(cmd, 0x3F, true);
-	if (dev->_height == 32) i2c_master_write_byte(cmd, 0x1F, true);
-	i2c_master_write_byte(cmd, OLED_CMD_SET_DISPLAY_OFFSET, true);		// D3
-	i2c_master_write_byte(cmd, 0x00, true);
-	//i2c_master_write_byte(cmd, OLED_CONTROL_BYTE_DATA_STREAM, true);	// 40
-	i2c_master_write_byte(cmd, OLED_CMD_SET_DISPLAY_START_LINE, true);	// 40
-	//i2c_master_write_byte(cmd, OLED_CMD_SET_SEGMENT_REMAP, true);		// A1
+
+	uint8_t out_buf[27];
+	int out_index = 0;
+	out_buf[out_index++] = OLED_CMD_DISPLAY_OFF;				// AE
+	out_buf[out_index++] = OLED_CMD_SET_MUX_RATIO;			// A8
+	if (dev->_height == 64) out_buf[out_index++] = 0x3F;
+	if (dev->_height == 32) out_buf[out_index++] = 0x1F;
+	out_buf[out_index++] = OLED_CMD_SET_DISPLAY_OFFSET;		// D3
+	out_buf[out_index++] = 0x00;
+	out_buf[out_index++] = OLED_CMD_SET_DISPLAY_START_LINE;	// 40
 	if (dev->_flip) {
-		i2c_master_write_byte(cmd, OLED_CMD_SET_SEGMENT_REMAP_0, true); // A0
+		out_buf[out_index++] = OLED_CMD_SET_SEGMENT_REMAP_0;	// A0
 	} else {
-		i2c_master_write_byte(cmd, OLED_CMD_SET_SEGMENT_REMAP_1, true);	// A1
+		out_buf[out_index++] = OLED_CMD_SET_SEGMENT_REMAP_1;	// A1
 	}
-	i2c_master_write_byte(cmd, OLED_CMD_SET_COM_SCAN_MODE, true);		// C8
-	i2c_master_write_byte(cmd, OLED_CMD_SET_DISPLAY_CLK_DIV, true);		// D5
-	i2c_master_write_byte(cmd, 0x80, true);
-	i2c_master_write_byte(cmd, OLED_CMD_SET_COM_PIN_MAP, true);			// DA
-	if (dev->_height == 64) i2c_master_write_byte(cmd, 0x12, true);
-	if (dev->_height == 32) i2c_master_write_byte(cmd, 0x02, true);
-	i2c_master_write_byte(cmd, OLED_CMD_SET_CONTRAST, true);			// 81
-	i2c_master_write_byte(cmd, 0xFF, true);
-	i2c_master_write_byte(cmd, OLED_CMD_DISPLAY_RAM, true);				// A4
-	i2c_master_write_byte(cmd, OLED_CMD_SET_VCOMH_DESELCT, true);		// DB
-	i2c_master_write_byte(cmd, 0x40, true);
-	i2c_master_write_byte(cmd, OLED_CMD_SET_MEMORY_ADDR_MODE, true);	// 20
-	//i2c_master_write_byte(cmd, OLED_CMD_SET_HORI_ADDR_MODE, true);	// 00
-	i2c_master_write_byte(cmd, OLED_CMD_SET_PAGE_ADDR_MODE, true);		// 02
+	out_buf[out_index++] = OLED_CMD_SET_COM_SCAN_MODE;		// C8
+	out_buf[out_index++] = OLED_CMD_SET_DISPLAY_CLK_DIV;		// D5
+	out_buf[out_index++] = 0x80;
+	out_buf[out_index++] = OLED_CMD_SET_COM_PIN_MAP;			// DA
+	if (dev->_height == 64) out_buf[out_index++] = 0x12;
+	if (dev->_height == 32) out_buf[out_index++] = 0x02;
+	out_buf[out_index++] = OLED_CMD_SET_CONTRAST;			// 81
+	out_buf[out_index++] = 0xFF;
+	out_buf[out_index++] = OLED_CMD_DISPLAY_RAM;				// A4
+	out_buf[out_index++] = OLED_CMD_SET_VCOMH_DESELCT;		// DB
+	out_buf[out_index++] = 0x40;
+	out_buf[out_index++] = OLED_CMD_SET_MEMORY_ADDR_MODE;	// 20
+	out_buf[out_index++] = OLED_CMD_SET_PAGE_ADDR_MODE;		// 02
 	// Set Lower Column Start Address for Page Addressing Mode
-	i2c_master_write_byte(cmd, 0x00, true);
+	out_buf[out_index++] = 0x00;
 	// Set Higher Column Start Address for Page Addressing Mode
-	i2c_master_write_byte(cmd, 0x10, true);
-	i2c_master_write_byte(cmd, OLED_CMD_SET_CHARGE_PUMP, true);			// 8D
-	i2c_master_write_byte(cmd, 0x14, true);
-	i2c_master_write_byte(cmd, OLED_CMD_DEACTIVE_SCROLL, true);			// 2E
-	i2c_master_write_byte(cmd, OLED_CMD_DISPLAY_NORMAL, true);			// A6
-	i2c_master_write_byte(cmd, OLED_CMD_DISPLAY_ON, true);				// AF
-
-	i2c_master_stop(cmd);
-
-	esp_err_t res = i2c_master_cmd_begin(dev->_i2c_num, cmd, I2C_TICKS_TO_WAIT);
+	out_buf[out_index++] = 0x10;
+	out_buf[out_index++] = OLED_CMD_SET_CHARGE_PUMP;			// 8D
+	out_buf[out_index++] = 0x14;
+	out_buf[out_index++] = OLED_CMD_DEACTIVE_SCROLL;			// 2E
+	out_buf[out_index++] = OLED_CMD_DISPLAY_NORMAL;			// A6
+	out_buf[out_index++] = OLED_CMD_DISPLAY_ON;				// AF
+
+	i2c_stream_append(dev, OLED_CONTROL_BYTE_CMD_STREAM, out_buf, out_index);
+	esp_err_t res = i2c_stream_flush(dev);
 	if (res == ESP_OK) {
 		ESP_LOGI(TAG, "OLED configured successfully");
 	} else {
 		ESP_LOGE(TAG, "OLED configuration failed. code: 0x%.2X", res);
 	}
-	i2c_cmd_link_delete(cmd);
 }
 
 
@@ -154,37 +263,26 @@ void i2c_display_image(SSD1306_t * dev, int page, int seg, uint8_t * images, int
 		_page = (dev->_pages - page) - 1;
 	}
 
-	i2c_cmd_handle_t cmd = i2c_cmd_link_create();
-	i2c_master_start(cmd);
-	i2c_master_write_byte(cmd, (dev->_address << 1) | I2C_MASTER_WRITE, true);
-
-	i2c_master_write_byte(cmd, OLED_CONTROL_BYTE_CMD_STREAM, true);
-	// Set Lower Column Start Address for Page Addressing Mode
-	i2c_master_write_byte(cmd, (0x00 + columLow), true);
-	// Set Higher Column Start Address for Page Addressing Mode
-	i2c_master_write_byte(cmd, (0x10 + columHigh), true);
-	// Set Page Start Address for Page Addressing Mode
-	i2c_master_write_byte(cmd, 0xB0 | _page, true);
-
-	i2c_master_stop(cmd);
-	esp_err_t res = i2c_master_cmd_begin(dev->_i2c_num, cmd, I2C_TICKS_TO_WAIT);
-	if (res != ESP_OK) {
-		ESP_LOGE(TAG, "Image command failed. code: 0x%.2X", res);
+	i2c_stream_t * stream = dev->_transport_ctx;
+	// Continue the previous write if the column pointer is already there
+	if (stream->cursor_page != _page || stream->cursor_seg != _seg) {
+		uint8_t out_buf[3] = {
+			// Set Lower Column Start Address for Page Addressing Mode
+			0x00 + columLow,
+			// Set Higher Column Start Address for Page Addressing Mode
+			0x10 + columHigh,
+			// Set Page Start Address for Page Addressing Mode
+			0xB0 | _page,
+		};
+		i2c_stream_append(dev, OLED_CONTROL_BYTE_CMD_STREAM, out_buf, sizeof(out_buf));
 	}
-	i2c_cmd_link_delete(cmd);
+	i2c_stream_append(dev, OLED_CONTROL_BYTE_DATA_STREAM, images, width);
 
-	cmd = i2c_cmd_link_create();
-	i2c_master_start(cmd);
-	i2c_master_write_byte(cmd, (dev->_address << 1) | I2C_MASTER_WRITE, true);
-	i2c_master_write_byte(cmd, OLED_CONTROL_BYTE_DATA_STREAM, true);
-	i2c_master_write(cmd, images, width, true);
-	i2c_master_stop(cmd);
-
-	res = i2c_master_cmd_begin(dev->_i2c_num, cmd, I2C_TICKS_TO_WAIT);
-	if (res != ESP_OK) {
-		ESP_LOGE(TAG, "Image command failed. code: 0x%.2X", res);
-	}
-	i2c_cmd_link_delete(cmd);
+	// Page addressing wraps within the page, don't follow that
+	stream->cursor_page = _page;
+	stream->cursor_seg = _seg + width < 128 ? _seg + width : -1;
+	if (stream->depth == 0)
+		i2c_stream_flush(dev);
 }
 
 void i2c_contrast(SSD1306_t * dev, int contrast) {
@@ -192,98 +290,142 @@ void i2c_contrast(SSD1306_t * dev, int contrast) {
 	if (contrast < 0x0) _contrast = 0;
 	if (contrast > 0xFF) _contrast = 0xFF;
 
-	i2c_cmd_handle_t cmd = i2c_cmd_link_create();
-	i2c_master_start(cmd);
-	i2c_master_write_byte(cmd, (dev->_address << 1) | I2C_MASTER_WRITE, true);
-	i2c_master_write_byte(cmd, OLED_CONTROL_BYTE_CMD_STREAM, true); // 00
-	i2c_master_write_byte(cmd, OLED_CMD_SET_CONTRAST, true); // 81
-	i2c_master_write_byte(cmd, _contrast, true);
-	i2c_master_stop(cmd);
-
-	esp_err_t res = i2c_master_cmd_begin(dev->_i2c_num, cmd, I2C_TICKS_TO_WAIT);
-	if (res != ESP_OK) {
-		ESP_LOGE(TAG, "Contrast command failed. code: 0x%.2X", res);
-	}
-	i2c_cmd_link_delete(cmd);
+	uint8_t out_buf[2] = {OLED_CMD_SET_CONTRAST, _contrast}; // 81
+	i2c_stream_append(dev, OLED_CONTROL_BYTE_CMD_STREAM, out_buf, sizeof(out_buf));
+	if (((i2c_stream_t *)dev->_transport_ctx)->depth == 0)
+		i2c_stream_flush(dev);
 }
 
 
 void i2c_hardware_scroll(SSD1306_t * dev, ssd1306_scroll_type_t scroll) {
-	i2c_cmd_handle_t cmd = i2c_cmd_link_create();
-	i2c_master_start(cmd);
-
-	i2c_master_write_byte(cmd, (dev->_address << 1) | I2C_MASTER_WRITE, true);
-	i2c_master_write_byte(cmd, OLED_CONTROL_BYTE_CMD_STREAM, true); // 00
+	uint8_t out_buf[11];
+	int out_index = 0;
 
 	if (scroll == SCROLL_RIGHT) {
-		i2c_master_write_byte(cmd, OLED_CMD_HORIZONTAL_RIGHT, true); // 26
-		i2c_master_write_byte(cmd, 0x00, true); // Dummy byte
-		i2c_master_write_byte(cmd, 0x00, true); // Define start page address
-		i2c_master_write_byte(cmd, 0x07, true); // Frame frequency
-		i2c_master_write_byte(cmd, 0x07, true); // Define end page address
-		i2c_master_write_byte(cmd, 0x00, true); //
-		i2c_master_write_byte(cmd, 0xFF, true); //
-		i2c_master_write_byte(cmd, OLED_CMD_ACTIVE_SCROLL, true); // 2F
-	} 
+		out_buf[out_index++] = OLED_CMD_HORIZONTAL_RIGHT; // 26
+		out_buf[out_index++] = 0x00; // Dummy byte
+		out_buf[out_index++] = 0x00; // Define start page address
+		out_buf[out_index++] = 0x07; // Frame frequency
+		out_buf[out_index++] = 0x07; // Define end page address
+		out_buf[out_index++] = 0x00; //
+		out_buf[out_index++] = 0xFF; //
+		out_buf[out_index++] = OLED_CMD_ACTIVE_SCROLL; // 2F
+	}
 
 	if (scroll == SCROLL_LEFT) {
-		i2c_master_write_byte(cmd, OLED_CMD_HORIZONTAL_LEFT, true); // 27
-		i2c_master_write_byte(cmd, 0x00, true); // Dummy byte
-		i2c_master_write_byte(cmd, 0x00, true); // Define start page address
-		i2c_master_write_byte(cmd, 0x07, true); // Frame frequency
-		i2c_master_write_byte(cmd, 0x07, true); // Define end page address
-		i2c_master_write_byte(cmd, 0x00, true); //
-		i2c_master_write_byte(cmd, 0xFF, true); //
-		i2c_master_write_byte(cmd, OLED_CMD_ACTIVE_SCROLL, true); // 2F
-	} 
+		out_buf[out_index++] = OLED_CMD_HORIZONTAL_LEFT; // 27
+		out_buf[out_index++] = 0x00; // Dummy byte
+		out_buf[out_index++] = 0x00; // Define start page address
+		out_buf[out_index++] = 0x07; // Frame frequency
+		out_buf[out_index++] = 0x07; // Define end page address
+		out_buf[out_index++] = 0x00; //
+		out_buf[out_index++] = 0xFF; //
+		out_buf[out_index++] = OLED_CMD_ACTIVE_SCROLL; // 2F
+	}
 
 	if (scroll == SCROLL_DOWN) {
-		i2c_master_write_byte(cmd, OLED_CMD_CONTINUOUS_SCROLL, true); // 29
-		i2c_master_write_byte(cmd, 0x00, true); // Dummy byte
-		i2c_master_write_byte(cmd, 0x00, true); // Define start page address
-		i2c_master_write_byte(cmd, 0x07, true); // Frame frequency
-		//i2c_master_write_byte(cmd, 0x01, true); // Define end page address
-		i2c_master_write_byte(cmd, 0x00, true); // Define end page address
-		i2c_master_write_byte(cmd, 0x3F, true); // Vertical scrolling offset
-
-		i2c_master_write_byte(cmd, OLED_CMD_VERTICAL, true); // A3
-		i2c_master_write_byte(cmd, 0x00, true);
+		out_buf[out_index++] = OLED_CMD_CONTINUOUS_SCROLL; // 29
+		out_buf[out_index++] = 0x00; // Dummy byte
+		out_buf[out_index++] = 0x00; // Define start page address
+		out_buf[out_index++] = 0x07; // Frame frequency
+		out_buf[out_index++] = 0x00; // Define end page address
+		out_buf[out_index++] = 0x3F; // Vertical scrolling offset
+
+		out_buf[out_index++] = OLED_CMD_VERTICAL; // A3
+		out_buf[out_index++] = 0x00;
 		if (dev->_height == 64)
-		//i2c_master_write_byte(cmd, 0x7F, true);
-		i2c_master_write_byte(cmd, 0x40, true);
+		out_buf[out_index++] = 0x40;
 		if (dev->_height == 32)
-		i2c_master_write_byte(cmd, 0x20, true);
-		i2c_master_write_byte(cmd, OLED_CMD_ACTIVE_SCROLL, true); // 2F
+		out_buf[out_index++] = 0x20;
+		out_buf[out_index++] = OLED_CMD_ACTIVE_SCROLL; // 2F
 	}
 
 	if (scroll == SCROLL_UP) {
-		i2c_master_write_byte(cmd, OLED_CMD_CONTINUOUS_SCROLL, true); // 29
-		i2c_master_write_byte(cmd, 0x00, true); // Dummy byte
-		i2c_master_write_byte(cmd, 0x00, true); // Define start page address
-		i2c_master_write_byte(cmd, 0x07, true); // Frame frequency
-		//i2c_master_write_byte(cmd, 0x01, true); // Define end page address
-		i2c_master_write_byte(cmd, 0x00, true); // Define end page address
-		i2c_master_write_byte(cmd, 0x01, true); // Vertical scrolling offset
-
-		i2c_master_write_byte(cmd, OLED_CMD_VERTICAL, true); // A3
-		i2c_master_write_byte(cmd, 0x00, true);
+		out_buf[out_index++] = OLED_CMD_CONTINUOUS_SCROLL; // 29
+		out_buf[out_index++] = 0x00; // Dummy byte
+		out_buf[out_index++] = 0x00; // Define start page address
+		out_buf[out_index++] = 0x07; // Frame frequency
+		out_buf[out_index++] = 0x00; // Define end page address
+		out_buf[out_index++] = 0x01; // Vertical scrolling offset
+
+		out_buf[out_index++] = OLED_CMD_VERTICAL; // A3
+		out_buf[out_index++] = 0x00;
 		if (dev->_height == 64)
-		//i2c_master_write_byte(cmd, 0x7F, true);
-		i2c_master_write_byte(cmd, 0x40, true);
+		out_buf[out_index++] = 0x40;
 		if (dev->_height == 32)
-		i2c_master_write_byte(cmd, 0x20, true);
-		i2c_master_write_byte(cmd, OLED_CMD_ACTIVE_SCROLL, true); // 2F
+		out_buf[out_index++] = 0x20;
+		out_buf[out_index++] = OLED_CMD_ACTIVE_SCROLL; // 2F
 	}
 
 	if (scroll == SCROLL_STOP) {
-		i2c_master_write_byte(cmd, OLED_CMD_DEACTIVE_SCROLL, true); // 2E
+		out_buf[out_index++] = OLED_CMD_DEACTIVE_SCROLL; // 2E
 	}
 
-	i2c_master_stop(cmd);
+	if (out_index == 0) return;
+	i2c_stream_append(dev, OLED_CONTROL_BYTE_CMD_STREAM, out_buf, out_index);
+	if (((i2c_stream_t *)dev->_transport_ctx)->depth == 0)
+		i2c_stream_flush(dev);
+}
 
-	esp_err_t res = i2c_master_cmd_begin(dev->_i2c_num, cmd, I2C_TICKS_TO_WAIT);
+void i2c_batch_begin(SSD1306_t * dev) {
+	i2c_stream_t * stream = dev->_transport_ctx;
+	stream->depth++;
+}
+
+void i2c_batch_end(SSD1306_t * dev) {
+	i2c_stream_t * stream = dev->_transport_ctx;
+	if (stream->depth > 0 && --stream->depth == 0)
+		i2c_stream_flush(dev);
+}
+
+// Only for a driver installed by i2c_master_init, the pins are needed to configure the bus again
+esp_err_t i2c_clock_speed(SSD1306_t * dev, uint32_t clk_hz) {
+	i2c_stream_t * stream = dev->_transport_ctx;
+	if (stream->sda < 0 || stream->scl < 0) return ESP_ERR_NOT_SUPPORTED;
+	i2c_stream_flush(dev);
+
+	i2c_config_t i2c_config = {
+		.mode = I2C_MODE_MASTER,
+		.sda_io_num = stream->sda,
+		.scl_io_num = stream->scl,
+		.sda_pullup_en = GPIO_PULLUP_ENABLE,
+		.scl_pullup_en = GPIO_PULLUP_ENABLE,
+		.master.clk_speed = clk_hz
+	};
+	esp_err_t res = i2c_param_config(dev->_i2c_num, &i2c_config);
 	if (res != ESP_OK) {
-		ESP_LOGE(TAG, "Scroll command failed. code: 0x%.2X", res);
+		ESP_LOGE(TAG, "Could not set clock %"PRIu32" Hz. code: 0x%.2X", clk_hz, res);
+		return res;
 	}
-	i2c_cmd_link_delete(cmd);
-}
\ No newline at end of file
+	dev->_i2c_clk_hz = clk_hz;
+	dev->_i2c_errors = 0;
+	return ESP_OK;
+}
+
+// Sends count page-sized NOP command streams, returns how many were not acknowledged.
+// Doesn't change panel state, there is no read-back on the write-only bus
+int i2c_clock_probe(SSD1306_t * dev, int count) {
+	i2c_stream_t * stream = dev->_transport_ctx;
+	i2c_stream_flush(dev);
+
+	uint8_t out_buf[I2C_PROBE_SIZE];
+	memset(out_buf, OLED_CMD_NOP, sizeof(out_buf));
+	int errors = 0;
+	stream->probing = true;
+	for (int i = 0; i < count; i++) {
+		i2c_stream_append(dev, OLED_CONTROL_BYTE_CMD_STREAM, out_buf, sizeof(out_buf));
+		if (i2c_stream_flush(dev) != ESP_OK)
+			errors++;
+	}
+	stream->probing = false;
+	return errors;
+}
+
+const ssd1306_transport_t ssd1306_i2c_transport = {
+	.init = i2c_init,
+	.display_image = i2c_display_image,
+	.contrast = i2c_contrast,
+	.hardware_scroll = i2c_hardware_scroll,
+	.batch_begin = i2c_batch_begin,
+	.batch_end = i2c_batch_end,
+};
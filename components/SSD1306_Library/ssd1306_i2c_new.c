@@ -1,3 +1,4 @@
+#include <inttypes.h>
 #include <string.h>
 
 #include "freertos/FreeRTOS.h"
@@ -20,6 +21,24 @@
 
 #define I2C_MASTER_FREQ_HZ 400000 // I2C clock of SSD1306 can run at 400 kHz max.
 #define I2C_TICKS_TO_WAIT 100	  // Maximum ticks to wait before issuing a timeout.
+#define I2C_FALLBACK_ERRORS 3	  // Failed writes in a row before going back to I2C_MASTER_FREQ_HZ
+#define I2C_PROBE_SIZE 128		  // Bytes per probe transaction, as long as a page write
+
+// Counts failed writes, a raised clock that keeps failing goes back to the default
+static esp_err_t i2c_write(SSD1306_t * dev, const uint8_t * buf, size_t len)
+{
+	esp_err_t res = i2c_master_transmit(dev->_i2c_dev_handle, buf, len, I2C_TICKS_TO_WAIT);
+	if (res == ESP_OK) {
+		dev->_i2c_errors = 0;
+		return res;
+	}
+	ESP_LOGE(TAG, "Could not write to device [0x%02x at %d]: %d (%s)", dev->_address, dev->_i2c_num, res, esp_err_to_name(res));
+	if (++dev->_i2c_errors >= I2C_FALLBACK_ERRORS && dev->_i2c_clk_hz > I2C_MASTER_FREQ_HZ) {
+		ESP_LOGW(TAG, "Too many errors at %"PRIu32" Hz, back to %d Hz", dev->_i2c_clk_hz, I2C_MASTER_FREQ_HZ);
+		i2c_clock_speed(dev, I2C_MASTER_FREQ_HZ);
+	}
+	return res;
+}
 
 void i2c_master_init(SSD1306_t * dev, int16_t sda, int16_t scl, int16_t reset)
 {
@@ -55,8 +74,10 @@ void i2c_master_init(SSD1306_t * dev, int16_t sda, int16_t scl, int16_t reset)
 	dev->_address = I2C_ADDRESS;
 	dev->_flip = false;
 	dev->_i2c_num = I2C_NUM;
+	dev->_transport = &ssd1306_i2c_transport;
 	dev->_i2c_bus_handle = i2c_bus_handle;
 	dev->_i2c_dev_handle = i2c_dev_handle;
+	dev->_i2c_clk_hz = I2C_MASTER_FREQ_HZ;
 }
 
 void i2c_device_add(SSD1306_t * dev, i2c_port_t i2c_num, int16_t reset, uint16_t i2c_address)
@@ -96,7 +117,9 @@ void i2c_device_add(SSD1306_t * dev, i2c_port_t i2c_num, int16_t reset, uint16_t
 	dev->_address = i2c_address;
 	dev->_flip = false;
 	dev->_i2c_num = i2c_num;
+	dev->_transport = &ssd1306_i2c_transport;
 	dev->_i2c_dev_handle = i2c_dev_handle;
+	dev->_i2c_clk_hz = I2C_MASTER_FREQ_HZ;
 }
 
 void i2c_init(SSD1306_t * dev, int width, int height) {
@@ -146,12 +169,9 @@ void i2c_init(SSD1306_t * dev, int width, int height) {
 	out_buf[out_index++] = OLED_CMD_DISPLAY_NORMAL;			// A6
 	out_buf[out_index++] = OLED_CMD_DISPLAY_ON;				// AF
 
-	esp_err_t res;
-	res = i2c_master_transmit(dev->_i2c_dev_handle, out_buf, out_index, I2C_TICKS_TO_WAIT);
+	esp_err_t res = i2c_write(dev, out_buf, out_index);
 	if (res == ESP_OK) {
 		ESP_LOGI(TAG, "OLED configured successfully");
-	} else {
-		ESP_LOGE(TAG, "Could not write to device [0x%02x at %d]: %d (%s)", dev->_address, dev->_i2c_num, res, esp_err_to_name(res));
 	}
 }
 
@@ -184,17 +204,12 @@ void i2c_display_image(SSD1306_t * dev, int page, int seg, uint8_t * images, int
 	// Set Page Start Address for Page Addressing Mode
 	out_buf[out_index++] = 0xB0 | _page;
 
-	esp_err_t res;
-	res = i2c_master_transmit(dev->_i2c_dev_handle, out_buf, out_index, I2C_TICKS_TO_WAIT);
-	if (res != ESP_OK)
-		ESP_LOGE(TAG, "Could not write to device [0x%02x at %d]: %d (%s)", dev->_address, dev->_i2c_num, res, esp_err_to_name(res));
+	i2c_write(dev, out_buf, out_index);
 
 	out_buf[0] = OLED_CONTROL_BYTE_DATA_STREAM;
 	memcpy(&out_buf[1], images, width);
 
-	res = i2c_master_transmit(dev->_i2c_dev_handle, out_buf, width + 1, I2C_TICKS_TO_WAIT);
-	if (res != ESP_OK)
-		ESP_LOGE(TAG, "Could not write to device [0x%02x at %d]: %d (%s)", dev->_address, dev->_i2c_num, res, esp_err_to_name(res));
+	i2c_write(dev, out_buf, width + 1);
 	free(out_buf);
 }
 
@@ -209,9 +224,7 @@ void i2c_contrast(SSD1306_t * dev, int contrast) {
 	out_buf[out_index++] = OLED_CMD_SET_CONTRAST; // 81
 	out_buf[out_index++] = _contrast;
 
-	esp_err_t res = i2c_master_transmit(dev->_i2c_dev_handle, out_buf, 3, I2C_TICKS_TO_WAIT);
-	if (res != ESP_OK)
-		ESP_LOGE(TAG, "Could not write to device [0x%02x at %d]: %d (%s)", dev->_address, dev->_i2c_num, res, esp_err_to_name(res));
+	i2c_write(dev, out_buf, 3);
 }
 
 
@@ -284,7 +297,49 @@ void i2c_hardware_scroll(SSD1306_t * dev, ssd1306_scroll_type_t scroll) {
 		out_buf[out_index++] = OLED_CMD_DEACTIVE_SCROLL; // 2E
 	}
 
-	esp_err_t res = i2c_master_transmit(dev->_i2c_dev_handle, out_buf, out_index, I2C_TICKS_TO_WAIT);
-	if (res != ESP_OK)
-		ESP_LOGE(TAG, "Could not write to device [0x%02x at %d]: %d (%s)", dev->_address, dev->_i2c_num, res, esp_err_to_name(res));
+	i2c_write(dev, out_buf, out_index);
+}
+
+// The device is added again with the new SCL speed
+esp_err_t i2c_clock_speed(SSD1306_t * dev, uint32_t clk_hz) {
+	i2c_device_config_t dev_cfg = {
+		.dev_addr_length = I2C_ADDR_BIT_LEN_7,
+		.device_address = dev->_address,
+		.scl_speed_hz = clk_hz,
+	};
+	i2c_master_dev_handle_t i2c_dev_handle;
+	ESP_ERROR_CHECK(i2c_master_bus_rm_device(dev->_i2c_dev_handle));
+	esp_err_t res = i2c_master_bus_add_device(dev->_i2c_bus_handle, &dev_cfg, &i2c_dev_handle);
+	if (res != ESP_OK) {
+		ESP_LOGE(TAG, "Could not set clock %"PRIu32" Hz: %s", clk_hz, esp_err_to_name(res));
+		dev_cfg.scl_speed_hz = dev->_i2c_clk_hz;
+		ESP_ERROR_CHECK(i2c_master_bus_add_device(dev->_i2c_bus_handle, &dev_cfg, &i2c_dev_handle));
+	} else {
+		dev->_i2c_clk_hz = clk_hz;
+	}
+	dev->_i2c_dev_handle = i2c_dev_handle;
+	dev->_i2c_errors = 0;
+	return res;
+}
+
+// Sends count page-sized NOP command streams, returns how many were not acknowledged.
+// Doesn't change panel state, there is no read-back on the write-only bus
+int i2c_clock_probe(SSD1306_t * dev, int count) {
+	uint8_t out_buf[I2C_PROBE_SIZE + 1];
+	out_buf[0] = OLED_CONTROL_BYTE_CMD_STREAM;
+	memset(&out_buf[1], OLED_CMD_NOP, I2C_PROBE_SIZE);
+
+	int errors = 0;
+	for (int i = 0; i < count; i++) {
+		if (i2c_master_transmit(dev->_i2c_dev_handle, out_buf, sizeof(out_buf), I2C_TICKS_TO_WAIT) != ESP_OK)
+			errors++;
+	}
+	return errors;
 }
+
+const ssd1306_transport_t ssd1306_i2c_transport = {
+	.init = i2c_init,
+	.display_image = i2c_display_image,
+	.contrast = i2c_contrast,
+	.hardware_scroll = i2c_hardware_scroll,
+};
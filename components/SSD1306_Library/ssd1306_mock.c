@@ -0,0 +1,401 @@
+#include <string.h>
+
+#include "ssd1306.h"
+
+// Recording transport for tests and driver benchmarks.
+// Sends the same byte streams as the legacy i2c and the spi backends, so counters and bus time
+// match what real hardware would see at the given clock. On i2c, writes are staged and flushed
+// like ssd1306_i2c_legacy.c does: one transaction per flush, a repeated start per block.
+
+// Start or repeated start of an i2c block, stop of the transaction, data and ack bits of a byte
+#define I2C_START_BITS 1
+#define I2C_STOP_BITS 1
+#define I2C_BITS_PER_BYTE 9
+
+static uint8_t mock_command_args(uint8_t command)
+{
+	switch (command) {
+	case OLED_CMD_SET_COLUMN_RANGE:
+	case OLED_CMD_SET_PAGE_RANGE:
+	case OLED_CMD_VERTICAL:
+		return 2;
+	case OLED_CMD_CONTINUOUS_SCROLL:
+	case 0x2A:
+		return 5;
+	case OLED_CMD_HORIZONTAL_RIGHT:
+	case OLED_CMD_HORIZONTAL_LEFT:
+		return 6;
+	case OLED_CMD_SET_MEMORY_ADDR_MODE:
+	case OLED_CMD_SET_CONTRAST:
+	case OLED_CMD_SET_CHARGE_PUMP:
+	case OLED_CMD_SET_MUX_RATIO:
+	case OLED_CMD_SET_DISPLAY_OFFSET:
+	case OLED_CMD_SET_DISPLAY_CLK_DIV:
+	case OLED_CMD_SET_PRECHARGE:
+	case OLED_CMD_SET_COM_PIN_MAP:
+	case OLED_CMD_SET_VCOMH_DESELCT:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+static void mock_apply_command(ssd1306_mock_t * mock)
+{
+	uint8_t *cmd = mock->cmd;
+	if (cmd[0] <= 0x0F) {
+		mock->col = (mock->col & 0xF0) | cmd[0];
+	} else if (cmd[0] <= 0x1F) {
+		mock->col = (mock->col & 0x0F) | ((cmd[0] & 0x0F) << 4);
+	} else if (cmd[0] >= 0xB0 && cmd[0] <= 0xB7) {
+		mock->page = cmd[0] & 0x07;
+	} else if (cmd[0] == OLED_CMD_SET_MEMORY_ADDR_MODE) {
+		mock->addr_mode = cmd[1] & 0x03;
+	} else if (cmd[0] == OLED_CMD_SET_COLUMN_RANGE) {
+		mock->col_start = mock->col = cmd[1] & 0x7F;
+		mock->col_end = cmd[2] & 0x7F;
+	} else if (cmd[0] == OLED_CMD_SET_PAGE_RANGE) {
+		mock->page_start = mock->page = cmd[1] & 0x07;
+		mock->page_end = cmd[2] & 0x07;
+	} else if (cmd[0] == OLED_CMD_SET_CONTRAST) {
+		mock->contrast = cmd[1];
+	}
+}
+
+static void mock_parse_command(ssd1306_mock_t * mock, uint8_t byte)
+{
+	if (mock->cmd_need == 0) {
+		mock->cmd_len = 0;
+		mock->cmd_need = mock_command_args(byte) + 1;
+	}
+	mock->cmd[mock->cmd_len++] = byte;
+	if (--mock->cmd_need == 0)
+		mock_apply_command(mock);
+}
+
+static void mock_write_gddram(ssd1306_mock_t * mock, uint8_t byte)
+{
+	if (mock->col < 128)
+		mock->gddram[mock->page][mock->col] = byte;
+
+	switch (mock->addr_mode) {
+	case OLED_CMD_SET_HORI_ADDR_MODE:
+		if (mock->col++ >= mock->col_end) {
+			mock->col = mock->col_start;
+			mock->page = mock->page >= mock->page_end ? mock->page_start : mock->page + 1;
+		}
+		break;
+	case OLED_CMD_SET_VERT_ADDR_MODE:
+		if (mock->page++ >= mock->page_end) {
+			mock->page = mock->page_start;
+			mock->col = mock->col >= mock->col_end ? mock->col_start : mock->col + 1;
+		}
+		break;
+	default:
+		// Page addressing wraps within the page
+		mock->col = (mock->col + 1) & 0x7F;
+		break;
+	}
+}
+
+// Panel receives a command or data block
+static void mock_apply_block(ssd1306_mock_t * mock, bool data, const uint8_t * buf, size_t len)
+{
+	if (data) {
+		mock->data_bytes += len;
+		for (size_t i = 0; i < len; i++)
+			mock_write_gddram(mock, buf[i]);
+	} else {
+		mock->command_bytes += len;
+		for (size_t i = 0; i < len; i++)
+			mock_parse_command(mock, buf[i]);
+	}
+
+	if (mock->record)
+		mock->record(mock->record_arg, data, buf, len);
+}
+
+static void mock_bus_time(ssd1306_mock_t * mock, uint64_t bits)
+{
+	mock->transactions++;
+	mock->bus_time_ns += bits * 1000000000ull / mock->clock_hz + mock->transaction_overhead_ns;
+}
+
+// spi transaction, D/C pin ahead of the payload
+static void mock_transaction(SSD1306_t * dev, bool data, const uint8_t * buf, size_t len)
+{
+	ssd1306_mock_t *mock = dev->_transport_ctx;
+	mock_bus_time(mock, len * 8);
+	mock_apply_block(mock, data, buf, len);
+}
+
+// Staged i2c blocks as one transaction, each block has the address and control byte ahead of it
+static void mock_stream_flush(SSD1306_t * dev)
+{
+	ssd1306_mock_t *mock = dev->_transport_ctx;
+	if (mock->block_count == 0) return;
+
+	uint64_t bits = I2C_STOP_BITS;
+	for (int i = 0; i < mock->block_count; i++) {
+		ssd1306_mock_block_t *block = &mock->blocks[i];
+		bits += I2C_START_BITS + (block->len + 2) * I2C_BITS_PER_BYTE;
+		mock_apply_block(mock, block->data, &mock->stream[block->offset], block->len);
+	}
+	mock_bus_time(mock, bits);
+	mock->block_count = 0;
+	mock->used = 0;
+}
+
+// Stage a block, extends the last one of the same kind. Same split rules as i2c_stream_append
+static void mock_stream_append(SSD1306_t * dev, bool data, const uint8_t * buf, int len)
+{
+	ssd1306_mock_t *mock = dev->_transport_ctx;
+	while (len > 0) {
+		ssd1306_mock_block_t *last = mock->block_count ? &mock->blocks[mock->block_count - 1] : NULL;
+		bool extend = last && last->data == data;
+		bool full = mock->used == MOCK_I2C_STREAM_BYTES || (!extend && mock->block_count == MOCK_I2C_STREAM_BLOCKS) ||
+			(!data && mock->used + len > MOCK_I2C_STREAM_BYTES);
+		if (full) {
+			mock_stream_flush(dev);
+			continue;
+		}
+
+		int n = MOCK_I2C_STREAM_BYTES - mock->used;
+		if (n > len) n = len;
+		memcpy(&mock->stream[mock->used], buf, n);
+		if (extend) {
+			last->len += n;
+		} else {
+			mock->blocks[mock->block_count++] = (ssd1306_mock_block_t){data, mock->used, n};
+		}
+		mock->used += n;
+		buf += n;
+		len -= n;
+	}
+}
+
+// Flush unless a batch is open
+static void mock_stream_end(SSD1306_t * dev)
+{
+	ssd1306_mock_t *mock = dev->_transport_ctx;
+	if (mock->depth == 0)
+		mock_stream_flush(dev);
+}
+
+// i2c backend stages a command stream, spi backend sends one byte per transaction
+// except for the address window, see mock_write_window
+static void mock_write_commands(SSD1306_t * dev, const uint8_t * buf, size_t len)
+{
+	ssd1306_mock_t *mock = dev->_transport_ctx;
+	if (mock->bus == MOCK_BUS_I2C) {
+		mock_stream_append(dev, false, buf, len);
+		mock_stream_end(dev);
+		return;
+	}
+	for (size_t i = 0; i < len; i++)
+		mock_transaction(dev, false, &buf[i], 1);
+}
+
+// Column and page window for Horizontal Addressing Mode, one command transaction on both buses
+static void mock_write_window(SSD1306_t * dev, int seg_start, int seg_end, int page_start, int page_end)
+{
+	uint8_t out_buf[6] = {
+		OLED_CMD_SET_COLUMN_RANGE, seg_start, seg_end,
+		OLED_CMD_SET_PAGE_RANGE, page_start, page_end,
+	};
+	mock_transaction(dev, false, out_buf, sizeof(out_buf));
+}
+
+static void mock_init(SSD1306_t * dev, int width, int height)
+{
+	ssd1306_mock_t *mock = dev->_transport_ctx;
+	dev->_width = width;
+	dev->_height = height;
+	dev->_pages = 8;
+	if (dev->_height == 32) dev->_pages = 4;
+
+	uint8_t out_buf[26];
+	int out_index = 0;
+	out_buf[out_index++] = OLED_CMD_DISPLAY_OFF;				// AE
+	out_buf[out_index++] = OLED_CMD_SET_MUX_RATIO;			// A8
+	out_buf[out_index++] = dev->_height == 32 ? 0x1F : 0x3F;
+	out_buf[out_index++] = OLED_CMD_SET_DISPLAY_OFFSET;		// D3
+	out_buf[out_index++] = 0x00;
+	out_buf[out_index++] = OLED_CMD_SET_DISPLAY_START_LINE;	// 40
+	out_buf[out_index++] = dev->_flip ? OLED_CMD_SET_SEGMENT_REMAP_0 : OLED_CMD_SET_SEGMENT_REMAP_1;
+	out_buf[out_index++] = OLED_CMD_SET_COM_SCAN_MODE;		// C8
+	out_buf[out_index++] = OLED_CMD_SET_DISPLAY_CLK_DIV;		// D5
+	out_buf[out_index++] = 0x80;
+	out_buf[out_index++] = OLED_CMD_SET_COM_PIN_MAP;			// DA
+	out_buf[out_index++] = dev->_height == 32 ? 0x02 : 0x12;
+	out_buf[out_index++] = OLED_CMD_SET_CONTRAST;			// 81
+	out_buf[out_index++] = 0xFF;
+	out_buf[out_index++] = OLED_CMD_DISPLAY_RAM;				// A4
+	out_buf[out_index++] = OLED_CMD_SET_VCOMH_DESELCT;		// DB
+	out_buf[out_index++] = 0x40;
+	out_buf[out_index++] = OLED_CMD_SET_MEMORY_ADDR_MODE;	// 20
+	if (mock->bus == MOCK_BUS_I2C) {
+		out_buf[out_index++] = OLED_CMD_SET_PAGE_ADDR_MODE;	// 02
+		out_buf[out_index++] = 0x00;
+		out_buf[out_index++] = 0x10;
+	} else {
+		out_buf[out_index++] = OLED_CMD_SET_HORI_ADDR_MODE;	// 00
+	}
+	out_buf[out_index++] = OLED_CMD_SET_CHARGE_PUMP;			// 8D
+	out_buf[out_index++] = 0x14;
+	out_buf[out_index++] = OLED_CMD_DEACTIVE_SCROLL;			// 2E
+	out_buf[out_index++] = OLED_CMD_DISPLAY_NORMAL;			// A6
+	out_buf[out_index++] = OLED_CMD_DISPLAY_ON;				// AF
+	mock_write_commands(dev, out_buf, out_index);
+}
+
+static void mock_display_image(SSD1306_t * dev, int page, int seg, uint8_t * images, int width)
+{
+	if (page >= dev->_pages) return;
+	if (seg >= dev->_width) return;
+
+	int _seg = seg + CONFIG_OFFSETX;
+	int _page = page;
+	if (dev->_flip) {
+		_page = (dev->_pages - page) - 1;
+	}
+
+	ssd1306_mock_t *mock = dev->_transport_ctx;
+	if (mock->bus == MOCK_BUS_SPI) {
+		int _end = _seg + width - 1;
+		if (_end > 127) _end = 127;
+		mock_write_window(dev, _seg, _end, _page, _page);
+		mock_transaction(dev, true, images, _end - _seg + 1);
+		return;
+	}
+
+	// Continue the previous write if the column pointer is already there
+	if (mock->cursor_page != _page || mock->cursor_seg != _seg) {
+		uint8_t out_buf[3] = {
+			0x00 + (_seg & 0x0F),
+			0x10 + ((_seg >> 4) & 0x0F),
+			0xB0 | _page,
+		};
+		mock_stream_append(dev, false, out_buf, sizeof(out_buf));
+	}
+	mock_stream_append(dev, true, images, width);
+
+	// Page addressing wraps within the page, don't follow that
+	mock->cursor_page = _page;
+	mock->cursor_seg = _seg + width < 128 ? _seg + width : -1;
+	mock_stream_end(dev);
+}
+
+static void mock_batch_begin(SSD1306_t * dev)
+{
+	ssd1306_mock_t *mock = dev->_transport_ctx;
+	if (mock->bus == MOCK_BUS_I2C)
+		mock->depth++;
+}
+
+static void mock_batch_end(SSD1306_t * dev)
+{
+	ssd1306_mock_t *mock = dev->_transport_ctx;
+	if (mock->bus == MOCK_BUS_I2C && mock->depth > 0 && --mock->depth == 0)
+		mock_stream_flush(dev);
+}
+
+// spi backend sends the frame as one data transaction, i2c goes page by page in one batch
+static void mock_show_buffer(SSD1306_t * dev)
+{
+	ssd1306_mock_t *mock = dev->_transport_ctx;
+	if (mock->bus == MOCK_BUS_I2C) {
+		mock_batch_begin(dev);
+		for (int page = 0; page < dev->_pages; page++)
+			mock_display_image(dev, page, 0, dev->_page[page]._segs, dev->_width);
+		mock_batch_end(dev);
+		return;
+	}
+
+	uint8_t frame[8 * 128];
+	int width = dev->_width;
+	for (int page = 0; page < dev->_pages; page++) {
+		int _page = dev->_flip ? (dev->_pages - page) - 1 : page;
+		memcpy(&frame[_page * width], dev->_page[page]._segs, width);
+	}
+	mock_write_window(dev, CONFIG_OFFSETX, CONFIG_OFFSETX + width - 1, 0, dev->_pages - 1);
+	mock_transaction(dev, true, frame, width * dev->_pages);
+}
+
+static void mock_contrast(SSD1306_t * dev, int contrast)
+{
+	int _contrast = contrast;
+	if (contrast < 0x0) _contrast = 0;
+	if (contrast > 0xFF) _contrast = 0xFF;
+
+	uint8_t out_buf[2] = {OLED_CMD_SET_CONTRAST, _contrast};
+	mock_write_commands(dev, out_buf, sizeof(out_buf));
+}
+
+static void mock_hardware_scroll(SSD1306_t * dev, ssd1306_scroll_type_t scroll)
+{
+	uint8_t out_buf[11];
+	int out_index = 0;
+	uint8_t rows = dev->_height == 32 ? 0x20 : 0x40;
+
+	if (scroll == SCROLL_RIGHT || scroll == SCROLL_LEFT) {
+		out_buf[out_index++] = scroll == SCROLL_RIGHT ? OLED_CMD_HORIZONTAL_RIGHT : OLED_CMD_HORIZONTAL_LEFT;
+		out_buf[out_index++] = 0x00; // Dummy byte
+		out_buf[out_index++] = 0x00; // Define start page address
+		out_buf[out_index++] = 0x07; // Frame frequency
+		out_buf[out_index++] = 0x07; // Define end page address
+		out_buf[out_index++] = 0x00;
+		out_buf[out_index++] = 0xFF;
+		out_buf[out_index++] = OLED_CMD_ACTIVE_SCROLL;		// 2F
+	} else if (scroll == SCROLL_DOWN || scroll == SCROLL_UP) {
+		out_buf[out_index++] = OLED_CMD_CONTINUOUS_SCROLL;	// 29
+		out_buf[out_index++] = 0x00; // Dummy byte
+		out_buf[out_index++] = 0x00; // Define start page address
+		out_buf[out_index++] = 0x07; // Frame frequency
+		out_buf[out_index++] = 0x00; // Define end page address
+		out_buf[out_index++] = scroll == SCROLL_DOWN ? 0x3F : 0x01; // Vertical scrolling offset
+		out_buf[out_index++] = OLED_CMD_VERTICAL;			// A3
+		out_buf[out_index++] = 0x00;
+		out_buf[out_index++] = rows;
+		out_buf[out_index++] = OLED_CMD_ACTIVE_SCROLL;		// 2F
+	} else if (scroll == SCROLL_STOP) {
+		out_buf[out_index++] = OLED_CMD_DEACTIVE_SCROLL;	// 2E
+	}
+	if (out_index)
+		mock_write_commands(dev, out_buf, out_index);
+}
+
+const ssd1306_transport_t ssd1306_mock_transport = {
+	.init = mock_init,
+	.display_image = mock_display_image,
+	.contrast = mock_contrast,
+	.hardware_scroll = mock_hardware_scroll,
+	.show_buffer = mock_show_buffer,
+	.batch_begin = mock_batch_begin,
+	.batch_end = mock_batch_end,
+};
+
+void mock_reset_stats(ssd1306_mock_t * mock)
+{
+	mock->transactions = 0;
+	mock->command_bytes = 0;
+	mock->data_bytes = 0;
+	mock->bus_time_ns = 0;
+}
+
+void mock_master_init(SSD1306_t * dev, ssd1306_mock_t * mock, ssd1306_mock_bus_t bus, uint32_t clock_hz)
+{
+	memset(mock, 0, sizeof(ssd1306_mock_t));
+	mock->bus = bus;
+	mock->clock_hz = clock_hz;
+	mock->addr_mode = OLED_CMD_SET_PAGE_ADDR_MODE;
+	mock->col_end = 127;
+	mock->page_end = 7;
+	mock->cursor_page = -1;
+	mock->cursor_seg = -1;
+
+	dev->_address = bus == MOCK_BUS_I2C ? I2C_ADDRESS : SPI_ADDRESS;
+	dev->_flip = false;
+	dev->_transport = &ssd1306_mock_transport;
+	dev->_transport_ctx = mock;
+}
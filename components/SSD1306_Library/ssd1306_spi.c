@@ -1,9 +1,14 @@
+#include <assert.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "driver/spi_master.h"
 #include "driver/gpio.h"
+#include "hal/gpio_ll.h"
+#include "esp_attr.h"
+#include "esp_heap_caps.h"
 #include "esp_log.h"
 
 #include "ssd1306.h"
@@ -20,10 +25,56 @@
 
 #define SPI_COMMAND_MODE 0
 #define SPI_DATA_MODE 1
-#define SPI_DEFAULT_FREQUENCY 1000000; // 1MHz
+#if CONFIG_SPI_CLOCK_HZ
+#define SPI_DEFAULT_FREQUENCY CONFIG_SPI_CLOCK_HZ
+#else
+#define SPI_DEFAULT_FREQUENCY 1000000 // 1MHz, if i2c is selected
+#endif
+// Full frame is a command and a data transaction in flight
+#define SPI_QUEUE_SIZE 2
+#define SPI_FRAME_SIZE (128 * 8)
+#define SPI_FRAME_COMMANDS 6
+
+// DC pin and level for the pre-transfer callback, flagged so DC on GPIO0 in command mode isn't NULL
+#define SPI_USER_SET 0x100
+#define SPI_USER_DC(dev, mode) ((void *)(intptr_t)(SPI_USER_SET | ((dev)->_dc << 1) | (mode)))
 
 int clock_speed_hz = SPI_DEFAULT_FREQUENCY;
 
+// Queued full frame, transactions and buffer must live until the transfer is done
+typedef struct {
+	spi_transaction_t trans[SPI_QUEUE_SIZE];
+	int pending;
+	uint8_t * buffer; // DMA capable, frame then commands
+} spi_frame_t;
+
+// Runs in the SPI ISR for queued transactions, gpio_ll is inline and safe from IRAM.
+// Transactions without SPI_USER_DC leave DC as it is
+static void IRAM_ATTR spi_pre_transfer_callback(spi_transaction_t * t)
+{
+	if ( t->user == NULL ) return;
+	int user = (int)(intptr_t)t->user;
+	gpio_ll_set_level(GPIO_LL_GET_HW(GPIO_PORT_0), (user >> 1) & 0x7F, user & 1);
+}
+
+static void spi_frame_init(SSD1306_t * dev)
+{
+	spi_frame_t * frame = calloc(1, sizeof(spi_frame_t));
+	assert(frame);
+	frame->buffer = heap_caps_malloc(SPI_FRAME_SIZE + SPI_FRAME_COMMANDS, MALLOC_CAP_DMA);
+	assert(frame->buffer);
+	dev->_transport_ctx = frame;
+}
+
+// Blocking writes can't be mixed with queued ones, collect the queued frame first
+static void spi_wait_pending(SSD1306_t * dev)
+{
+	spi_frame_t * frame = dev->_transport_ctx;
+	spi_transaction_t * rtrans;
+	for (; frame->pending; frame->pending--)
+		spi_device_get_trans_result(dev->_spi_device_handle, &rtrans, portMAX_DELAY);
+}
+
 void spi_clock_speed(int speed) {
 	ESP_LOGI(TAG, "SPI clock speed=%d MHz", speed/1000000);
 	clock_speed_hz = speed;
@@ -55,7 +106,7 @@ void spi_master_init(SSD1306_t * dev, int16_t mosi, int16_t sclk, int16_t cs, in
 		.sclk_io_num = sclk,
 		.quadwp_io_num = -1,
 		.quadhd_io_num = -1,
-		.max_transfer_sz = 0,
+		.max_transfer_sz = SPI_FRAME_SIZE + SPI_FRAME_COMMANDS,
 		.flags = 0
 	};
 
@@ -69,7 +120,8 @@ void spi_master_init(SSD1306_t * dev, int16_t mosi, int16_t sclk, int16_t cs, in
 	//devcfg.clock_speed_hz = SPI_DEFAULT_FREQUENCY;
 	devcfg.clock_speed_hz = clock_speed_hz;
 	devcfg.spics_io_num = cs;
-	devcfg.queue_size = 1;
+	devcfg.queue_size = SPI_QUEUE_SIZE;
+	devcfg.pre_cb = spi_pre_transfer_callback;
 
 	spi_device_handle_t spi_device_handle;
 	ret = spi_bus_add_device( HOST_ID, &devcfg, &spi_device_handle);
@@ -80,6 +132,8 @@ void spi_master_init(SSD1306_t * dev, int16_t mosi, int16_t sclk, int16_t cs, in
 	dev->_address = SPI_ADDRESS;
 	dev->_flip = false;
 	dev->_spi_device_handle = spi_device_handle;
+	dev->_transport = &ssd1306_spi_transport;
+	spi_frame_init(dev);
 }
 
 void spi_device_add(SSD1306_t * dev, int16_t cs, int16_t dc, int16_t reset)
@@ -110,7 +164,7 @@ void spi_device_add(SSD1306_t * dev, int16_t cs, int16_t dc, int16_t reset)
 		.sclk_io_num = sclk,
 		.quadwp_io_num = -1,
 		.quadhd_io_num = -1,
-		.max_transfer_sz = 0,
+		.max_transfer_sz = SPI_FRAME_SIZE + SPI_FRAME_COMMANDS,
 		.flags = 0
 	};
 
@@ -125,7 +179,8 @@ void spi_device_add(SSD1306_t * dev, int16_t cs, int16_t dc, int16_t reset)
 	//devcfg.clock_speed_hz = SPI_DEFAULT_FREQUENCY;
 	devcfg.clock_speed_hz = clock_speed_hz;
 	devcfg.spics_io_num = cs;
-	devcfg.queue_size = 1;
+	devcfg.queue_size = SPI_QUEUE_SIZE;
+	devcfg.pre_cb = spi_pre_transfer_callback;
 
 	spi_device_handle_t spi_device_handle;
 	ret = spi_bus_add_device( HOST_ID, &devcfg, &spi_device_handle);
@@ -136,35 +191,43 @@ void spi_device_add(SSD1306_t * dev, int16_t cs, int16_t dc, int16_t reset)
 	dev->_address = SPI_ADDRESS;
 	dev->_flip = false;
 	dev->_spi_device_handle = spi_device_handle;
+	dev->_transport = &ssd1306_spi_transport;
+	spi_frame_init(dev);
 }
 
 
-bool spi_master_write_byte(spi_device_handle_t SPIHandle, const uint8_t* Data, size_t DataLength )
+// DC is set by the pre-transfer callback, short writes go in the transaction itself
+static bool spi_master_transmit(SSD1306_t * dev, int mode, const uint8_t* Data, size_t DataLength )
 {
-	spi_transaction_t SPITransaction;
+	if ( DataLength == 0 ) return true;
+	spi_wait_pending( dev );
 
-	if ( DataLength > 0 ) {
-		memset( &SPITransaction, 0, sizeof( spi_transaction_t ) );
-		SPITransaction.length = DataLength * 8;
+	spi_transaction_t SPITransaction;
+	memset( &SPITransaction, 0, sizeof( spi_transaction_t ) );
+	SPITransaction.length = DataLength * 8;
+	SPITransaction.user = SPI_USER_DC( dev, mode );
+	if ( DataLength <= sizeof( SPITransaction.tx_data ) ) {
+		SPITransaction.flags = SPI_TRANS_USE_TXDATA;
+		memcpy( SPITransaction.tx_data, Data, DataLength );
+	} else {
 		SPITransaction.tx_buffer = Data;
-		spi_device_transmit( SPIHandle, &SPITransaction );
 	}
-
-	return true;
+	return spi_device_polling_transmit( dev->_spi_device_handle, &SPITransaction ) == ESP_OK;
 }
 
 bool spi_master_write_command(SSD1306_t * dev, uint8_t Command )
 {
-	static uint8_t CommandByte = 0;
-	CommandByte = Command;
-	gpio_set_level( dev->_dc, SPI_COMMAND_MODE );
-	return spi_master_write_byte( dev->_spi_device_handle, &CommandByte, 1 );
+	return spi_master_transmit( dev, SPI_COMMAND_MODE, &Command, 1 );
+}
+
+bool spi_master_write_commands(SSD1306_t * dev, const uint8_t* Commands, size_t Length )
+{
+	return spi_master_transmit( dev, SPI_COMMAND_MODE, Commands, Length );
 }
 
 bool spi_master_write_data(SSD1306_t * dev, const uint8_t* Data, size_t DataLength )
 {
-	gpio_set_level( dev->_dc, SPI_DATA_MODE );
-	return spi_master_write_byte( dev->_spi_device_handle, Data, DataLength );
+	return spi_master_transmit( dev, SPI_DATA_MODE, Data, DataLength );
 }
 
 
@@ -200,12 +263,8 @@ void spi_init(SSD1306_t * dev, int width, int height)
 	spi_master_write_command(dev, OLED_CMD_SET_VCOMH_DESELCT);		// DB
 	spi_master_write_command(dev, 0x40);
 	spi_master_write_command(dev, OLED_CMD_SET_MEMORY_ADDR_MODE);	// 20
-	//spi_master_write_command(dev, OLED_CMD_SET_HORI_ADDR_MODE);	// 00
-	spi_master_write_command(dev, OLED_CMD_SET_PAGE_ADDR_MODE);		// 02
-	// Set Lower Column Start Address for Page Addressing Mode
-	spi_master_write_command(dev, 0x00);
-	// Set Higher Column Start Address for Page Addressing Mode
-	spi_master_write_command(dev, 0x10);
+	// Writes set a column and page window, a full frame is one data transfer
+	spi_master_write_command(dev, OLED_CMD_SET_HORI_ADDR_MODE);		// 00
 	spi_master_write_command(dev, OLED_CMD_SET_CHARGE_PUMP);		// 8D
 	spi_master_write_command(dev, 0x14);
 	spi_master_write_command(dev, OLED_CMD_DEACTIVE_SCROLL);		// 2E
@@ -220,23 +279,62 @@ void spi_display_image(SSD1306_t * dev, int page, int seg, uint8_t * images, int
 	if (seg >= dev->_width) return;
 
 	int _seg = seg + CONFIG_OFFSETX;
-	uint8_t columLow = _seg & 0x0F;
-	uint8_t columHigh = (_seg >> 4) & 0x0F;
+	int _end = _seg + width - 1;
+	if (_end > 127) _end = 127;
 
 	int _page = page;
 	if (dev->_flip) {
 		_page = (dev->_pages - page) - 1;
 	}
 
-	// Set Lower Column Start Address for Page Addressing Mode
-	spi_master_write_command(dev, (0x00 + columLow));
-	// Set Higher Column Start Address for Page Addressing Mode
-	spi_master_write_command(dev, (0x10 + columHigh));
-	// Set Page Start Address for Page Addressing Mode
-	spi_master_write_command(dev, 0xB0 | _page);
+	// Column and page window for Horizontal Addressing Mode, one command transaction
+	uint8_t commands[SPI_FRAME_COMMANDS] = {
+		OLED_CMD_SET_COLUMN_RANGE, _seg, _end,
+		OLED_CMD_SET_PAGE_RANGE, _page, _page,
+	};
+	spi_master_write_commands(dev, commands, sizeof(commands));
+
+	spi_master_write_data(dev, images, _end - _seg + 1);
 
-	spi_master_write_data(dev, images, width);
+}
 
+// Whole frame as one queued command and one queued DMA data transaction, doesn't wait for the transfer.
+// The frame is copied first, so the caller may draw into _page right away
+void spi_show_buffer(SSD1306_t * dev)
+{
+	spi_wait_pending(dev);
+	spi_frame_t * frame = dev->_transport_ctx;
+
+	int width = dev->_width;
+	int size = width * dev->_pages;
+	for (int page = 0; page < dev->_pages; page++) {
+		int _page = dev->_flip ? (dev->_pages - page) - 1 : page;
+		memcpy(&frame->buffer[_page * width], dev->_page[page]._segs, width);
+	}
+	uint8_t * commands = &frame->buffer[SPI_FRAME_SIZE];
+	commands[0] = OLED_CMD_SET_COLUMN_RANGE;
+	commands[1] = CONFIG_OFFSETX;
+	commands[2] = CONFIG_OFFSETX + width - 1;
+	commands[3] = OLED_CMD_SET_PAGE_RANGE;
+	commands[4] = 0;
+	commands[5] = dev->_pages - 1;
+
+	spi_transaction_t * trans = frame->trans;
+	memset(trans, 0, sizeof(frame->trans));
+	trans[0].length = SPI_FRAME_COMMANDS * 8;
+	trans[0].tx_buffer = commands;
+	trans[0].user = SPI_USER_DC(dev, SPI_COMMAND_MODE);
+	trans[1].length = size * 8;
+	trans[1].tx_buffer = frame->buffer;
+	trans[1].user = SPI_USER_DC(dev, SPI_DATA_MODE);
+
+	for (int i = 0; i < SPI_QUEUE_SIZE; i++) {
+		if (spi_device_queue_trans(dev->_spi_device_handle, &trans[i], portMAX_DELAY) != ESP_OK) {
+			ESP_LOGE(TAG, "Queue frame transaction %d failed", i);
+			break;
+		}
+		frame->pending++;
+	}
 }
 
 void spi_contrast(SSD1306_t * dev, int contrast) {
@@ -312,4 +410,12 @@ void spi_hardware_scroll(SSD1306_t * dev, ssd1306_scroll_type_t scroll)
 	if (scroll == SCROLL_STOP) {
 		spi_master_write_command(dev, OLED_CMD_DEACTIVE_SCROLL);	// 2E
 	}
-}
\ No newline at end of file
+}
+
+const ssd1306_transport_t ssd1306_spi_transport = {
+	.init = spi_init,
+	.display_image = spi_display_image,
+	.contrast = spi_contrast,
+	.hardware_scroll = spi_hardware_scroll,
+	.show_buffer = spi_show_buffer,
+};
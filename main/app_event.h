@@ -0,0 +1,106 @@
+#ifndef __APP_EVENT_H__
+#define __APP_EVENT_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/param.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/timers.h>
+
+#include "trace.h"
+
+#define APP_EVENT_QUEUE_SIZE 16
+// Queue slots kept free for completion events, input is dropped instead when the queue is this full
+#define APP_EVENT_RESERVED_SLOTS 4
+
+static const char *TAG_EVENT = "main:event";
+
+typedef enum app_event_type {
+    APP_EVENT_BTN_CLICK,
+    APP_EVENT_BTN_DOUBLE_CLICK,
+    APP_EVENT_BTN_LONG_PRESS_START,
+    APP_EVENT_BTN_LONG_PRESS_UP,
+    APP_EVENT_CAPTURE_DONE,
+    APP_EVENT_CAPTURE_FAILED,
+    APP_EVENT_TIMER,
+    APP_EVENT_OTA_START,
+} AppEventType;
+
+typedef struct {
+    AppEventType type;
+    int64_t timeUs;  // esp_timer time when the event happened
+} AppEvent;
+
+static QueueHandle_t appEventQueue;
+#if CONFIG_IDF_TARGET_LINUX
+// Only esp_timer_get_time is available on host, use a FreeRTOS timer
+static TimerHandle_t appEventTimer;
+#else
+static esp_timer_handle_t appEventTimer;
+#endif
+
+static inline bool appEventIsInput(AppEventType type) {
+    return type <= APP_EVENT_BTN_LONG_PRESS_UP;
+}
+
+bool appEventPost(AppEventType type) {
+    if (!appEventQueue) return false;
+    if (appEventIsInput(type) && uxQueueSpacesAvailable(appEventQueue) <= APP_EVENT_RESERVED_SLOTS) {
+        ESP_LOGW(TAG_EVENT, "Queue full, input %d dropped", type);
+        return false;
+    }
+    AppEvent event = {
+        .type = type,
+        .timeUs = esp_timer_get_time(),
+    };
+    TRACE_INSTANT(TRACE_EVENT_APP_POST, type);
+    if (xQueueSend(appEventQueue, &event, 0) != pdTRUE) {
+        ESP_LOGE(TAG_EVENT, "Queue full, event %d dropped", type);
+        return false;
+    }
+    return true;
+}
+
+#if CONFIG_IDF_TARGET_LINUX
+static void appEventTimerCallback(TimerHandle_t timer) {
+#else
+static void appEventTimerCallback(void *args) {
+#endif
+    appEventPost(APP_EVENT_TIMER);
+}
+
+esp_err_t appEventInit() {
+    appEventQueue = xQueueCreate(APP_EVENT_QUEUE_SIZE, sizeof(AppEvent));
+    if (!appEventQueue) return ESP_ERR_NO_MEM;
+
+#if CONFIG_IDF_TARGET_LINUX
+    appEventTimer = xTimerCreate("app_event", 1, pdFALSE, NULL, appEventTimerCallback);
+    return appEventTimer ? ESP_OK : ESP_ERR_NO_MEM;
+#else
+    esp_timer_create_args_t timerArgs = {
+        .callback = appEventTimerCallback,
+        .name = "app_event",
+    };
+    return esp_timer_create(&timerArgs, &appEventTimer);
+#endif
+}
+
+// Post APP_EVENT_TIMER after timeout, replaces pending timer
+void appEventTimerStart(uint32_t timeoutMs) {
+#if CONFIG_IDF_TARGET_LINUX
+    // Changing the period restarts the timer
+    xTimerChangePeriod(appEventTimer, MAX(pdMS_TO_TICKS(timeoutMs), 1), 0);
+#else
+    esp_timer_stop(appEventTimer);
+    esp_timer_start_once(appEventTimer, timeoutMs * 1000ULL);
+#endif
+}
+
+static inline bool appEventWait(AppEvent *event, TickType_t timeout) {
+    return xQueueReceive(appEventQueue, event, timeout) == pdTRUE;
+}
+
+#endif
@@ -0,0 +1,69 @@
+#ifndef __BOOT_TIMELINE_H__
+#define __BOOT_TIMELINE_H__
+
+#include <stdint.h>
+#include <inttypes.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+
+static const char *TAG_BOOT = "main:boot";
+
+typedef enum boot_phase {
+    BOOT_PHASE_NVS,
+    BOOT_PHASE_WIFI_START,
+    BOOT_PHASE_OLED,
+    BOOT_PHASE_INPUT,
+    BOOT_PHASE_CAMERA,
+    BOOT_PHASE_FIRST_PREVIEW,  // app_main start to first preview frame
+    BOOT_PHASE_WIFI_CONNECT,
+    BOOT_PHASE_OTA_CHECK,
+    BOOT_PHASE_COUNT,
+} BootPhase;
+
+static const char *const bootPhaseNames[BOOT_PHASE_COUNT] = {
+    "nvs",
+    "wifi_start",
+    "oled",
+    "input",
+    "camera",
+    "first_preview",
+    "wifi_connect",
+    "ota_check",
+};
+
+// Phase start and end in us since boot, 0 if not reached yet
+typedef struct {
+    int64_t start;
+    int64_t end;
+} BootPhaseTime;
+
+BootPhaseTime bootTimeline[BOOT_PHASE_COUNT];
+
+static inline void bootPhaseBegin(BootPhase phase) {
+    bootTimeline[phase].start = esp_timer_get_time();
+}
+
+// Phases are one-shot, later calls are ignored
+static inline void bootPhaseEnd(BootPhase phase) {
+    BootPhaseTime *time = &bootTimeline[phase];
+    if (time->end) return;
+    time->end = esp_timer_get_time();
+    ESP_LOGI(TAG_BOOT, "%s: %" PRId64 " ms (at %" PRId64 " ms)", bootPhaseNames[phase],
+             (time->end - time->start) / 1000, time->end / 1000);
+}
+
+// Phase duration in ms, -1 if not finished
+static inline int bootPhaseMs(BootPhase phase) {
+    BootPhaseTime *time = &bootTimeline[phase];
+    if (!time->end) return -1;
+    return (time->end - time->start) / 1000;
+}
+
+void bootTimelineLog() {
+    for (int i = 0; i < BOOT_PHASE_COUNT; i++) {
+        ESP_LOGI(TAG_BOOT, "%-14s %6d ms, %6" PRId64 " -> %6" PRId64 " ms", bootPhaseNames[i], bootPhaseMs(i),
+                 bootTimeline[i].start / 1000, bootTimeline[i].end / 1000);
+    }
+}
+
+#endif
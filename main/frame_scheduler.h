@@ -0,0 +1,115 @@
+#ifndef __FRAME_SCHEDULER_H__
+#define __FRAME_SCHEDULER_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+
+#include "perf_stats.h"
+
+#define FRAME_STATS_LOG_INTERVAL_US (10 * 1000 * 1000)
+
+static const char *TAG_FRAME = "main:frame";
+
+// Target frame rate by what is on screen
+typedef enum frame_rate_class {
+    FRAME_RATE_PREVIEW,  // Camera preview
+    FRAME_RATE_SCROLL,   // Result scrolling
+    FRAME_RATE_IDLE,     // Nothing changes, no frame until next input
+    FRAME_RATE_COUNT,
+} FrameRateClass;
+
+// 0 for no deadline
+static const uint8_t frameRateFps[FRAME_RATE_COUNT] = {
+    12,  // FRAME_RATE_PREVIEW
+    30,  // FRAME_RATE_SCROLL
+    0,   // FRAME_RATE_IDLE
+};
+
+typedef struct {
+    FrameRateClass rateClass;
+    int64_t frameStartUs;
+    int64_t deadlineUs;  // End of current frame, 0 to restart cadence
+    int64_t lastLogUs;
+    uint32_t frames;
+    uint32_t missedDeadlines;
+    PerfHistogram workTime;      // Frame start to frame end, us
+    PerfHistogram intervalTime;  // Frame start to next frame start, us
+} FrameScheduler;
+
+FrameScheduler frameScheduler;
+
+void frameSchedulerLog(FrameScheduler *fs) {
+    PerfHistogram work, interval;
+    perfHistSnapshot(&fs->workTime, &work);
+    perfHistSnapshot(&fs->intervalTime, &interval);
+    uint32_t avgInterval = perfHistAvg(&interval);
+    ESP_LOGI(TAG_FRAME, "frames %" PRIu32 ", missed %" PRIu32 ", fps %.1f, work min %" PRIu32 " avg %" PRIu32 " p99 %" PRIu32
+             " max %" PRIu32 " us",
+             fs->frames, fs->missedDeadlines, avgInterval ? 1000000.0f / avgInterval : 0,
+             work.min, perfHistAvg(&work), perfHistPercentile(&work, 99), work.max);
+    perfStageLog();
+}
+
+static inline void frameBegin(FrameScheduler *fs) {
+    int64_t now = esp_timer_get_time();
+    if (fs->frameStartUs && fs->deadlineUs)
+        perfHistRecord(&fs->intervalTime, now - fs->frameStartUs);
+    fs->frameStartUs = now;
+    TRACE_BEGIN(TRACE_EVENT_FRAME, 0);
+}
+
+// Frame work doesn't belong to any rate (e.g. blocking capture), restart cadence without stats
+static inline void frameSkip(FrameScheduler *fs) {
+    fs->deadlineUs = 0;
+    TRACE_END(TRACE_EVENT_FRAME, FRAME_RATE_COUNT);
+}
+
+// Return ticks left until the frame deadline of the given rate, portMAX_DELAY if the rate has no deadline.
+// Deadlines advance by one period from the previous deadline, so work time is absorbed
+// and the cadence doesn't drift. A missed deadline restarts the cadence from now.
+TickType_t frameEnd(FrameScheduler *fs, FrameRateClass rateClass) {
+    int64_t now = esp_timer_get_time();
+    TickType_t wait = 0;
+    perfHistRecord(&fs->workTime, now - fs->frameStartUs);
+    fs->frames++;
+    TRACE_END(TRACE_EVENT_FRAME, rateClass);
+
+    if (now - fs->lastLogUs > FRAME_STATS_LOG_INTERVAL_US) {
+        fs->lastLogUs = now;
+        frameSchedulerLog(fs);
+    }
+
+    bool rateChanged = rateClass != fs->rateClass;
+    fs->rateClass = rateClass;
+    if (!frameRateFps[rateClass]) {
+        fs->deadlineUs = 0;
+        return portMAX_DELAY;
+    }
+
+    int64_t period = 1000000 / frameRateFps[rateClass];
+    if (!fs->deadlineUs || rateChanged)
+        fs->deadlineUs = fs->frameStartUs + period;
+    else
+        fs->deadlineUs += period;
+
+    if (now >= fs->deadlineUs) {
+        fs->missedDeadlines++;
+        fs->deadlineUs = now;
+    } else {
+        wait = pdMS_TO_TICKS((fs->deadlineUs - now + 500) / 1000);
+    }
+    return wait;
+}
+
+// Ticks left until the current deadline, for waits that are cut short
+static inline TickType_t frameTicksLeft(FrameScheduler *fs) {
+    if (!fs->deadlineUs) return portMAX_DELAY;
+    int64_t left = fs->deadlineUs - esp_timer_get_time();
+    return left > 0 ? pdMS_TO_TICKS((left + 500) / 1000) : 0;
+}
+
+#endif
@@ -0,0 +1,245 @@
+#ifndef __IMAGE_KERNELS_H__
+#define __IMAGE_KERNELS_H__
+
+// Pixel kernels for preview and result rendering.
+// Only depends on libc, so the same code can be built and benchmarked on host.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#define setIfLess(target, cache, value) \
+    if ((cache = value) < target) target = cache
+
+typedef struct {
+    uint16_t width;
+    uint16_t height;
+    uint8_t *input;
+    uint8_t *output;
+} ImageData;
+
+static inline uint8_t RGB24_to_BW8(const ImageData *bmp, uint16_t x, uint16_t y) {
+    if (y >= bmp->height) y = bmp->height - 1;
+    uint32_t index = (y * bmp->width + x) * 3;
+    return (uint8_t)(0.299f * bmp->output[index] +
+                     0.587f * bmp->output[index + 1] +
+                     0.114f * bmp->output[index + 2]);
+}
+
+// Dither levels from a coarse scan of the image light
+void imageCalcThreshold(const ImageData *image, int *threshold, int *step) {
+#define W_SCAN 26
+#define H_SCAN 20
+    float wScanScale = (float)image->width / W_SCAN;
+    float hScanScale = (float)image->height / H_SCAN;
+
+    float avg = 0;
+    int thresholdMin = 255;
+    int thresholdMax = 0;
+    for (int i = 0; i < H_SCAN; i++) {
+        for (int j = 0; j < W_SCAN; j++) {
+            uint8_t level = RGB24_to_BW8(image, j * wScanScale, i * hScanScale);
+            if (level < thresholdMin) thresholdMin = level;
+            if (level > thresholdMax) thresholdMax = level;
+            avg += level;
+        }
+    }
+    int center = thresholdMax * 0.4f +
+                 thresholdMin * 0.3f +
+                 avg / (H_SCAN * W_SCAN) * 0.3f;
+    int gap = (thresholdMax - thresholdMin) * 0.15f;
+    *threshold = center - gap;
+    *step = center + gap;
+#undef W_SCAN
+#undef H_SCAN
+}
+
+// Scale image to a row major 1 bit bitmap, 2 pixel wide cells with 3 level dither.
+// Width is in pixels and multiple of 8
+void imageDitherBitmap(const ImageData *image, int threshold, int step, uint8_t *bitmap, int width, int height) {
+    int rowByteCount = width >> 3;
+    float widthScale = (float)image->width / width;
+    float heightScale = (float)image->height / height;
+    for (uint16_t i = 0; i < height; i++) {
+        uint8_t *row = bitmap + i * rowByteCount;
+        uint16_t yOff = i * heightScale;
+        for (uint16_t j = 0; j < rowByteCount; j++) {
+            uint16_t jb = (j << 3);
+
+            uint8_t cache;
+            uint8_t p0 = RGB24_to_BW8(image, (jb + 0) * widthScale, yOff);
+            setIfLess(p0, cache, RGB24_to_BW8(image, (jb + 1) * widthScale, yOff));
+            setIfLess(p0, cache, RGB24_to_BW8(image, (jb + 0) * widthScale, yOff + 1));
+            setIfLess(p0, cache, RGB24_to_BW8(image, (jb + 1) * widthScale, yOff + 1));
+
+            uint8_t p1 = RGB24_to_BW8(image, (jb + 2) * widthScale, yOff);
+            setIfLess(p1, cache, RGB24_to_BW8(image, (jb + 3) * widthScale, yOff));
+            setIfLess(p1, cache, RGB24_to_BW8(image, (jb + 2) * widthScale, yOff + 1));
+            setIfLess(p1, cache, RGB24_to_BW8(image, (jb + 3) * widthScale, yOff + 1));
+
+            uint8_t p2 = RGB24_to_BW8(image, (jb + 4) * widthScale, yOff);
+            setIfLess(p2, cache, RGB24_to_BW8(image, (jb + 5) * widthScale, yOff));
+            setIfLess(p2, cache, RGB24_to_BW8(image, (jb + 4) * widthScale, yOff + 1));
+            setIfLess(p2, cache, RGB24_to_BW8(image, (jb + 5) * widthScale, yOff + 1));
+
+            uint8_t p3 = RGB24_to_BW8(image, (jb + 6) * widthScale, yOff);
+            setIfLess(p3, cache, RGB24_to_BW8(image, (jb + 7) * widthScale, yOff));
+            setIfLess(p3, cache, RGB24_to_BW8(image, (jb + 6) * widthScale, yOff + 1));
+            setIfLess(p3, cache, RGB24_to_BW8(image, (jb + 7) * widthScale, yOff + 1));
+
+            row[j] = (p0 < threshold ? 0 : (p0 < step ? (i % 2 ? 0b1000000 : 0b10000000) : 0b11000000)) |
+                     (p1 < threshold ? 0 : (p1 < step ? (i % 2 ? 0b10000 : 0b100000) : 0b110000)) |
+                     (p2 < threshold ? 0 : (p2 < step ? (i % 2 ? 0b100 : 0b1000) : 0b1100)) |
+                     (p3 < threshold ? 0 : (p3 < step ? (i % 2 ? 0b1 : 0b10) : 0b11));
+        }
+    }
+}
+
+// Scale image to planeCount row major 1 bit bitmaps for frame rate modulation, planeCount + 1 gray levels
+// between low and high. A pixel of level l is lit in l of the planes, the planes it is lit in are shifted
+// by a 2x2 ordered pattern so neighbouring pixels don't blink together. Up to 7 planes, width multiple of 8
+void imageGrayPlanes(const ImageData *image, int low, int high, uint8_t **planes, int planeCount, int width, int height) {
+    static const uint8_t phase[2][2] = {{0, 2}, {3, 1}};
+    int rowByteCount = width >> 3;
+    int range = high > low ? high - low : 1;
+    float widthScale = (float)image->width / width;
+    float heightScale = (float)image->height / height;
+    for (uint16_t i = 0; i < height; i++) {
+        uint16_t yOff = i * heightScale;
+        for (uint16_t j = 0; j < rowByteCount; j++) {
+            uint8_t bits[7] = {0};
+            for (int b = 0; b < 8; b++) {
+                uint16_t x = (j << 3) + b;
+                int p = RGB24_to_BW8(image, x * widthScale, yOff) - low;
+                int level = p <= 0 ? 0 : (p >= range ? planeCount : (p * (planeCount + 1)) / (range + 1));
+                int start = phase[i & 1][x & 1] * planeCount >> 2;
+                for (int k = 0; k < level; k++) {
+                    int plane = start + k;
+                    if (plane >= planeCount) plane -= planeCount;
+                    bits[plane] |= 0x80 >> b;
+                }
+            }
+            for (int k = 0; k < planeCount; k++)
+                planes[k][i * rowByteCount + j] = bits[k];
+        }
+    }
+}
+
+static inline uint8_t zoomImg2x(const uint8_t *imgRowOff, int imgByteWidth, int xByteOff) {
+    uint8_t pix0 = imgRowOff[xByteOff];
+    uint8_t pix1 = (xByteOff + 1 < imgByteWidth) ? imgRowOff[xByteOff + 1] : 0;
+    return ((pix0 & 0b10000000) << 0) | ((pix0 & 0b01000000) << 1) |
+           ((pix0 & 0b00100000) << 1) | ((pix0 & 0b00010000) << 2) |
+           ((pix0 & 0b00001000) << 2) | ((pix0 & 0b00000100) << 3) |
+           ((pix0 & 0b00000010) << 3) | ((pix0 & 0b00000001) << 4) |
+
+           ((pix1 & 0b10000000) >> 4) | ((pix1 & 0b01000000) >> 3) |
+           ((pix1 & 0b00100000) >> 3) | ((pix1 & 0b00010000) >> 2) |
+           ((pix1 & 0b00001000) >> 2) | ((pix1 & 0b00000100) >> 1) |
+           ((pix1 & 0b00000010) >> 1) | ((pix1 & 0b00000001) >> 0);
+}
+
+static inline uint8_t zoomImg4x(const uint8_t *imgRowOff, int imgByteWidth, int xByteOff) {
+    uint8_t pix0 = imgRowOff[xByteOff];
+    uint8_t pix1 = (xByteOff + 1 < imgByteWidth) ? imgRowOff[xByteOff + 1] : 0;
+    uint8_t pix2 = (xByteOff + 2 < imgByteWidth) ? imgRowOff[xByteOff + 2] : 0;
+    uint8_t pix3 = (xByteOff + 3 < imgByteWidth) ? imgRowOff[xByteOff + 3] : 0;
+    return ((pix0 & 0b10000000) << 0) | ((pix0 & 0b01000000) << 1) | ((pix0 & 0b00100000) << 2) | ((pix0 & 0b00010000) << 3) |
+           ((pix0 & 0b00001000) << 3) | ((pix0 & 0b00000100) << 4) | ((pix0 & 0b00000010) << 5) | ((pix0 & 0b00000001) << 6) |
+
+           ((pix1 & 0b10000000) >> 2) | ((pix1 & 0b01000000) >> 1) | ((pix1 & 0b00100000) << 0) | ((pix1 & 0b00010000) << 1) |
+           ((pix1 & 0b00001000) << 1) | ((pix1 & 0b00000100) << 2) | ((pix1 & 0b00000010) << 3) | ((pix1 & 0b00000001) << 4) |
+
+           ((pix2 & 0b10000000) >> 4) | ((pix2 & 0b01000000) >> 3) | ((pix2 & 0b00100000) >> 2) | ((pix2 & 0b00010000) >> 1) |
+           ((pix2 & 0b00001000) >> 1) | ((pix2 & 0b00000100) >> 0) | ((pix2 & 0b00000010) << 1) | ((pix2 & 0b00000001) << 2) |
+
+           ((pix3 & 0b10000000) >> 6) | ((pix3 & 0b01000000) >> 5) | ((pix3 & 0b00100000) >> 4) | ((pix3 & 0b00010000) >> 3) |
+           ((pix3 & 0b00001000) >> 3) | ((pix3 & 0b00000100) >> 2) | ((pix3 & 0b00000010) >> 1) | ((pix3 & 0b00000001) >> 0);
+}
+
+// Widest frame row the zoom kernels take, in bytes
+#define IMAGE_ZOOM_MAX_FRAME_BYTES 16
+
+// Funnel shift of a 1 bit row: dst byte j gets source pixels xOff + 8j to xOff + 8j + 7, zero past the row end.
+// Whole words while the byte after them is still in the row
+void imageShiftRow(uint8_t *dst, const uint8_t *src, int srcByteWidth, int xOff, int count) {
+    int b = xOff >> 3, s = xOff & 7;
+    int avail = srcByteWidth - b;
+    if (avail < 0) avail = 0;
+    src += b;
+
+    int j = 0;
+    if (s == 0) {
+        j = count < avail ? count : avail;
+        memcpy(dst, src, j);
+    } else {
+        for (; j + 4 < avail && j + 4 <= count; j += 4) {
+            uint32_t word = (uint32_t)src[j] << 24 | (uint32_t)src[j + 1] << 16 | (uint32_t)src[j + 2] << 8 | src[j + 3];
+            word = word << s | src[j + 4] >> (8 - s);
+            dst[j] = word >> 24;
+            dst[j + 1] = word >> 16;
+            dst[j + 2] = word >> 8;
+            dst[j + 3] = word;
+        }
+        for (; j < count && j < avail; j++)
+            dst[j] = src[j] << s | (j + 1 < avail ? src[j + 1] >> (8 - s) : 0);
+    }
+    if (j < count) memset(dst + j, 0, count - j);
+}
+
+// Zoom out 1 bit image by 2 into frame rows, starting at image pixel column xOff
+void imageZoom2x(uint8_t *frame, int frameByteWidth, int rows,
+                 const uint8_t *img, int imgByteWidth, int xOff) {
+    uint8_t row0[IMAGE_ZOOM_MAX_FRAME_BYTES * 2], row1[IMAGE_ZOOM_MAX_FRAME_BYTES * 2];
+    int w = frameByteWidth * 2;
+    for (int i = 0; i < rows; i++) {
+        uint8_t *off = frame + i * frameByteWidth;
+        const uint8_t *imgOff = img + (i * 2 * imgByteWidth);
+        imageShiftRow(row0, imgOff, imgByteWidth, xOff, w);
+        imageShiftRow(row1, imgOff + imgByteWidth, imgByteWidth, xOff, w);
+        for (int j = 0; j < w; j += 2) {
+            off[j >> 1] = zoomImg2x(row0, w, j) | zoomImg2x(row1, w, j);
+        }
+    }
+}
+
+// Zoom out 1 bit image by 4 into frame rows, starting at image pixel column xOff
+void imageZoom4x(uint8_t *frame, int frameByteWidth, int rows,
+                 const uint8_t *img, int imgByteWidth, int xOff) {
+    uint8_t row[IMAGE_ZOOM_MAX_FRAME_BYTES * 4];
+    int w = frameByteWidth * 4;
+    for (int i = 0; i < rows; i++) {
+        uint8_t *off = frame + i * frameByteWidth;
+        imageShiftRow(row, img + (i * 4 * imgByteWidth), imgByteWidth, xOff, w);
+        for (int j = 0; j < w; j += 4) {
+            off[j >> 2] = zoomImg4x(row, w, j);
+        }
+    }
+}
+
+// Row major 1 bit bitmap to display pages, bit 0 of a page byte is the top row of the page.
+// Height is multiple of 8
+void imageBitmapToPages(uint8_t *pages, const uint8_t *bitmap, int byteWidth, int height) {
+    int width = byteWidth << 3;
+    for (int page = 0; page < height >> 3; page++) {
+        const uint8_t *rows = bitmap + (page << 3) * byteWidth;
+        uint8_t *segs = pages + page * width;
+        for (int j = 0; j < byteWidth; j++) {
+            // 8x8 block, rows packed in two words so each column is a shift and mask per row
+            uint32_t hi = (uint32_t)rows[j] << 24 | (uint32_t)rows[byteWidth + j] << 16 |
+                          (uint32_t)rows[2 * byteWidth + j] << 8 | rows[3 * byteWidth + j];
+            uint32_t lo = (uint32_t)rows[4 * byteWidth + j] << 24 | (uint32_t)rows[5 * byteWidth + j] << 16 |
+                          (uint32_t)rows[6 * byteWidth + j] << 8 | rows[7 * byteWidth + j];
+            for (int k = 0; k < 8; k++) {
+                int shift = 7 - k;
+                uint8_t seg = (hi >> (24 + shift) & 1) | (hi >> (15 + shift) & 2) |
+                              (hi >> (6 + shift) & 4) | (hi << 3 >> shift & 8) |
+                              (lo >> (20 + shift) & 16) | (lo >> (11 + shift) & 32) |
+                              (lo >> (2 + shift) & 64) | (lo << 7 >> shift & 128);
+                segs[(j << 3) + k] = seg;
+            }
+        }
+    }
+}
+
+#endif
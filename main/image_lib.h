@@ -1,15 +1,14 @@
 #include <stdbool.h>
+#include <sdkconfig.h>
 
+#if CONFIG_IDF_TARGET_LINUX
+#include "module/host_jpeg.h"
+#else
 #include <esp_jpg_decode.h>
+#endif
 
 #include "spi_ram.h"
-
-typedef struct {
-    uint16_t width;
-    uint16_t height;
-    uint8_t *input;
-    uint8_t *output;
-} ImageData;
+#include "image_kernels.h"
 
 // output buffer and image width
 static bool _rgb_write(void *arg, uint16_t x, uint16_t y, uint16_t w, uint16_t h, uint8_t *data) {
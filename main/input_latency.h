@@ -0,0 +1,61 @@
+#ifndef __INPUT_LATENCY_H__
+#define __INPUT_LATENCY_H__
+
+#include <stdint.h>
+#include <inttypes.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+
+#include "perf_stats.h"
+
+static const char *TAG_LATENCY = "main:latency";
+
+// Button interaction measured from button event to display flush
+typedef enum input_latency_type {
+    INPUT_LATENCY_CLICK_RENDER,       // Click to result re-render
+    INPUT_LATENCY_DOUBLE_CLICK_ZOOM,  // Double click to zoomed result
+    INPUT_LATENCY_LONG_PRESS_SCROLL,  // Long press to first scroll frame
+    INPUT_LATENCY_COUNT,
+} InputLatencyType;
+
+static const char *const inputLatencyNames[INPUT_LATENCY_COUNT] = {
+    "click_render",
+    "double_click_zoom",
+    "long_press_scroll",
+};
+
+PerfHistogram inputLatency[INPUT_LATENCY_COUNT];
+
+// Interaction waiting for its display flush, only used from main task
+static struct {
+    bool pending;
+    InputLatencyType type;
+    int64_t eventUs;
+} inputLatencyPending;
+
+// Start measuring an interaction, eventUs is the esp_timer time of the button event
+static inline void inputLatencyBegin(InputLatencyType type, int64_t eventUs) {
+    inputLatencyPending.pending = true;
+    inputLatencyPending.type = type;
+    inputLatencyPending.eventUs = eventUs;
+}
+
+static inline void inputLatencyCancel() {
+    inputLatencyPending.pending = false;
+}
+
+// Call after display flush, record latency of the pending interaction
+void inputLatencyFlushed() {
+    if (!inputLatencyPending.pending) return;
+    inputLatencyPending.pending = false;
+
+    InputLatencyType type = inputLatencyPending.type;
+    PerfHistogram *hist = &inputLatency[type];
+    uint32_t latency = esp_timer_get_time() - inputLatencyPending.eventUs;
+    perfHistRecord(hist, latency);
+    ESP_LOGI(TAG_LATENCY, "%s %" PRIu32 " us, p50 %" PRIu32 " p99 %" PRIu32 " max %" PRIu32 " us (%" PRIu32 ")",
+             inputLatencyNames[type], latency,
+             perfHistPercentile(hist, 50), perfHistPercentile(hist, 99), hist->max, hist->count);
+}
+
+#endif
@@ -1,3 +1,4 @@
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -6,23 +7,37 @@
 #include <esp_system.h>
 #include <sys/param.h>
 #include <nvs_flash.h>
-#include <iot_button.h>
+#include <pthread.h>
+#if !CONFIG_IDF_TARGET_LINUX
+#include <driver/gpio.h>
+#endif
 
 #include "millis.h"
 #include "log_util.h"
+#include "app_event.h"
+#include "boot_timeline.h"
+#include "frame_scheduler.h"
+#include "input_latency.h"
+#include "result_tiles.h"
+#include "result_text.h"
 #include "module/camera_control.h"
 #include "module/oled_control.h"
+#include "module/button_control.h"
 
 #include "ota_update.h"
 #include "module/wifi_control.h"
 #include "module/http_api_control.h"
+#include "module/metrics_server.h"
+#include "module/telemetry.h"
 
 #define LED_PIN 4
-#define BTN_OK_PIN 13
 
 #define PREVIEW_FRAMESIZE FRAMESIZE_QQVGA
 #define PREVIEW_QUALITY 4
-#define TARGET_FRAME_DELAY 1000 / 12
+#define CAPTURE_WIFI_WAIT_MS 3000
+#define CAMERA_INIT_STACK_SIZE 4096
+#define ERROR_MESSAGE_TIME_MS 500
+#define RESULT_SCROLL_SPEED 240  // Display pixels per second
 
 #ifndef __has_attribute
 #define __has_attribute(x) 0
@@ -43,18 +58,29 @@ typedef enum app_state {
     APP_STATE_RESULT,
     APP_STATE_RESULT_SCROLL,
     APP_STATE_RESULT_RENDER,
-    APP_STATE_RESULT_CLEAN,
+    APP_STATE_ERROR,
     APP_STATE_OTA,
 } AppState;
+// Only changed by main task
 AppState appState = APP_STATE_PREVIEW;
+// Time of the event that entered current state, input before this was made on the previous screen
+int64_t appStateEnterUs;
 
 // Result variable
 ImageData imageResult;
-int imageResultByteOffsetX;
+int imageResultOffsetX, imageResultOffsetY;  // Result image pixels
 uint8_t imageResultZoom;
+// By zoom level. Raster results zoom out 4 and 2 times,
+// text results are laid out at 1x and 2x font size and shown as is
+ResultTiles imageResultTiles[2];
+ImageData imageResultText[2];
+// Scroll distance is from time since this, leftover below a pixel is kept by not advancing it fully
+int64_t imageResultScrollUs;
 typedef enum result_control {
     RESULT_CONTROL_RIGHT,
     RESULT_CONTROL_LEFT,
+    RESULT_CONTROL_DOWN,
+    RESULT_CONTROL_UP,
     RESULT_CONTROL_RESET,
 } ResultControl;
 ResultControl imageResultControl;
@@ -69,169 +95,180 @@ static esp_err_t nvsFlashInit() {
 }
 
 static void capureImage(ImageData *imageOut) {
+    TelemetryCapture telemetry = {0};
+    // Hold back background network work for the whole capture workflow
+    netSchedulerBegin(NET_PRIORITY_CAPTURE);
+    if (!wifiWaitReady(pdMS_TO_TICKS(CAPTURE_WIFI_WAIT_MS))) {
+        oledShowString(0, "No WiFi");
+        telemetry.failedStep = TELEMETRY_STEP_WIFI;
+        goto FAILED;
+    }
+    wifiSetPsProfile(WIFI_PS_PROFILE_LATENCY);
+    int64_t stageStart = perfStageBegin(PERF_STAGE_CAPTURE_SWITCH);
     cameraChangeSettings(FRAMESIZE_UXGA, 6);
+    telemetry.captureSwitchUs = perfStageEnd(PERF_STAGE_CAPTURE_SWITCH, stageStart);
     // cameraChangeSettings(FRAMESIZE_XGA, 3);
     ESP_LOGI(TAG, "Take picture");
-    oledClear();
-    oledShowString(0, "Capture image");
+    oledClearLayers();
+    oledSetString(0, "Capture image");
+    oledFlush();
     delay(500);
 
     camera_fb_t *pic = esp_camera_fb_get();
     // Reset preview camera setting
+    stageStart = perfStageBegin(PERF_STAGE_CAPTURE_SWITCH);
     cameraChangeSettings(PREVIEW_FRAMESIZE, PREVIEW_QUALITY);
+    telemetry.captureSwitchUs += perfStageEnd(PERF_STAGE_CAPTURE_SWITCH, stageStart);
+    // Rest of the workflow only waits on the network
+    cameraSleep();
     if (!pic) {
         ESP_LOGE(TAG, "Failed to read image");
         oledShowString(0, "Failed capture");
+        telemetry.failedStep = TELEMETRY_STEP_CAMERA;
         goto FAILED;
     }
     // size_t imageSize = pic->len, imageWidth = pic->width, imageHeight = pic->height;
     // ESP_LOGI(TAG, "Image size: %zux%zu (%zu bytes)", imageWidth, imageHeight, imageSize);
 
-    // Show image
-    oledClearLine(0);
-    oledUpdateImage(pic->buf, pic->len, true, JPG_SCALE_8X);
+    // Show image, covers the whole panel
+    oledUpdateImage(pic->buf, pic->len, true, JPG_SCALE_8X, false);
 
     // Send image
     oledShowString(0, "Sending image...");
     // UUID
     char processId[37];
+    stageStart = perfStageBegin(PERF_STAGE_UPLOAD);
     esp_err_t result = httpSendImageProcess(pic->buf, pic->len, processId, sizeof(processId) - 1);
+    telemetry.uploadUs = perfStageEnd(PERF_STAGE_UPLOAD, stageStart);
+    telemetry.uploadBytes = pic->len;
     esp_camera_fb_return(pic);
     if (result != ESP_OK) {
         oledShowString(0, "Send image fail");
+        telemetry.failedStep = TELEMETRY_STEP_UPLOAD;
         goto FAILED;
     }
     ESP_LOGI(TAG, "Id: %s", processId);
 
     // Wait image processing
     oledShowString(1, "Processing...   ");
+    stageStart = perfStageBegin(PERF_STAGE_WAIT_PROCESS);
     result = httpWaitImageProcess(pic->buf, processId);
+    telemetry.waitProcessUs = perfStageEnd(PERF_STAGE_WAIT_PROCESS, stageStart);
     if (result != ESP_OK) {
         oledShowString(0, "Processing fail ");
+        telemetry.failedStep = TELEMETRY_STEP_WAIT_PROCESS;
         goto FAILED;
     }
 
     // Wait problem solving
     oledShowString(2, "Solving...      ");
+    stageStart = perfStageBegin(PERF_STAGE_WAIT_SOLVE);
     result = httpWaitImageProcess(pic->buf, processId);
+    telemetry.waitSolveUs = perfStageEnd(PERF_STAGE_WAIT_SOLVE, stageStart);
     if (result != ESP_OK) {
         oledShowString(0, "Solving fail   ");
+        telemetry.failedStep = TELEMETRY_STEP_WAIT_SOLVE;
         goto FAILED;
     }
 
     // Get final result
     oledShowString(3, "Analyzing...    ");
+    stageStart = perfStageBegin(PERF_STAGE_RESULT_DOWNLOAD);
     result = httpGetProcessResult(pic->buf, processId, imageOut);
+    telemetry.resultDownloadUs = perfStageEnd(PERF_STAGE_RESULT_DOWNLOAD, stageStart);
     if (result != ESP_OK) {
         oledShowString(0, "Analyzing fail  ");
+        telemetry.failedStep = TELEMETRY_STEP_RESULT_DOWNLOAD;
         goto FAILED;
     }
+    telemetry.resultBytes = imageOut->width ? imageOut->width * imageOut->height / 8 : resultTextSize(imageOut->output);
 
-    // Set render result state
-    imageResultByteOffsetX = 0;
-    imageResultZoom = 0;
-    imageResultControl = 0;
-    appState = APP_STATE_RESULT_RENDER;
+    telemetryAddCapture(&telemetry);
+    wifiSetPsProfile(WIFI_PS_PROFILE_SAVE);
+    netSchedulerEnd(NET_PRIORITY_CAPTURE);
+    appEventPost(APP_EVENT_CAPTURE_DONE);
     return;
 
 FAILED:
-    appState = APP_STATE_PREVIEW;
-    delay(500);  // For showing error
+    telemetryAddCapture(&telemetry);
+    wifiSetPsProfile(WIFI_PS_PROFILE_SAVE);
+    netSchedulerEnd(NET_PRIORITY_CAPTURE);
+    appEventPost(APP_EVENT_CAPTURE_FAILED);
     return;
 }
 
-static inline uint8_t zoomImg2x(uint8_t *imgRowOff, int imgByteWidth, int xByteOff) {
-    uint8_t pix0 = imgRowOff[xByteOff];
-    uint8_t pix1 = (xByteOff + 1 < imgByteWidth) ? imgRowOff[xByteOff + 1] : 0;
-    return ((pix0 & 0b10000000) << 0) | ((pix0 & 0b01000000) << 1) |
-           ((pix0 & 0b00100000) << 1) | ((pix0 & 0b00010000) << 2) |
-           ((pix0 & 0b00001000) << 2) | ((pix0 & 0b00000100) << 3) |
-           ((pix0 & 0b00000010) << 3) | ((pix0 & 0b00000001) << 4) |
-
-           ((pix1 & 0b10000000) >> 4) | ((pix1 & 0b01000000) >> 3) |
-           ((pix1 & 0b00100000) >> 3) | ((pix1 & 0b00010000) >> 2) |
-           ((pix1 & 0b00001000) >> 2) | ((pix1 & 0b00000100) >> 1) |
-           ((pix1 & 0b00000010) >> 1) | ((pix1 & 0b00000001) >> 0);
-}
-
-static inline uint8_t zoomImg4x(uint8_t *imgRowOff, int imgByteWidth, int xByteOff) {
-    uint8_t pix0 = imgRowOff[xByteOff];
-    uint8_t pix1 = (xByteOff + 1 < imgByteWidth) ? imgRowOff[xByteOff + 1] : 0;
-    uint8_t pix2 = (xByteOff + 2 < imgByteWidth) ? imgRowOff[xByteOff + 2] : 0;
-    uint8_t pix3 = (xByteOff + 3 < imgByteWidth) ? imgRowOff[xByteOff + 3] : 0;
-    return ((pix0 & 0b10000000) << 0) | ((pix0 & 0b01000000) << 1) | ((pix0 & 0b00100000) << 2) | ((pix0 & 0b00010000) << 3) |
-           ((pix0 & 0b00001000) << 3) | ((pix0 & 0b00000100) << 4) | ((pix0 & 0b00000010) << 5) | ((pix0 & 0b00000001) << 6) |
-
-           ((pix1 & 0b10000000) >> 2) | ((pix1 & 0b01000000) >> 1) | ((pix1 & 0b00100000) << 0) | ((pix1 & 0b00010000) << 1) |
-           ((pix1 & 0b00001000) << 1) | ((pix1 & 0b00000100) << 2) | ((pix1 & 0b00000010) << 3) | ((pix1 & 0b00000001) << 4) |
-
-           ((pix2 & 0b10000000) >> 4) | ((pix2 & 0b01000000) >> 3) | ((pix2 & 0b00100000) >> 2) | ((pix2 & 0b00010000) >> 1) |
-           ((pix2 & 0b00001000) >> 1) | ((pix2 & 0b00000100) >> 0) | ((pix2 & 0b00000010) << 1) | ((pix2 & 0b00000001) << 2) |
-
-           ((pix3 & 0b10000000) >> 6) | ((pix3 & 0b01000000) >> 5) | ((pix3 & 0b00100000) >> 4) | ((pix3 & 0b00010000) >> 3) |
-           ((pix3 & 0b00001000) >> 3) | ((pix3 & 0b00000100) >> 2) | ((pix3 & 0b00000010) >> 1) | ((pix3 & 0b00000001) >> 0);
+// Drop tiles and text layouts of the previous result
+static void resultViewReset() {
+    for (int i = 0; i < 2; i++) {
+        resultTilesReset(&imageResultTiles[i]);
+        free(imageResultText[i].output);
+        imageResultText[i].output = NULL;
+    }
+    resultTextUnload();
 }
 
-static void renderResultImage(ImageData *image) {
-    uint8_t frame[BITMAP_ROW_BYTE_COUNT * 64];
-    uint8_t *resultImg = image->output + 4;
-    int imgByteWidth = image->width >> 3;
-
-    if (imageResultZoom == 1) {
-        // int w = MIN(imgByteWidth, BITMAP_ROW_BYTE_COUNT);
-        // for (size_t i = 0; i < 64; i++) {
-        //     memcpy(frame + i * BITMAP_ROW_BYTE_COUNT, resultImg + imageResultByteOffsetX + i * imgByteWidth, w);
-        // }
-
-        // Limit image scroll offset
-        if (imgByteWidth < BITMAP_ROW_BYTE_COUNT * 2 || imageResultByteOffsetX < 0)
-            imageResultByteOffsetX = 0;
-        else if (imageResultByteOffsetX + BITMAP_ROW_BYTE_COUNT * 2 > imgByteWidth)
-            imageResultByteOffsetX = imgByteWidth - BITMAP_ROW_BYTE_COUNT * 2;
-
-        for (size_t i = 0; i < 64; i++) {
-            uint8_t *off = frame + i * BITMAP_ROW_BYTE_COUNT;
-            uint8_t *imgOff = resultImg + (i * 2 * imgByteWidth) + imageResultByteOffsetX;
-            int w = MIN(imgByteWidth, BITMAP_ROW_BYTE_COUNT * 2);
-            for (size_t j = 0; j < w; j += 2) {
-                off[j >> 1] = zoomImg2x(imgOff, imgByteWidth, j) |
-                              zoomImg2x(imgOff + imgByteWidth, imgByteWidth, j);
-            }
-        }
-    } else {
-        if (imgByteWidth < BITMAP_ROW_BYTE_COUNT * 4 || imageResultByteOffsetX < 0)
-            imageResultByteOffsetX = 0;
-        else if (imageResultByteOffsetX + BITMAP_ROW_BYTE_COUNT * 4 > imgByteWidth)
-            imageResultByteOffsetX = imgByteWidth - BITMAP_ROW_BYTE_COUNT * 4;
-
-        memset(frame, 0, BITMAP_ROW_BYTE_COUNT * 64);
-        for (size_t i = 0; i < 32; i++) {
-            uint8_t *off = frame + (16 + i) * BITMAP_ROW_BYTE_COUNT;
-            uint8_t *imgOff = resultImg + (i * 4 * imgByteWidth) + imageResultByteOffsetX;
-            int w = MIN(imgByteWidth, BITMAP_ROW_BYTE_COUNT * 4);
-            for (size_t j = 0; j < w; j += 4) {
-                off[j >> 2] = zoomImg4x(imgOff, imgByteWidth, j);
-            }
-        }
+static void resultViewInit() {
+    resultViewReset();
+    if (imageResult.width) {
+        imageResultTiles[0] = (ResultTiles){.image = &imageResult, .zoom = 4};
+        imageResultTiles[1] = (ResultTiles){.image = &imageResult, .zoom = 2};
+        return;
+    }
+    resultTextLoad(imageResult.output);
+    for (int i = 0; i < 2; i++) {
+        resultTextLayout(imageResult.output, i + 1, &imageResultText[i]);
+        imageResultTiles[i] = (ResultTiles){.image = &imageResultText[i], .zoom = 1};
     }
-    oledShowBitmap(frame);
+}
 
-    // Mode display
+static void renderResultImage() {
+    uint8_t pages[OLED_PAGES][OLED_WIDTH];
+    int64_t stageStart = perfStageBegin(PERF_STAGE_RENDER);
+    ResultTiles *tiles = &imageResultTiles[imageResultZoom];
+    int zoom = tiles->zoom;
+    int height = resultTilesHeight(tiles);
+
+    // Limit image scroll offset, narrow results stay at the left and short ones are centered
+    int maxX = (resultTilesWidth(tiles) - OLED_WIDTH) * zoom;
+    int maxY = (height - OLED_HEIGHT) * zoom;
+    if (maxX < 0 || imageResultOffsetX < 0)
+        imageResultOffsetX = 0;
+    else if (imageResultOffsetX > maxX)
+        imageResultOffsetX = maxX;
+    if (maxY < 0 || imageResultOffsetY < 0)
+        imageResultOffsetY = 0;
+    else if (imageResultOffsetY > maxY)
+        imageResultOffsetY = maxY;
+
+    int y = maxY < 0 ? (height - OLED_HEIGHT) / 2 : imageResultOffsetY / zoom;
+    resultTilesView(tiles, imageResultOffsetX / zoom, y, pages[0], OLED_WIDTH, OLED_PAGES);
+    perfStageEnd(PERF_STAGE_RENDER, stageStart);
+    oledSetContentPages(pages);
+
+    // Mode display, sent with the frame
     switch (imageResultControl) {
     case RESULT_CONTROL_RIGHT:
-        oledShowString(0, ">");
+        oledSetMode('>');
         break;
     case RESULT_CONTROL_LEFT:
-        oledShowString(0, "<");
+        oledSetMode('<');
+        break;
+    case RESULT_CONTROL_DOWN:
+        oledSetMode('v');
+        break;
+    case RESULT_CONTROL_UP:
+        oledSetMode('^');
         break;
     case RESULT_CONTROL_RESET:
-        oledShowString(0, "-");
+        oledSetMode('-');
         break;
     }
+    oledFlush();
 }
 
 void capureImagePreview() {
     // Capture preview image
+    int64_t stageStart = perfStageBegin(PERF_STAGE_CAM_FB_GET);
     camera_fb_t *pic = esp_camera_fb_get();
     if (!pic) {
         ESP_LOGE(TAG, "Failed to read preview image");
@@ -239,119 +276,249 @@ void capureImagePreview() {
         delay(100);
         return;
     }
+    perfStageEnd(PERF_STAGE_CAM_FB_GET, stageStart);
 
     // size_t imageSize = pic->len,imageWidth = pic->width,imageHeight = pic->height;
     // ESP_LOGI(TAG, "Image size: %zux%zu (%zu bytes)", imageWidth, imageHeight, imageSize);
 
-    oledUpdateImage(pic->buf, pic->len, false, JPG_SCALE_2X);
+    oledUpdateImage(pic->buf, pic->len, false, JPG_SCALE_2X, true);
     esp_camera_fb_return(pic);
 }
 
-void btnOkClick() {
+static void appSetState(AppState state, int64_t timeUs) {
+    appState = state;
+    appStateEnterUs = timeUs;
+}
+
+static void appHandleClick(const AppEvent *event) {
     if (appState == APP_STATE_PREVIEW) {
-        appState = APP_STATE_CAPTURE;
+        appSetState(APP_STATE_CAPTURE, event->timeUs);
     } else if (appState == APP_STATE_RESULT) {
         if (imageResultControl == RESULT_CONTROL_RESET)
             imageResultControl = 0;
         else
             imageResultControl++;
-        appState = APP_STATE_RESULT_RENDER;
+        appSetState(APP_STATE_RESULT_RENDER, event->timeUs);
+        inputLatencyBegin(INPUT_LATENCY_CLICK_RENDER, event->timeUs);
     }
 }
 
-void btnOkLongPress(void *button_handle, void *usr_data) {
+static void appHandleLongPress(const AppEvent *event) {
     if (appState != APP_STATE_RESULT && appState != APP_STATE_RESULT_SCROLL)
         return;
 
-    if (usr_data) {
-        appState = APP_STATE_RESULT_SCROLL;
-    } else
-        appState = APP_STATE_RESULT;
+    if (event->type == APP_EVENT_BTN_LONG_PRESS_START) {
+        appSetState(APP_STATE_RESULT_SCROLL, event->timeUs);
+        imageResultScrollUs = event->timeUs;
+        inputLatencyBegin(INPUT_LATENCY_LONG_PRESS_SCROLL, event->timeUs);
+    } else {
+        appSetState(APP_STATE_RESULT, event->timeUs);
+        inputLatencyCancel();
+    }
 }
 
-void btnOkDoubleClick() {
+static void appHandleDoubleClick(const AppEvent *event) {
     if (appState == APP_STATE_PREVIEW) {
-        appState = APP_STATE_PREVIOUS_RESULT;
+        appSetState(APP_STATE_PREVIOUS_RESULT, event->timeUs);
     }
     // Result control
     else if (appState == APP_STATE_RESULT) {
-        if (imageResultByteOffsetX == 0 && imageResultControl == RESULT_CONTROL_RESET)
+        if (imageResultOffsetX == 0 && imageResultOffsetY == 0 && imageResultControl == RESULT_CONTROL_RESET) {
             // Clean result
-            appState = APP_STATE_RESULT_CLEAN;
-        else {
+            resultViewReset();
+            free(imageResult.output);
+            imageResult.output = NULL;
+            appSetState(APP_STATE_PREVIEW, event->timeUs);
+        } else {
             // Change zoom
             if (++imageResultZoom == 2)
                 imageResultZoom = 0;
-            appState = APP_STATE_RESULT_RENDER;
+            appSetState(APP_STATE_RESULT_RENDER, event->timeUs);
+            inputLatencyBegin(INPUT_LATENCY_DOUBLE_CLICK_ZOOM, event->timeUs);
         }
     }
 }
 
-button_config_t btnOkConfig = {
-    .type = BUTTON_TYPE_GPIO,
-    .long_press_time = CONFIG_BUTTON_LONG_PRESS_TIME_MS,
-    .short_press_time = CONFIG_BUTTON_SHORT_PRESS_TIME_MS,
-    .gpio_button_config = {
-        .gpio_num = BTN_OK_PIN,
-        .active_level = 0,
-        .enable_power_save = true,
-    },
-};
+static void appHandleEvent(const AppEvent *event) {
+    TRACE_INSTANT(TRACE_EVENT_APP_HANDLE, event->type);
+    if (appEventIsInput(event->type) && event->timeUs < appStateEnterUs) {
+        ESP_LOGD(TAG, "Stale input %d dropped", event->type);
+        return;
+    }
+
+    switch (event->type) {
+    case APP_EVENT_BTN_CLICK:
+        appHandleClick(event);
+        break;
+    case APP_EVENT_BTN_DOUBLE_CLICK:
+        appHandleDoubleClick(event);
+        break;
+    case APP_EVENT_BTN_LONG_PRESS_START:
+    case APP_EVENT_BTN_LONG_PRESS_UP:
+        appHandleLongPress(event);
+        break;
+    case APP_EVENT_CAPTURE_DONE:
+        // Set render result state
+        imageResultOffsetX = 0;
+        imageResultOffsetY = 0;
+        imageResultZoom = 0;
+        resultViewInit();
+        imageResultControl = 0;
+        appSetState(APP_STATE_RESULT_RENDER, event->timeUs);
+        break;
+    case APP_EVENT_CAPTURE_FAILED:
+        // Keep error on screen before going back to preview
+        appSetState(APP_STATE_ERROR, event->timeUs);
+        appEventTimerStart(ERROR_MESSAGE_TIME_MS);
+        break;
+    case APP_EVENT_TIMER:
+        if (appState == APP_STATE_ERROR)
+            appSetState(APP_STATE_PREVIEW, event->timeUs);
+        break;
+    case APP_EVENT_OTA_START:
+        appSetState(APP_STATE_OTA, event->timeUs);
+        break;
+    }
+}
+
+// Handle events until the wait ends, return early when the state changed and needs a frame
+static void appProcessEvents(TickType_t wait) {
+    AppEvent event;
+    while (appEventWait(&event, wait)) {
+        AppState lastState = appState;
+        appHandleEvent(&event);
+        if (appState != lastState)
+            return;
+        wait = frameTicksLeft(&frameScheduler);
+    }
+}
+
+static esp_err_t cameraInitResult;
+static void *cameraInitThread(void *args) {
+    bootPhaseBegin(BOOT_PHASE_CAMERA);
+    cameraInitResult = cameraInit();
+    if (cameraInitResult == ESP_OK)
+        cameraChangeSettings(PREVIEW_FRAMESIZE, PREVIEW_QUALITY);
+    bootPhaseEnd(BOOT_PHASE_CAMERA);
+    return NULL;
+}
+
+// Frame rate of what is on screen in current state
+static FrameRateClass appFrameRate() {
+    switch (appState) {
+    case APP_STATE_PREVIEW:
+        return FRAME_RATE_PREVIEW;
+    case APP_STATE_RESULT_SCROLL:
+        return FRAME_RATE_SCROLL;
+    default:
+        return FRAME_RATE_IDLE;
+    }
+}
+
+// Camera frames are used in current state, the sensor is in standby otherwise.
+// Error state goes back to preview, the sensor wakes up while the message is shown
+static bool appUsesCamera() {
+    switch (appState) {
+    case APP_STATE_PREVIEW:
+    case APP_STATE_CAPTURE:
+    case APP_STATE_PREVIOUS_RESULT:
+    case APP_STATE_ERROR:
+        return true;
+    default:
+        return false;
+    }
+}
 
 void app_main(void) {
     #if (CONFIG_SPIRAM_SUPPORT && (CONFIG_SPIRAM_USE_CAPS_ALLOC || CONFIG_SPIRAM_USE_MALLOC))
         ESP_LOGI(TAG, "SPIRAM is enabled");
     #endif
+    bootPhaseBegin(BOOT_PHASE_FIRST_PREVIEW);
+    if (traceInit() != ESP_OK)
+        ESP_LOGE(TAG, "Failed to init trace");
+    traceNameArgs(TRACE_EVENT_STAGE, perfStageNames, PERF_STAGE_COUNT);
+
+    bootPhaseBegin(BOOT_PHASE_NVS);
+    esp_err_t nvsResult = nvsFlashInit();
+    bootPhaseEnd(BOOT_PHASE_NVS);
+
+    // WiFi associates in background, OTA thread and capture wait for it
+    esp_err_t wifiResult = ESP_FAIL;
+    if (nvsResult == ESP_OK) {
+        bootPhaseBegin(BOOT_PHASE_WIFI_START);
+        wifiResult = wifiStart();
+        bootPhaseEnd(BOOT_PHASE_WIFI_START);
+        if (wifiResult == ESP_OK && metricsServerStart() != ESP_OK)
+            ESP_LOGE(TAG, "Failed to start metrics server");
+    }
+
+    // Camera init runs while display and buttons initialize
+    pthread_t cameraInitThreadt;
+    pthread_attr_t cameraInitAttr;
+    pthread_attr_init(&cameraInitAttr);
+    pthread_attr_setstacksize(&cameraInitAttr, CAMERA_INIT_STACK_SIZE);
+    pthread_create(&cameraInitThreadt, &cameraInitAttr, cameraInitThread, NULL);
+    pthread_attr_destroy(&cameraInitAttr);
+
+    bootPhaseBegin(BOOT_PHASE_OLED);
     init_oled_panel();
     oledShowString(0, "Booting...");
+    bootPhaseEnd(BOOT_PHASE_OLED);
 
-    oledShowString(1, "Init NVS...");
-    if (ESP_OK != nvsFlashInit()) {
+    if (nvsResult != ESP_OK) {
         oledShowString(1, "Failed NVS   ");
         return;
     }
-
-    oledShowString(1, "Init WiFi...  ");
-    if (ESP_OK != wifi_connect()) {
+    if (wifiResult != ESP_OK) {
         oledShowString(1, "Failed WiFi  ");
         return;
     }
-    otaUpadateCheckStart();
 
-    oledShowString(1, "GPIO init...");
+    bootPhaseBegin(BOOT_PHASE_INPUT);
+#if !CONFIG_IDF_TARGET_LINUX
     gpio_set_direction(LED_PIN, GPIO_MODE_OUTPUT);
     gpio_set_level(LED_PIN, 0);
+#endif
 
-    button_handle_t btnOk = iot_button_create(&btnOkConfig);
-    if (!btnOk) {
+    if (appEventInit() != ESP_OK) {
+        oledShowString(1, "Failed event");
+        return;
+    }
+    if (buttonInit() != ESP_OK) {
         oledShowString(1, "Failed button");
         return;
     }
-    iot_button_register_cb(btnOk, BUTTON_SINGLE_CLICK, btnOkClick, NULL);
-    iot_button_register_cb(btnOk, BUTTON_LONG_PRESS_START, btnOkLongPress, (void *)true);
-    iot_button_register_cb(btnOk, BUTTON_LONG_PRESS_UP, btnOkLongPress, (void *)false);
-    iot_button_register_cb(btnOk, BUTTON_DOUBLE_CLICK, btnOkDoubleClick, NULL);
+    bootPhaseEnd(BOOT_PHASE_INPUT);
 
     oledShowString(1, "Init camera...");
-    if (ESP_OK != cameraInit()) {
+    pthread_join(cameraInitThreadt, NULL);
+    if (ESP_OK != cameraInitResult) {
         oledShowString(1, "Failed camera");
         delay(1000);
         esp_restart();
         return;
     }
-    cameraChangeSettings(PREVIEW_FRAMESIZE, PREVIEW_QUALITY);
 
     oledClear();
+    if (oledGrayStart() != ESP_OK)
+        ESP_LOGE(TAG, "Failed to start gray preview");
     // ESP_LOGI(TAG_CAM, "Total heap:%zu bytes", heap_caps_get_total_size(MALLOC_CAP_8BIT));
     // ESP_LOGI(TAG_CAM, "Free heap: %zu bytes", heap_caps_get_free_size(MALLOC_CAP_8BIT));
 
-    uint64_t time = millis();
+    // UI is live after the first preview frame, start background OTA check from here
+    capureImagePreview();
+    bootPhaseEnd(BOOT_PHASE_FIRST_PREVIEW);
+    if (telemetryInit() != ESP_OK)
+        ESP_LOGE(TAG, "Failed to init telemetry");
+    otaUpadateCheckStart();
+
     while (!otaUpdating) {
-        // Clean result after close
-        if (appState == APP_STATE_RESULT_CLEAN) {
-            appState = APP_STATE_PREVIEW;
-            free(imageResult.output);
-        }
+        frameBegin(&frameScheduler);
+        bool blockingFrame = false;
+        if (appUsesCamera())
+            cameraWake();
+        else
+            cameraSleep();
         // App state switch
         switch (appState) {
         case APP_STATE_PREVIEW:
@@ -359,47 +526,61 @@ void app_main(void) {
             break;
         case APP_STATE_CAPTURE:
             capureImage(&imageResult);
+            blockingFrame = true;
             break;
         case APP_STATE_PREVIOUS_RESULT:
             capureImage(&imageResult);
+            blockingFrame = true;
             break;
         case APP_STATE_RESULT_RENDER:
-            renderResultImage(&imageResult);
+            renderResultImage();
+            inputLatencyFlushed();
             appState = APP_STATE_RESULT;
             break;
         case APP_STATE_RESULT_SCROLL:
-            int scrollSpeed = imageResultZoom == 1 ? 2 : 4;
+            // Same speed on screen for both zooms, a late frame scrolls further
+            int64_t now = esp_timer_get_time();
+            int speed = RESULT_SCROLL_SPEED * imageResultTiles[imageResultZoom].zoom;
+            int64_t travel = (now - imageResultScrollUs) * speed;
+            int scrollStep = travel / 1000000;
+            imageResultScrollUs = now - (travel % 1000000) / speed;
 
             switch (imageResultControl) {
             case RESULT_CONTROL_RIGHT:
-                imageResultByteOffsetX += scrollSpeed;
+                imageResultOffsetX += scrollStep;
                 break;
             case RESULT_CONTROL_LEFT:
-                imageResultByteOffsetX -= scrollSpeed;
+                imageResultOffsetX -= scrollStep;
+                break;
+            case RESULT_CONTROL_DOWN:
+                imageResultOffsetY += scrollStep;
+                break;
+            case RESULT_CONTROL_UP:
+                imageResultOffsetY -= scrollStep;
                 break;
             case RESULT_CONTROL_RESET:
-                imageResultByteOffsetX = 0;
+                imageResultOffsetX = 0;
+                imageResultOffsetY = 0;
                 imageResultControl = 0;
                 appState = APP_STATE_RESULT;
                 break;
             }
-            renderResultImage(&imageResult);
+            renderResultImage();
+            inputLatencyFlushed();
             break;
         default:
             break;
         }
 
-        uint64_t now = millis();
-        uint64_t pass = now - time; 
-        time = now;
-        ESP_LOGD(TAG, "Loop: %llu ms", pass);
-
-        // char cache[6];
-        // sprintf(cache, "%llu", pass);
-        // ssd1306_display_text(&oled, 10, 0, cache, false);
-
-        if (TARGET_FRAME_DELAY > time)
-            delay(TARGET_FRAME_DELAY - time);
+        // Capture workflow blocks for seconds, keep it out of frame statistics.
+        // Its completion event is already queued, handle it without waiting
+        TickType_t wait = 0;
+        if (blockingFrame)
+            frameSkip(&frameScheduler);
+        else
+            wait = frameEnd(&frameScheduler, appFrameRate());
+        // Block on input until next frame, idle states wait for input only
+        appProcessEvents(wait);
     }
     esp_camera_deinit();
 }
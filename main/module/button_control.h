@@ -0,0 +1,143 @@
+#ifndef __BUTTON_CONTROL__
+#define __BUTTON_CONTROL__
+
+#include <stdint.h>
+#include <inttypes.h>
+#include <esp_err.h>
+#include <esp_log.h>
+
+#include "app_event.h"
+
+#define BTN_OK_PIN 13
+
+static const char *TAG_BUTTON = "main:button";
+
+#if CONFIG_IDF_TARGET_LINUX
+
+// Scripted button for the linux target, read from CONFIG_APP_HOST_BUTTON_SCRIPT.
+// One step per line, delay in ms since the previous step then the action:
+//   1500 click | double_click | long_press_start | long_press_up | exit
+// "exit" logs the performance summary and the mock panel bus counters, then ends the process.
+// Lines starting with # are skipped
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include "frame_scheduler.h"
+#include "input_latency.h"
+#include "oled_control.h"
+
+#define BUTTON_SCRIPT_STACK_SIZE 4096
+
+static const struct {
+    const char *name;
+    AppEventType type;
+} buttonScriptActions[] = {
+    {"click", APP_EVENT_BTN_CLICK},
+    {"double_click", APP_EVENT_BTN_DOUBLE_CLICK},
+    {"long_press_start", APP_EVENT_BTN_LONG_PRESS_START},
+    {"long_press_up", APP_EVENT_BTN_LONG_PRESS_UP},
+};
+
+static void buttonScriptExit() {
+    frameSchedulerLog(&frameScheduler);
+    PerfHistogram hist;
+    for (int i = 0; i < INPUT_LATENCY_COUNT; i++) {
+        perfHistSnapshot(&inputLatency[i], &hist);
+        if (!hist.count) continue;
+        ESP_LOGI(TAG_BUTTON, "%-17s n %4" PRIu32 ", min %7" PRIu32 " avg %7" PRIu32 " p50 %7" PRIu32 " p99 %7" PRIu32
+                 " max %7" PRIu32 " us", inputLatencyNames[i],
+                 hist.count, hist.min, perfHistAvg(&hist), perfHistPercentile(&hist, 50),
+                 perfHistPercentile(&hist, 99), hist.max);
+    }
+#if CONFIG_MOCK_INTERFACE
+    ESP_LOGI(TAG_BUTTON, "oled %s %" PRIu32 " Hz, %" PRIu32 " transactions, %" PRIu32 " command + %" PRIu32
+             " data bytes, bus %" PRIu64 " ms", oledMock.bus == MOCK_BUS_SPI ? "spi" : "i2c", oledMock.clock_hz,
+             oledMock.transactions, oledMock.command_bytes, oledMock.data_bytes, oledMock.bus_time_ns / 1000000);
+#endif
+    fflush(stdout);
+    exit(0);
+}
+
+static void buttonScriptTask(void *args) {
+    FILE *file = args;
+    char line[64];
+    int lineNum = 0;
+    while (fgets(line, sizeof(line), file)) {
+        lineNum++;
+        unsigned int delayMs;
+        char action[24];
+        if (line[0] == '#' || sscanf(line, "%u %23s", &delayMs, action) != 2) continue;
+        if (delayMs) vTaskDelay(pdMS_TO_TICKS(delayMs));
+
+        if (!strcmp(action, "exit")) {
+            fclose(file);
+            buttonScriptExit();
+        }
+        int i = 0;
+        int count = sizeof(buttonScriptActions) / sizeof(buttonScriptActions[0]);
+        while (i < count && strcmp(action, buttonScriptActions[i].name)) i++;
+        if (i == count) {
+            ESP_LOGW(TAG_BUTTON, "Line %d: unknown action %s", lineNum, action);
+            continue;
+        }
+        ESP_LOGI(TAG_BUTTON, "%s", action);
+        appEventPost(buttonScriptActions[i].type);
+    }
+    fclose(file);
+    ESP_LOGI(TAG_BUTTON, "Script done");
+    vTaskDelete(NULL);
+}
+
+esp_err_t buttonInit() {
+    FILE *file = fopen(CONFIG_APP_HOST_BUTTON_SCRIPT, "r");
+    if (!file) {
+        ESP_LOGW(TAG_BUTTON, "No button script %s", CONFIG_APP_HOST_BUTTON_SCRIPT);
+        return ESP_OK;
+    }
+    if (xTaskCreate(buttonScriptTask, "button", BUTTON_SCRIPT_STACK_SIZE, file, tskIDLE_PRIORITY + 2, NULL) != pdPASS) {
+        fclose(file);
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+#else
+
+#include <iot_button.h>
+
+static button_config_t btnOkConfig = {
+    .type = BUTTON_TYPE_GPIO,
+    .long_press_time = CONFIG_BUTTON_LONG_PRESS_TIME_MS,
+    .short_press_time = CONFIG_BUTTON_SHORT_PRESS_TIME_MS,
+    .gpio_button_config = {
+        .gpio_num = BTN_OK_PIN,
+        .active_level = 0,
+        .enable_power_save = true,
+    },
+};
+
+// Button callbacks run in button timer task, only post the event type given as usr_data
+static void btnOkEvent(void *button_handle, void *usr_data) {
+    appEventPost((AppEventType)(intptr_t)usr_data);
+}
+
+esp_err_t buttonInit() {
+    button_handle_t btnOk = iot_button_create(&btnOkConfig);
+    if (!btnOk) {
+        ESP_LOGE(TAG_BUTTON, "Failed to create button");
+        return ESP_FAIL;
+    }
+    iot_button_register_cb(btnOk, BUTTON_SINGLE_CLICK, btnOkEvent, (void *)APP_EVENT_BTN_CLICK);
+    iot_button_register_cb(btnOk, BUTTON_LONG_PRESS_START, btnOkEvent, (void *)APP_EVENT_BTN_LONG_PRESS_START);
+    iot_button_register_cb(btnOk, BUTTON_LONG_PRESS_UP, btnOkEvent, (void *)APP_EVENT_BTN_LONG_PRESS_UP);
+    iot_button_register_cb(btnOk, BUTTON_DOUBLE_CLICK, btnOkEvent, (void *)APP_EVENT_BTN_DOUBLE_CLICK);
+    return ESP_OK;
+}
+
+#endif  // CONFIG_IDF_TARGET_LINUX
+
+#endif
@@ -1,5 +1,16 @@
 
+#include <sdkconfig.h>
+
+#if CONFIG_IDF_TARGET_LINUX
+#include "host_camera.h"
+#else
+
+#include <inttypes.h>
 #include <esp_camera.h>
+#include <driver/gpio.h>
+#include <driver/ledc.h>
+
+#include "perf_stats.h"
 
 // ESP32Cam (AiThinker) PIN Map
 #define CAM_PIN_PWDN 32
@@ -119,4 +130,42 @@ static void cameraChangeSettings(framesize_t frameSize, int quality) {
     if (pic) esp_camera_fb_return(pic);
 }
 
-#endif
\ No newline at end of file
+static bool cameraAsleep;
+
+// Sensor standby outside preview. It stops sending frames, so the driver has no DMA transfers
+// into PSRAM, and keeps its registers for wake up
+static void cameraSleep(void) {
+    if (cameraAsleep) return;
+    gpio_set_level(CAM_PIN_PWDN, 1);
+    // XCLK only drives the sensor, LEDC low speed mode like the driver sets it up
+    ledc_timer_pause(LEDC_LOW_SPEED_MODE, camera_config.ledc_timer);
+    cameraAsleep = true;
+    ESP_LOGD(TAG_CAM, "Sensor standby");
+}
+
+// Leave standby, returns after the first frame the sensor took after it
+static void cameraWake(void) {
+    if (!cameraAsleep) return;
+    int64_t stageStart = perfStageBegin(PERF_STAGE_CAMERA_WAKE);
+    ledc_timer_resume(LEDC_LOW_SPEED_MODE, camera_config.ledc_timer);
+    gpio_set_level(CAM_PIN_PWDN, 0);
+    cameraAsleep = false;
+
+    // Drop frames queued before standby, one of fb_count + 1 frames is new
+    for (int i = 0; i <= camera_config.fb_count; i++) {
+        camera_fb_t *pic = esp_camera_fb_get();
+        if (!pic) break;
+        int64_t frameUs = pic->timestamp.tv_sec * 1000000LL + pic->timestamp.tv_usec;
+        esp_camera_fb_return(pic);
+        if (frameUs >= stageStart) {
+            uint32_t time = perfStageEnd(PERF_STAGE_CAMERA_WAKE, stageStart);
+            ESP_LOGD(TAG_CAM, "Wake up in %" PRIu32 " us", time);
+            return;
+        }
+    }
+    ESP_LOGE(TAG_CAM, "No frame after wake up");
+}
+
+#endif  // ESP_CAMERA_SUPPORTED
+
+#endif  // CONFIG_IDF_TARGET_LINUX
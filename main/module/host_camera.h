@@ -0,0 +1,149 @@
+#ifndef __HOST_CAMERA__
+#define __HOST_CAMERA__
+
+// Camera stand-in for the linux target.
+// Replays JPEG files from CONFIG_APP_HOST_CAMERA_DIR in name order and loops at the end,
+// frames are held back to CONFIG_APP_HOST_CAMERA_FPS like the sensor would
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <dirent.h>
+#include <esp_err.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#define HOST_CAMERA_MAX_FILES 1024
+
+static const char *TAG_CAM = "main:cam";
+
+typedef enum {
+    FRAMESIZE_QQVGA,
+    FRAMESIZE_XGA,
+    FRAMESIZE_UXGA,
+} framesize_t;
+
+typedef struct {
+    uint8_t *buf;
+    size_t len;
+    size_t width;
+    size_t height;
+} camera_fb_t;
+
+static char **hostCameraFiles;
+static int hostCameraFileCount;
+static int hostCameraIndex;
+static int64_t hostCameraLastFrameUs;
+// Only logged, every frame size gets the same files
+static framesize_t hostCameraFrameSize;
+
+static int hostCameraCompare(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+static bool hostCameraIsJpeg(const char *name) {
+    const char *ext = strrchr(name, '.');
+    return ext && (!strcasecmp(ext, ".jpg") || !strcasecmp(ext, ".jpeg"));
+}
+
+// Runs in a host pthread, must not call FreeRTOS
+static esp_err_t cameraInit(void) {
+    DIR *dir = opendir(CONFIG_APP_HOST_CAMERA_DIR);
+    if (!dir) {
+        ESP_LOGE(TAG_CAM, "Can't open %s", CONFIG_APP_HOST_CAMERA_DIR);
+        return ESP_ERR_NOT_FOUND;
+    }
+    hostCameraFiles = malloc(sizeof(char *) * HOST_CAMERA_MAX_FILES);
+    if (!hostCameraFiles) {
+        closedir(dir);
+        return ESP_ERR_NO_MEM;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir)) && hostCameraFileCount < HOST_CAMERA_MAX_FILES) {
+        if (!hostCameraIsJpeg(entry->d_name)) continue;
+        size_t size = strlen(CONFIG_APP_HOST_CAMERA_DIR) + strlen(entry->d_name) + 2;
+        char *path = malloc(size);
+        if (!path) break;
+        snprintf(path, size, "%s/%s", CONFIG_APP_HOST_CAMERA_DIR, entry->d_name);
+        hostCameraFiles[hostCameraFileCount++] = path;
+    }
+    closedir(dir);
+
+    if (!hostCameraFileCount) {
+        ESP_LOGE(TAG_CAM, "No JPEG files in %s", CONFIG_APP_HOST_CAMERA_DIR);
+        return ESP_ERR_NOT_FOUND;
+    }
+    qsort(hostCameraFiles, hostCameraFileCount, sizeof(char *), hostCameraCompare);
+    ESP_LOGI(TAG_CAM, "Replaying %d frames from %s", hostCameraFileCount, CONFIG_APP_HOST_CAMERA_DIR);
+    return ESP_OK;
+}
+
+static void cameraChangeSettings(framesize_t frameSize, int quality) {
+    hostCameraFrameSize = frameSize;
+    ESP_LOGD(TAG_CAM, "Frame size %d, quality %d", frameSize, quality);
+}
+
+// Files are only read on request, nothing runs in standby
+static void cameraSleep(void) {
+}
+
+static void cameraWake(void) {
+}
+
+camera_fb_t *esp_camera_fb_get() {
+    if (!hostCameraFileCount) return NULL;
+
+#if CONFIG_APP_HOST_CAMERA_FPS
+    int64_t interval = 1000000 / CONFIG_APP_HOST_CAMERA_FPS;
+    int64_t wait = hostCameraLastFrameUs + interval - esp_timer_get_time();
+    if (wait > 0)
+        vTaskDelay(pdMS_TO_TICKS((wait + 999) / 1000));
+#endif
+    hostCameraLastFrameUs = esp_timer_get_time();
+
+    const char *path = hostCameraFiles[hostCameraIndex];
+    hostCameraIndex = (hostCameraIndex + 1) % hostCameraFileCount;
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        ESP_LOGE(TAG_CAM, "Can't open %s", path);
+        return NULL;
+    }
+    fseek(file, 0, SEEK_END);
+    long len = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    camera_fb_t *fb = calloc(1, sizeof(camera_fb_t));
+    uint8_t *buf = len > 0 ? malloc(len) : NULL;
+    if (!fb || !buf || fread(buf, 1, len, file) != (size_t)len) {
+        ESP_LOGE(TAG_CAM, "Can't read %s", path);
+        free(buf);
+        free(fb);
+        fclose(file);
+        return NULL;
+    }
+    fclose(file);
+    fb->buf = buf;
+    fb->len = len;
+    ESP_LOGD(TAG_CAM, "Frame %s, size %d", path, hostCameraFrameSize);
+    return fb;
+}
+
+void esp_camera_fb_return(camera_fb_t *fb) {
+    if (!fb) return;
+    free(fb->buf);
+    free(fb);
+}
+
+esp_err_t esp_camera_deinit() {
+    for (int i = 0; i < hostCameraFileCount; i++)
+        free(hostCameraFiles[i]);
+    free(hostCameraFiles);
+    hostCameraFiles = NULL;
+    hostCameraFileCount = 0;
+    return ESP_OK;
+}
+
+#endif
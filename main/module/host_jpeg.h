@@ -0,0 +1,69 @@
+#ifndef __HOST_JPEG__
+#define __HOST_JPEG__
+
+// esp_jpg_decode stand-in for the linux target, esp32-camera is not available on host.
+// Decodes the whole image with esp_jpeg and hands it to the writer in one block
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <esp_err.h>
+#include <jpeg_decoder.h>
+
+typedef enum {
+    JPG_SCALE_NONE,
+    JPG_SCALE_2X,
+    JPG_SCALE_4X,
+    JPG_SCALE_8X,
+    JPG_SCALE_MAX = JPG_SCALE_8X
+} jpg_scale_t;
+
+typedef unsigned int (*jpg_reader_cb)(void *arg, size_t index, uint8_t *buf, size_t len);
+typedef bool (*jpg_writer_cb)(void *arg, uint16_t x, uint16_t y, uint16_t w, uint16_t h, uint8_t *data);
+
+static const esp_jpeg_image_scale_t hostJpegScales[] = {
+    JPEG_IMAGE_SCALE_0,
+    JPEG_IMAGE_SCALE_1_2,
+    JPEG_IMAGE_SCALE_1_4,
+    JPEG_IMAGE_SCALE_1_8,
+};
+
+esp_err_t esp_jpg_decode(size_t len, jpg_scale_t scale, jpg_reader_cb reader, jpg_writer_cb writer, void *arg) {
+    uint8_t *input = malloc(len);
+    if (!input) return ESP_ERR_NO_MEM;
+    reader(arg, 0, input, len);
+
+    esp_jpeg_image_cfg_t config = {
+        .indata = input,
+        .indata_size = len,
+        .out_format = JPEG_IMAGE_FORMAT_RGB888,
+        .out_scale = hostJpegScales[scale],
+    };
+    esp_jpeg_image_output_t info;
+    esp_err_t result = esp_jpeg_get_image_info(&config, &info);
+    if (result != ESP_OK) {
+        free(input);
+        return result;
+    }
+
+    // Unscaled size is an upper bound of the output
+    config.outbuf_size = info.width * info.height * 3;
+    config.outbuf = malloc(config.outbuf_size);
+    if (!config.outbuf) {
+        free(input);
+        return ESP_ERR_NO_MEM;
+    }
+    result = esp_jpeg_decode(&config, &info);
+    if (result == ESP_OK) {
+        if (!writer(arg, 0, 0, info.width, info.height, NULL) ||
+            !writer(arg, 0, 0, info.width, info.height, config.outbuf))
+            result = ESP_FAIL;
+        else
+            writer(arg, info.width, info.height, 0, 0, NULL);
+    }
+    free(config.outbuf);
+    free(input);
+    return result;
+}
+
+#endif
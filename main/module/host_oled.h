@@ -0,0 +1,75 @@
+#ifndef __HOST_OLED__
+#define __HOST_OLED__
+
+// Display stand-in for the linux target.
+// The mock transport keeps the panel memory, changed frames are written to CONFIG_APP_HOST_FRAME_DIR
+// as <sequence>_<ms since boot>.pbm, lit pixels are white like /framebuffer.pbm of the metrics server
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <esp_err.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <ssd1306.h>
+
+#define HOST_OLED_STACK_SIZE 4096
+
+static const char *TAG_HOST_OLED = "main:host_oled";
+
+static volatile bool hostOledDirty;
+
+static void hostOledRecord(void *arg, bool data, const uint8_t *buf, size_t len) {
+    if (data) hostOledDirty = true;
+}
+
+static void hostOledWriteFrame(ssd1306_mock_t *mock, uint32_t sequence) {
+    char path[256];
+    snprintf(path, sizeof(path), "%s/%06lu_%08" PRId64 ".pbm", CONFIG_APP_HOST_FRAME_DIR,
+             (unsigned long)sequence, esp_timer_get_time() / 1000);
+    FILE *file = fopen(path, "wb");
+    if (!file) {
+        ESP_LOGE(TAG_HOST_OLED, "Can't write %s", path);
+        return;
+    }
+    fprintf(file, "P4\n128 64\n");
+    for (int y = 0; y < 64; y++) {
+        const uint8_t *segs = mock->gddram[y >> 3];
+        uint8_t bit = 1 << (y & 7);
+        for (int x = 0; x < 128; x += 8) {
+            uint8_t out = 0;
+            for (int i = 0; i < 8; i++)
+                out = (out << 1) | !(segs[x + i] & bit);
+            fputc(out, file);
+        }
+    }
+    fclose(file);
+}
+
+static void hostOledTask(void *args) {
+    ssd1306_mock_t *mock = args;
+    uint32_t sequence = 0;
+    TickType_t lastWake = xTaskGetTickCount();
+    for (;;) {
+        vTaskDelayUntil(&lastWake, pdMS_TO_TICKS(CONFIG_APP_HOST_FRAME_INTERVAL_MS));
+        if (!hostOledDirty) continue;
+        hostOledDirty = false;
+        hostOledWriteFrame(mock, sequence++);
+    }
+}
+
+esp_err_t hostOledStart(ssd1306_mock_t *mock) {
+    if (!CONFIG_APP_HOST_FRAME_DIR[0]) return ESP_OK;
+    mkdir(CONFIG_APP_HOST_FRAME_DIR, 0755);
+
+    mock->record = hostOledRecord;
+    if (xTaskCreate(hostOledTask, "host_oled", HOST_OLED_STACK_SIZE, mock, tskIDLE_PRIORITY + 1, NULL) != pdPASS)
+        return ESP_ERR_NO_MEM;
+    ESP_LOGI(TAG_HOST_OLED, "Writing frames to %s", CONFIG_APP_HOST_FRAME_DIR);
+    return ESP_OK;
+}
+
+#endif
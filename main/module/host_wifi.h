@@ -0,0 +1,47 @@
+#ifndef __HOST_WIFI__
+#define __HOST_WIFI__
+
+// WiFi stand-in for the linux target, the host network is always up
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <esp_err.h>
+#include <freertos/FreeRTOS.h>
+
+typedef enum wifi_link_state {
+    WIFI_LINK_DOWN,
+    WIFI_LINK_CONNECTING,
+    WIFI_LINK_ASSOCIATED,
+    WIFI_LINK_READY,
+} WifiLinkState;
+
+typedef enum wifi_ps_profile {
+    WIFI_PS_PROFILE_SAVE,
+    WIFI_PS_PROFILE_LATENCY,
+    WIFI_PS_PROFILE_COUNT,
+} WifiPsProfile;
+
+volatile WifiLinkState wifiLinkState = WIFI_LINK_DOWN;
+uint32_t wifiDisconnectCount;
+int wifiConnectTimeMs = -1;
+bool wifiConnectedFast;
+
+static esp_err_t wifiStart() {
+    wifiLinkState = WIFI_LINK_READY;
+    wifiConnectTimeMs = 0;
+    return ESP_OK;
+}
+
+static inline esp_err_t wifiSetPsProfile(WifiPsProfile profile) {
+    return ESP_OK;
+}
+
+static inline bool wifiIsReady() {
+    return wifiLinkState == WIFI_LINK_READY;
+}
+
+static inline bool wifiWaitReady(TickType_t timeout) {
+    return wifiIsReady();
+}
+
+#endif
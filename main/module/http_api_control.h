@@ -6,8 +6,22 @@
 #include <esp_log.h>
 #include <esp_http_client.h>
 
+#include "trace.h"
+#include "result_text.h"
+#include "net_scheduler.h"
+
+#if CONFIG_IDF_TARGET_LINUX
+// Local stand-in server, see tools/host_server.py
+#define HTTP_API_HOST CONFIG_APP_HOST_API_HOST
+#define HTTP_API_PORT CONFIG_APP_HOST_API_PORT
+#else
 #define HTTP_API_HOST "140.116.246.59"
 #define HTTP_API_PORT 25569
+#endif
+// TCP keep-alive detects a dead link during long server waits, instead of waiting for timeout_ms
+#define HTTP_KEEP_ALIVE_IDLE 5
+#define HTTP_KEEP_ALIVE_INTERVAL 5
+#define HTTP_KEEP_ALIVE_COUNT 3
 
 // local pc
 // #undef HTTP_API_HOST
@@ -21,6 +35,7 @@ typedef struct {
 } HttpResponseData;
 
 esp_err_t httpEventHandler(esp_http_client_event_t *evt) {
+    TRACE_INSTANT(TRACE_EVENT_HTTP, evt->event_id);
     switch (evt->event_id) {
     case HTTP_EVENT_ERROR:
         ESP_LOGE(TAG_HTTP, "HTTP_EVENT_ERROR");
@@ -91,12 +106,16 @@ esp_err_t httpSendImageProcess(uint8_t *imageBuff, size_t imageSize,
         .method = HTTP_METHOD_POST,
         .timeout_ms = 30000,
         .event_handler = httpEventHandler,
+        .keep_alive_enable = true,
+        .keep_alive_idle = HTTP_KEEP_ALIVE_IDLE,
+        .keep_alive_interval = HTTP_KEEP_ALIVE_INTERVAL,
+        .keep_alive_count = HTTP_KEEP_ALIVE_COUNT,
     };
     esp_http_client_handle_t client = esp_http_client_init(&config);
     // esp_http_client_set_header(client, "Connection", "Keep-Alive");
     esp_http_client_set_header(client, "Content-Type", "image/jpeg");
     esp_http_client_set_post_field(client, (char *)imageBuff, imageSize);
-    esp_err_t result = esp_http_client_perform(client);
+    esp_err_t result = netPerform(client, NET_PRIORITY_CAPTURE);
     HttpResponseData *responseData;
     esp_http_client_get_user_data(client, (void **)&responseData);
     if (result != ESP_OK) {
@@ -125,6 +144,10 @@ esp_err_t httpWaitImageProcess(uint8_t *imageBuff, char *processId) {
         .method = HTTP_METHOD_GET,
         .timeout_ms = 120000,
         .event_handler = httpEventHandler,
+        .keep_alive_enable = true,
+        .keep_alive_idle = HTTP_KEEP_ALIVE_IDLE,
+        .keep_alive_interval = HTTP_KEEP_ALIVE_INTERVAL,
+        .keep_alive_count = HTTP_KEEP_ALIVE_COUNT,
     };
     esp_http_client_handle_t client = esp_http_client_init(&config);
     // Wait result
@@ -132,7 +155,7 @@ esp_err_t httpWaitImageProcess(uint8_t *imageBuff, char *processId) {
     esp_http_client_set_method(client, HTTP_METHOD_GET);
     esp_http_client_set_header(client, "id", processId);
 
-    esp_err_t result = esp_http_client_perform(client);
+    esp_err_t result = netPerform(client, NET_PRIORITY_CAPTURE);
     int code = esp_http_client_get_status_code(client);
     if (result != ESP_OK || code == 400 || code == 500) {
         ESP_LOGE(TAG_HTTP, "HTTP POST request failed");
@@ -153,6 +176,10 @@ esp_err_t httpGetProcessResult(uint8_t *imageBuff, char *processId, ImageData *i
         .method = HTTP_METHOD_GET,
         .timeout_ms = 120000,
         .event_handler = httpEventHandler,
+        .keep_alive_enable = true,
+        .keep_alive_idle = HTTP_KEEP_ALIVE_IDLE,
+        .keep_alive_interval = HTTP_KEEP_ALIVE_INTERVAL,
+        .keep_alive_count = HTTP_KEEP_ALIVE_COUNT,
     };
     esp_http_client_handle_t client = esp_http_client_init(&config);
     // Wait result
@@ -160,7 +187,7 @@ esp_err_t httpGetProcessResult(uint8_t *imageBuff, char *processId, ImageData *i
     esp_http_client_set_method(client, HTTP_METHOD_GET);
     esp_http_client_set_header(client, "id", processId);
 
-    esp_err_t result = esp_http_client_perform(client);
+    esp_err_t result = netPerform(client, NET_PRIORITY_RESULT);
     HttpResponseData *imageResult;
     esp_http_client_get_user_data(client, (void **)&imageResult);
     int code = esp_http_client_get_status_code(client);
@@ -173,11 +200,25 @@ esp_err_t httpGetProcessResult(uint8_t *imageBuff, char *processId, ImageData *i
     // Free client data
     esp_http_client_cleanup(client);
 
-    // Get response data info
+    if (resultTextIs(imageResult->buff, imageResult->len)) {
+        // Text result is laid out by the caller, width 0 marks it
+        if (resultTextSize(imageResult->buff) > imageResult->len) {
+            ESP_LOGE(TAG_HTTP, "Text result cut at %zu bytes", imageResult->len);
+            httpResponseDataFree(imageResult);
+            return ESP_FAIL;
+        }
+        imageOut->width = 0;
+        imageOut->height = 0;
+        imageOut->output = imageResult->buff;
+        free(imageResult);
+        return ESP_OK;
+    }
+
+    // Raster result, get response data info
     int imgWidth = (imageResult->buff[0] << 24) | (imageResult->buff[1] << 16) | (imageResult->buff[2] << 8) | (imageResult->buff[3]);
     // In pixel
     imageOut->width = imgWidth;
-    imageOut->height = imageResult->len * 8 / imgWidth;
+    imageOut->height = (imageResult->len - 4) * 8 / imgWidth;
     imageOut->output = imageResult->buff;
 
     // Dont free buff, image need to use later
@@ -0,0 +1,216 @@
+#ifndef __METRICS_SERVER__
+#define __METRICS_SERVER__
+
+#include <esp_err.h>
+
+#if CONFIG_APP_METRICS_SERVER
+
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_wifi.h>
+#include <esp_heap_caps.h>
+#include <esp_http_server.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include "spi_ram.h"
+#include "perf_stats.h"
+#include "boot_timeline.h"
+#include "frame_scheduler.h"
+#include "input_latency.h"
+#include "net_scheduler.h"
+#include "oled_control.h"
+#include "wifi_control.h"
+
+#define METRICS_BUFFER_SIZE (16 * 1024)
+#define METRICS_MAX_TASKS 32
+
+static const char *TAG_METRICS = "main:metrics";
+
+typedef struct {
+    char *buf;
+    size_t size;
+    size_t len;
+} MetricsWriter;
+
+static void metricsPrintf(MetricsWriter *w, const char *format, ...) {
+    if (w->len >= w->size) return;
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(w->buf + w->len, w->size - w->len, format, args);
+    va_end(args);
+    if (n > 0) w->len = MIN(w->len + n, w->size - 1);
+}
+
+static void metricsHist(MetricsWriter *w, const char *name, const PerfHistogram *src) {
+    PerfHistogram hist;
+    perfHistSnapshot(src, &hist);
+    metricsPrintf(w, "\"%s\":{\"count\":%" PRIu32 ",\"min\":%" PRIu32 ",\"avg\":%" PRIu32 ",\"p50\":%" PRIu32
+                  ",\"p90\":%" PRIu32 ",\"p99\":%" PRIu32 ",\"max\":%" PRIu32 "},",
+                  name, hist.count, hist.min, perfHistAvg(&hist), perfHistPercentile(&hist, 50),
+                  perfHistPercentile(&hist, 90), perfHistPercentile(&hist, 99), hist.max);
+}
+
+// Replace trailing comma of last item with the closing bracket
+static void metricsClose(MetricsWriter *w, char bracket) {
+    if (w->len && w->buf[w->len - 1] == ',')
+        w->len--;
+    metricsPrintf(w, "%c,", bracket);
+}
+
+static void metricsWriteHeap(MetricsWriter *w, const char *name, uint32_t caps) {
+    metricsPrintf(w, "\"%s\":{\"free\":%zu,\"min_free\":%zu,\"largest_block\":%zu},", name,
+                  heap_caps_get_free_size(caps), heap_caps_get_minimum_free_size(caps),
+                  heap_caps_get_largest_free_block(caps));
+}
+
+static void metricsWriteTasks(MetricsWriter *w) {
+#if configUSE_TRACE_FACILITY
+    TaskStatus_t *tasks = malloc(sizeof(TaskStatus_t) * METRICS_MAX_TASKS);
+    if (!tasks) return;
+    uint32_t totalRunTime = 0;
+    UBaseType_t count = uxTaskGetSystemState(tasks, METRICS_MAX_TASKS, &totalRunTime);
+
+    metricsPrintf(w, "\"tasks\":[");
+    for (UBaseType_t i = 0; i < count; i++) {
+        TaskStatus_t *task = &tasks[i];
+        metricsPrintf(w, "{\"name\":\"%s\",\"priority\":%u,\"stack_min_free\":%" PRIu32, task->pcTaskName,
+                      (unsigned)task->uxCurrentPriority, (uint32_t)task->usStackHighWaterMark);
+#if configGENERATE_RUN_TIME_STATS
+        metricsPrintf(w, ",\"run_time\":%" PRIu32 ",\"cpu\":%.1f", (uint32_t)task->ulRunTimeCounter,
+                      totalRunTime ? task->ulRunTimeCounter * 100.0f / totalRunTime : 0);
+#endif
+        metricsPrintf(w, "},");
+    }
+    metricsClose(w, ']');
+    free(tasks);
+#endif
+}
+
+static esp_err_t metricsHandler(httpd_req_t *req) {
+    MetricsWriter w = {
+        .buf = malloc_spi(METRICS_BUFFER_SIZE),
+        .size = METRICS_BUFFER_SIZE,
+    };
+    if (!w.buf) return httpd_resp_send_500(req);
+
+    metricsPrintf(&w, "{\"uptime_ms\":%" PRId64 ",", esp_timer_get_time() / 1000);
+
+    metricsPrintf(&w, "\"stages\":{");
+    for (int i = 0; i < PERF_STAGE_COUNT; i++)
+        metricsHist(&w, perfStageNames[i], &perfStages[i]);
+    metricsClose(&w, '}');
+
+    PerfHistogram interval;
+    perfHistSnapshot(&frameScheduler.intervalTime, &interval);
+    uint32_t avgInterval = perfHistAvg(&interval);
+    metricsPrintf(&w, "\"frame\":{\"fps\":%.1f,\"frames\":%" PRIu32 ",\"missed\":%" PRIu32 ",",
+                  avgInterval ? 1000000.0f / avgInterval : 0, frameScheduler.frames, frameScheduler.missedDeadlines);
+    metricsHist(&w, "work", &frameScheduler.workTime);
+    metricsHist(&w, "interval", &frameScheduler.intervalTime);
+    metricsClose(&w, '}');
+
+    metricsPrintf(&w, "\"input_latency\":{");
+    for (int i = 0; i < INPUT_LATENCY_COUNT; i++)
+        metricsHist(&w, inputLatencyNames[i], &inputLatency[i]);
+    metricsClose(&w, '}');
+
+    metricsPrintf(&w, "\"net_request\":{");
+    for (int i = 0; i < NET_PRIORITY_COUNT; i++)
+        metricsHist(&w, netPriorityNames[i], &netRequestTime[i]);
+    metricsClose(&w, '}');
+
+    metricsPrintf(&w, "\"heap\":{");
+    metricsWriteHeap(&w, "internal", MALLOC_CAP_INTERNAL);
+    metricsWriteHeap(&w, "psram", MALLOC_CAP_SPIRAM);
+    metricsClose(&w, '}');
+
+    wifi_ap_record_t ap;
+    int rssi = esp_wifi_sta_get_ap_info(&ap) == ESP_OK ? ap.rssi : 0;
+    metricsPrintf(&w, "\"wifi\":{\"rssi\":%d,\"state\":%d,\"disconnects\":%" PRIu32 ",\"connect_ms\":%d,\"fast\":%s},",
+                  rssi, wifiLinkState, wifiDisconnectCount, wifiConnectTimeMs, wifiConnectedFast ? "true" : "false");
+
+    metricsPrintf(&w, "\"boot\":{");
+    for (int i = 0; i < BOOT_PHASE_COUNT; i++)
+        metricsPrintf(&w, "\"%s\":%d,", bootPhaseNames[i], bootPhaseMs(i));
+    metricsClose(&w, '}');
+
+    metricsWriteTasks(&w);
+    metricsClose(&w, '}');
+    // Drop trailing comma from metricsClose
+    w.len--;
+
+    if (w.len >= w.size - 2)
+        ESP_LOGW(TAG_METRICS, "Metrics truncated");
+    httpd_resp_set_type(req, "application/json");
+    esp_err_t result = httpd_resp_send(req, w.buf, w.len);
+    free(w.buf);
+    return result;
+}
+
+// Display buffer as binary PBM, lit pixels are white.
+// Snapshot of the last flushed frame. The buffers are static, too big for the default httpd stack,
+// and the server runs one handler at a time
+static esp_err_t framebufferHandler(httpd_req_t *req) {
+    static const char header[] = "P4\n" "128 64\n";
+    static uint8_t image[sizeof(header) - 1 + BITMAP_ROW_BYTE_COUNT * OLED_HEIGHT];
+    memcpy(image, header, sizeof(header) - 1);
+
+    static uint8_t pages[OLED_PAGES][OLED_WIDTH];
+    oledSnapshot(pages);
+    uint8_t *pixels = image + sizeof(header) - 1;
+    for (int y = 0; y < OLED_HEIGHT; y++) {
+        uint8_t *row = pixels + y * BITMAP_ROW_BYTE_COUNT;
+        uint8_t *segs = pages[y >> 3];
+        uint8_t bit = 1 << (y & 7);
+        for (int x = 0; x < OLED_WIDTH; x += 8) {
+            uint8_t out = 0;
+            for (int i = 0; i < 8; i++)
+                out = (out << 1) | !(segs[x + i] & bit);
+            row[x >> 3] = out;
+        }
+    }
+
+    httpd_resp_set_type(req, "image/x-portable-bitmap");
+    return httpd_resp_send(req, (const char *)image, sizeof(image));
+}
+
+static httpd_handle_t metricsServer;
+
+esp_err_t metricsServerStart() {
+    httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+    config.server_port = CONFIG_APP_METRICS_SERVER_PORT;
+    config.task_priority = tskIDLE_PRIORITY + 1;
+    config.lru_purge_enable = true;
+    esp_err_t result = httpd_start(&metricsServer, &config);
+    if (result != ESP_OK) {
+        ESP_LOGE(TAG_METRICS, "Failed to start server: %s", esp_err_to_name(result));
+        return result;
+    }
+
+    httpd_uri_t metricsUri = {
+        .uri = "/metrics",
+        .method = HTTP_GET,
+        .handler = metricsHandler,
+    };
+    httpd_uri_t framebufferUri = {
+        .uri = "/framebuffer.pbm",
+        .method = HTTP_GET,
+        .handler = framebufferHandler,
+    };
+    httpd_register_uri_handler(metricsServer, &metricsUri);
+    httpd_register_uri_handler(metricsServer, &framebufferUri);
+    ESP_LOGI(TAG_METRICS, "Listening on port %d", config.server_port);
+    return ESP_OK;
+}
+
+#else
+
+#define metricsServerStart() ESP_OK
+
+#endif  // CONFIG_APP_METRICS_SERVER
+
+#endif
@@ -0,0 +1,89 @@
+#ifndef __NET_SCHEDULER__
+#define __NET_SCHEDULER__
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <esp_log.h>
+#include <esp_http_client.h>
+
+#include "millis.h"
+#include "perf_stats.h"
+#include "trace.h"
+#include "wifi_control.h"
+
+static const char *TAG_NET = "main:net";
+
+// Network request priority class, lower value is more important
+typedef enum net_priority {
+    NET_PRIORITY_CAPTURE,    // Image upload and processing wait
+    NET_PRIORITY_RESULT,     // Result download
+    NET_PRIORITY_OTA,        // OTA update check
+    NET_PRIORITY_TELEMETRY,  // Telemetry report
+    NET_PRIORITY_COUNT,
+} NetPriority;
+
+static const char *const netPriorityNames[NET_PRIORITY_COUNT] = {
+    "capture",
+    "result",
+    "ota",
+    "telemetry",
+};
+
+// Request time by class, us
+PerfHistogram netRequestTime[NET_PRIORITY_COUNT];
+
+// Requests from this class on are deferred while more important work is in flight
+#define NET_PRIORITY_BACKGROUND NET_PRIORITY_OTA
+
+static pthread_mutex_t netSchedulerLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t netSchedulerCond = PTHREAD_COND_INITIALIZER;
+static int netInFlight[NET_PRIORITY_COUNT];
+
+static bool netHigherPriorityInFlight(NetPriority priority) {
+    for (int i = 0; i < priority; i++)
+        if (netInFlight[i]) return true;
+    return false;
+}
+
+// Mark network work of the given class as in flight.
+// Background classes block until no more important work is running.
+// Interactive classes never wait, and can be nested to cover a multi-request workflow.
+void netSchedulerBegin(NetPriority priority) {
+    pthread_mutex_lock(&netSchedulerLock);
+    if (priority >= NET_PRIORITY_BACKGROUND && netHigherPriorityInFlight(priority)) {
+        uint64_t start = millis();
+        while (netHigherPriorityInFlight(priority))
+            pthread_cond_wait(&netSchedulerCond, &netSchedulerLock);
+        ESP_LOGI(TAG_NET, "Priority %d deferred %" PRIu64 " ms", priority, millis() - start);
+    }
+    netInFlight[priority]++;
+    pthread_mutex_unlock(&netSchedulerLock);
+}
+
+void netSchedulerEnd(NetPriority priority) {
+    pthread_mutex_lock(&netSchedulerLock);
+    if (netInFlight[priority] > 0)
+        netInFlight[priority]--;
+    pthread_cond_broadcast(&netSchedulerCond);
+    pthread_mutex_unlock(&netSchedulerLock);
+}
+
+// Perform http request as network work of the given class,
+// fail fast when the network is not ready instead of waiting for request timeout
+esp_err_t netPerform(esp_http_client_handle_t client, NetPriority priority) {
+    if (!wifiIsReady()) {
+        ESP_LOGW(TAG_NET, "Network not ready, priority %d request dropped", priority);
+        return ESP_ERR_WIFI_NOT_CONNECT;
+    }
+    netSchedulerBegin(priority);
+    TRACE_BEGIN(TRACE_EVENT_NET_REQUEST, priority);
+    int64_t start = esp_timer_get_time();
+    esp_err_t result = esp_http_client_perform(client);
+    perfHistRecord(&netRequestTime[priority], esp_timer_get_time() - start);
+    TRACE_END(TRACE_EVENT_NET_REQUEST, priority);
+    netSchedulerEnd(priority);
+    return result;
+}
+
+#endif
@@ -2,23 +2,112 @@
 #define __OLED_CONTROL__
 
 #include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
 
 #include <ssd1306.h>
 
 #include "millis.h"
 #include "image_lib.h"
+#include "perf_stats.h"
+#if CONFIG_IDF_TARGET_LINUX
+#include "host_oled.h"
+#endif
+#if CONFIG_APP_OLED_CLOCK_AUTOTUNE
+#include <inttypes.h>
+#include <nvs.h>
+#endif
+#if CONFIG_APP_OLED_GRAY
+#include <inttypes.h>
+#include <sys/param.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#endif
 
 #define OLED_WIDTH 128
 #define OLED_HEIGHT 64
 #define BITMAP_ROW_BYTE_COUNT (OLED_WIDTH >> 3)
 
-#define setIfLess(target, cache, value) \
-    if ((cache = value) < target) target = cache
-
 static const char *TAG_OLED = "main:oled";
 
 uint8_t *oledBitmap;
 SSD1306_t oled;
+#if CONFIG_MOCK_INTERFACE
+// Transactions and bus time of the mock panel, see ssd1306_mock.c
+ssd1306_mock_t oledMock;
+#endif
+#if CONFIG_APP_OLED_CLOCK_AUTOTUNE
+#define OLED_CLOCK_NVS_NAMESPACE "oled"
+#define OLED_CLOCK_NVS_KEY "i2c_hz"
+#define OLED_CLOCK_BASE_HZ 400000
+#define OLED_CLOCK_STEP_HZ 200000
+// Page-sized transfers per step, all must be acknowledged
+#define OLED_CLOCK_PROBE_COUNT 32
+
+// Clock in NVS, a difference to the panel means it fell back
+static uint32_t oledClockHz;
+
+static uint32_t oledClockLoad() {
+    nvs_handle_t nvs;
+    uint32_t hz = 0;
+    if (nvs_open(OLED_CLOCK_NVS_NAMESPACE, NVS_READONLY, &nvs) != ESP_OK)
+        return 0;
+    nvs_get_u32(nvs, OLED_CLOCK_NVS_KEY, &hz);
+    nvs_close(nvs);
+    return hz;
+}
+
+static void oledClockSave(uint32_t hz) {
+    nvs_handle_t nvs;
+    if (nvs_open(OLED_CLOCK_NVS_NAMESPACE, NVS_READWRITE, &nvs) != ESP_OK)
+        return;
+    nvs_set_u32(nvs, OLED_CLOCK_NVS_KEY, hz);
+    nvs_commit(nvs);
+    nvs_close(nvs);
+}
+
+static bool oledClockVerify(uint32_t hz) {
+    return i2c_clock_speed(&oled, hz) == ESP_OK && i2c_clock_probe(&oled, OLED_CLOCK_PROBE_COUNT) == 0;
+}
+
+// Runs before ssd1306_init, so the panel is configured again after the probes
+static void oledClockTune() {
+    uint32_t stored = oledClockLoad();
+    if (stored >= OLED_CLOCK_BASE_HZ && stored <= CONFIG_APP_OLED_CLOCK_MAX_HZ) {
+        if (oledClockVerify(stored)) {
+            oledClockHz = stored;
+            ESP_LOGI(TAG_OLED, "I2C clock %" PRIu32 " Hz", stored);
+            return;
+        }
+        ESP_LOGW(TAG_OLED, "Stored I2C clock %" PRIu32 " Hz failed, tuning again", stored);
+    }
+
+    uint32_t best = OLED_CLOCK_BASE_HZ;
+    for (uint32_t hz = OLED_CLOCK_BASE_HZ + OLED_CLOCK_STEP_HZ; hz <= CONFIG_APP_OLED_CLOCK_MAX_HZ; hz += OLED_CLOCK_STEP_HZ) {
+        if (!oledClockVerify(hz)) break;
+        best = hz;
+    }
+    i2c_clock_speed(&oled, best);
+    oledClockHz = best;
+    oledClockSave(best);
+    ESP_LOGI(TAG_OLED, "I2C clock tuned to %" PRIu32 " Hz", best);
+}
+
+// The driver went back to 400 kHz after bus errors, keep it for the next boots
+static inline void oledClockCheck() {
+    if (oled._i2c_clk_hz == oledClockHz) return;
+    oledClockHz = oled._i2c_clk_hz;
+    oledClockSave(oledClockHz);
+}
+#else
+
+#define oledClockTune() ((void)0)
+#define oledClockCheck() ((void)0)
+
+#endif  // CONFIG_APP_OLED_CLOCK_AUTOTUNE
+
 static void init_oled_panel(void) {
 #if CONFIG_I2C_INTERFACE
     // ESP_LOGI(TAG_OLED, "INTERFACE i2c");
@@ -26,6 +115,7 @@ static void init_oled_panel(void) {
     // ESP_LOGI(TAG_OLED, "CONFIG_SCL_GPIO=%d", CONFIG_SCL_GPIO);
     // ESP_LOGI(TAG_OLED, "CONFIG_RESET_GPIO=%d", CONFIG_RESET_GPIO);
     i2c_master_init(&oled, CONFIG_SDA_GPIO, CONFIG_SCL_GPIO, CONFIG_RESET_GPIO);
+    oledClockTune();
 #endif  // CONFIG_I2C_INTERFACE
 
 #if CONFIG_SPI_INTERFACE
@@ -35,9 +125,21 @@ static void init_oled_panel(void) {
     // ESP_LOGI(TAG_OLED, "CONFIG_CS_GPIO=%d", CONFIG_CS_GPIO);
     // ESP_LOGI(TAG_OLED, "CONFIG_DC_GPIO=%d", CONFIG_DC_GPIO);
     // ESP_LOGI(TAG_OLED, "CONFIG_RESET_GPIO=%d", CONFIG_RESET_GPIO);
-    spi_master_init(&dev, CONFIG_MOSI_GPIO, CONFIG_SCLK_GPIO, CONFIG_CS_GPIO, CONFIG_DC_GPIO, CONFIG_RESET_GPIO);
+    spi_master_init(&oled, CONFIG_MOSI_GPIO, CONFIG_SCLK_GPIO, CONFIG_CS_GPIO, CONFIG_DC_GPIO, CONFIG_RESET_GPIO);
 #endif  // CONFIG_SPI_INTERFACE
 
+#if CONFIG_MOCK_INTERFACE
+#if CONFIG_MOCK_BUS_SPI
+    mock_master_init(&oled, &oledMock, MOCK_BUS_SPI, CONFIG_MOCK_CLOCK_HZ);
+#else
+    mock_master_init(&oled, &oledMock, MOCK_BUS_I2C, CONFIG_MOCK_CLOCK_HZ);
+#endif
+#if CONFIG_IDF_TARGET_LINUX
+    if (hostOledStart(&oledMock) != ESP_OK)
+        ESP_LOGE(TAG_OLED, "Failed to start frame writer");
+#endif
+#endif  // CONFIG_MOCK_INTERFACE
+
     // ESP_LOGI(TAG_OLED, "Panel size: 128x64");
     ssd1306_init(&oled, 128, 64);
 
@@ -47,17 +149,329 @@ static void init_oled_panel(void) {
     oledBitmap = malloc((OLED_WIDTH / 8) * OLED_HEIGHT);
 }
 
-static inline uint8_t RGB24_to_BW8(ImageData *bmp, uint16_t x, uint16_t y) {
-    if (y >= bmp->height) y = bmp->height - 1;
-    uint32_t index = (y * bmp->width + x) * 3;
-    return (uint8_t)(0.299f * bmp->output[index] +
-                     0.587f * bmp->output[index + 1] +
-                     0.114f * bmp->output[index + 2]);
+// Compositor, the only writer of the panel buffer oled._page.
+// Layers from bottom to top: content image, status text lines, progress bar, mode mark.
+// oledSet* change a layer and mark its pages dirty, oledFlush composes the dirty pages and sends
+// them in one batch. oledShow* are a setter and a flush. All of it is locked, the OTA thread draws too
+
+#define OLED_PAGES (OLED_HEIGHT >> 3)
+#define OLED_TEXT_COLUMNS (OLED_WIDTH >> 3)
+#define OLED_ALL_PAGES ((1 << OLED_PAGES) - 1)
+#define OLED_PROGRESS_WIDTH 80  // Bar in front of the percentage text
+#define OLED_PROGRESS_TEXT_OFFSET 10
+
+typedef struct {
+    char text[OLED_TEXT_COLUMNS + 1];  // Empty if the line shows the content
+    uint8_t offset;
+} OledStatusLine;
+
+static pthread_mutex_t oledLock = PTHREAD_MUTEX_INITIALIZER;
+// Content layer, only the page buffer is used so images are transposed straight into it
+static SSD1306_t oledContent;
+static OledStatusLine oledStatus[OLED_PAGES];
+// Progress bar is modal, it hides the content but keeps the status lines
+static int oledProgressLine = -1;
+static int oledProgressLength;
+static char oledProgressText[8];
+static char oledMode[2];
+static uint8_t oledDirtyPages;
+// Content is refreshed from gray planes, see CONFIG_APP_OLED_GRAY
+static bool oledGrayActive;
+
+static void oledComposePage(int page) {
+    uint8_t *segs = oled._page[page]._segs;
+    if (oledProgressLine < 0)
+        memcpy(segs, oledContent._page[page]._segs, OLED_WIDTH);
+    else
+        memset(segs, 0, OLED_WIDTH);
+
+    OledStatusLine *status = &oledStatus[page];
+    if (status->text[0])
+        _ssd1306_text(&oled, status->offset, page, status->text, false);
+
+    if (page == oledProgressLine) {
+        int y = (page << 3) + 4;
+        _ssd1306_line(&oled, 0, y, oledProgressLength, y, false);
+        _ssd1306_text(&oled, OLED_PROGRESS_TEXT_OFFSET, page, oledProgressText, false);
+    }
+
+    if (page == 0 && oledMode[0])
+        _ssd1306_text(&oled, 0, 0, oledMode, false);
+}
+
+// Caller holds oledLock
+static void oledFlushLocked() {
+    if (!oledDirtyPages) return;
+    int64_t stageStart = perfStageBegin(PERF_STAGE_FLUSH);
+    for (int page = 0; page < OLED_PAGES; page++)
+        if (oledDirtyPages & (1 << page)) oledComposePage(page);
+
+    if (oledDirtyPages == OLED_ALL_PAGES) {
+        ssd1306_show_buffer(&oled);
+    } else {
+        ssd1306_batch_begin(&oled);
+        for (int page = 0; page < OLED_PAGES; page++)
+            if (oledDirtyPages & (1 << page)) ssd1306_show_buffer_page(&oled, page, 0);
+        ssd1306_batch_end(&oled);
+    }
+    oledDirtyPages = 0;
+    perfStageEnd(PERF_STAGE_FLUSH, stageStart);
+    oledClockCheck();
+}
+
+static inline void oledFlush() {
+    pthread_mutex_lock(&oledLock);
+    oledFlushLocked();
+    pthread_mutex_unlock(&oledLock);
+}
+
+// New content replaces the status lines and mode mark. Caller holds oledLock
+static void oledClearOverlaysLocked() {
+    for (int page = 0; page < OLED_PAGES; page++) {
+        if (!oledStatus[page].text[0]) continue;
+        oledStatus[page].text[0] = 0;
+        oledDirtyPages |= 1 << page;
+    }
+    if (oledMode[0]) {
+        oledMode[0] = 0;
+        oledDirtyPages |= 1;
+    }
+}
+
+static void oledSetStatusLocked(int offset, int line, const char *str) {
+    if (line < 0 || line >= OLED_PAGES || offset < 0 || offset >= OLED_TEXT_COLUMNS) return;
+    OledStatusLine *status = &oledStatus[line];
+    status->offset = offset;
+    // Cut at the panel edge when composed
+    strncpy(status->text, str, OLED_TEXT_COLUMNS);
+    status->text[OLED_TEXT_COLUMNS] = 0;
+    oledDirtyPages |= 1 << line;
+}
+
+// Content replaces the whole picture, status lines and mode mark are cleared with it.
+// While a progress bar is shown only the content is stored
+static void oledSetContent(uint8_t *bitmap) {
+    pthread_mutex_lock(&oledLock);
+    int64_t stageStart = perfStageBegin(PERF_STAGE_TRANSPOSE);
+    oledContent._flip = oled._flip;
+    _ssd1306_bitmaps(&oledContent, 0, 0, bitmap, OLED_WIDTH, OLED_HEIGHT, false);
+    perfStageEnd(PERF_STAGE_TRANSPOSE, stageStart);
+
+    oledGrayActive = false;
+    if (oledProgressLine < 0) {
+        oledClearOverlaysLocked();
+        oledDirtyPages = OLED_ALL_PAGES;
+    }
+    pthread_mutex_unlock(&oledLock);
+}
+
+// Content already in page format, pages that didn't change aren't sent again.
+// Status lines and mode mark are cleared like with oledSetContent
+static void oledSetContentPages(const uint8_t pages[OLED_PAGES][OLED_WIDTH]) {
+    pthread_mutex_lock(&oledLock);
+    oledGrayActive = false;
+    for (int page = 0; page < OLED_PAGES; page++) {
+        uint8_t *segs = oledContent._page[page]._segs;
+        memcpy(segs, pages[page], OLED_WIDTH);
+        if (oled._flip) ssd1306_flip(segs, OLED_WIDTH);
+        if (oledProgressLine < 0 && memcmp(segs, oled._page[page]._segs, OLED_WIDTH))
+            oledDirtyPages |= 1 << page;
+    }
+    if (oledProgressLine < 0) oledClearOverlaysLocked();
+    pthread_mutex_unlock(&oledLock);
+}
+
+static inline void oledSetString(int line, const char *str) {
+    pthread_mutex_lock(&oledLock);
+    oledSetStatusLocked(0, line, str);
+    pthread_mutex_unlock(&oledLock);
+}
+
+// Character at the top left over content and status, 0 hides it
+static inline void oledSetMode(char mode) {
+    pthread_mutex_lock(&oledLock);
+    oledMode[0] = mode;
+    oledDirtyPages |= 1;
+    pthread_mutex_unlock(&oledLock);
+}
+
+// Clears all layers without a flush
+static inline void oledClearLayers() {
+    pthread_mutex_lock(&oledLock);
+    memset(oledContent._page, 0, sizeof(oledContent._page));
+    memset(oledStatus, 0, sizeof(oledStatus));
+    oledProgressLine = -1;
+    oledMode[0] = 0;
+    oledGrayActive = false;
+    oledDirtyPages = OLED_ALL_PAGES;
+    pthread_mutex_unlock(&oledLock);
+}
+
+// Same as ssd1306_bitmaps, with transpose and flush timed separately
+static inline void oledShowBitmap(uint8_t *bitmap) {
+    oledSetContent(bitmap);
+    oledFlush();
+}
+
+#if CONFIG_APP_OLED_GRAY
+// Frame rate modulation: the preview is split in bit planes and a task shows one plane per refresh,
+// the eye averages them to gray levels. Only pages that differ from the previous plane are sent
+
+#define OLED_GRAY_MAX_PLANES (CONFIG_APP_OLED_GRAY_LEVELS - 1)
+#define OLED_GRAY_PERIOD_MS (1000 / CONFIG_APP_OLED_GRAY_REFRESH_HZ)
+#define OLED_GRAY_CHECK_REFRESHES 64  // Flush time is averaged over this many refreshes
+// More levels are tried again this long after they were lowered, doubled each time they don't fit
+#define OLED_GRAY_RAISE_MIN_MS (30 * 1000)
+#define OLED_GRAY_RAISE_MAX_MS (10 * 60 * 1000)
+#define OLED_GRAY_STACK_SIZE 3072
+
+// Planes in page format, front is shown and back is rendered from the next camera frame
+static SSD1306_t *oledGrayFront, *oledGrayBack;
+static uint8_t *oledGrayBitmaps[OLED_GRAY_MAX_PLANES];
+// Lowered when flushes don't fit the refresh period, 0 is the dithered preview
+static int oledGrayPlanes = OLED_GRAY_MAX_PLANES;
+static int64_t oledGrayRaiseUs;  // When to try more levels
+static int oledGrayRaiseMs = OLED_GRAY_RAISE_MIN_MS;
+static TaskHandle_t oledGrayTaskHandle;
+
+// Content pages for the next refresh, status lines and mode mark stay. Caller holds oledLock
+static void oledRefreshContentLocked(const SSD1306_t *plane) {
+    for (int page = 0; page < OLED_PAGES; page++) {
+        uint8_t *segs = oledContent._page[page]._segs;
+        if (!memcmp(segs, plane->_page[page]._segs, OLED_WIDTH)) continue;
+        memcpy(segs, plane->_page[page]._segs, OLED_WIDTH);
+        if (oledProgressLine < 0) oledDirtyPages |= 1 << page;
+    }
+}
+
+// Half the levels, below 3 levels it's the dithered preview again.
+// The shown planes don't match the new count, they stop until the next camera frame
+static void oledGrayReduce(uint32_t flushUs) {
+    pthread_mutex_lock(&oledLock);
+    int levels = (oledGrayPlanes + 1) >> 1;
+    oledGrayPlanes = levels < 3 ? 0 : levels - 1;
+    oledGrayActive = false;
+    oledGrayRaiseUs = esp_timer_get_time() + oledGrayRaiseMs * 1000LL;
+    oledGrayRaiseMs = MIN(oledGrayRaiseMs * 2, OLED_GRAY_RAISE_MAX_MS);
+    pthread_mutex_unlock(&oledLock);
+    ESP_LOGW(TAG_OLED, "Flush takes %" PRIu32 " us for %d ms refresh, %d gray levels", flushUs,
+             OLED_GRAY_PERIOD_MS, oledGrayPlanes ? oledGrayPlanes + 1 : 2);
 }
 
-void oledUpdateImage(uint8_t *data, size_t len, bool forceCalculateLight, const jpg_scale_t scale) {
+// Double the levels again after a while, a slow spell such as the I2C clock fallback may be over.
+// The refresh check lowers them again if flushes still don't fit. Called by the main task before rendering
+static void oledGrayRaise() {
+    // No planes without the task and buffers
+    if (!oledGrayFront || oledGrayPlanes == OLED_GRAY_MAX_PLANES) return;
+    int levels = 0;
+    pthread_mutex_lock(&oledLock);
+    if (esp_timer_get_time() >= oledGrayRaiseUs) {
+        levels = MIN((oledGrayPlanes ? oledGrayPlanes + 1 : 2) * 2, OLED_GRAY_MAX_PLANES + 1);
+        oledGrayPlanes = levels - 1;
+        oledGrayActive = false;
+    }
+    pthread_mutex_unlock(&oledLock);
+    if (levels) ESP_LOGI(TAG_OLED, "Trying %d gray levels", levels);
+}
+
+static void oledGrayTask(void *args) {
+    int plane = 0, refreshes = 0;
+    int64_t flushUs = 0;
+    TickType_t lastWake = xTaskGetTickCount();
+    for (;;) {
+        if (!oledGrayActive) {
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            lastWake = xTaskGetTickCount();
+            refreshes = 0;
+            flushUs = 0;
+        }
+        vTaskDelayUntil(&lastWake, pdMS_TO_TICKS(OLED_GRAY_PERIOD_MS));
+
+        pthread_mutex_lock(&oledLock);
+        // Timed after the lock, waiting for the main task isn't flush time
+        int64_t start = esp_timer_get_time();
+        if (oledGrayActive) {
+            if (plane >= oledGrayPlanes) plane = 0;
+            oledRefreshContentLocked(&oledGrayFront[plane++]);
+            oledFlushLocked();
+        }
+        flushUs += esp_timer_get_time() - start;
+        pthread_mutex_unlock(&oledLock);
+
+        if (++refreshes < OLED_GRAY_CHECK_REFRESHES) continue;
+        // A quarter of the period is left for the main task
+        uint32_t avgUs = flushUs / refreshes;
+        if (avgUs > OLED_GRAY_PERIOD_MS * 750)
+            oledGrayReduce(avgUs);
+        else if (oledGrayPlanes == OLED_GRAY_MAX_PLANES)
+            oledGrayRaiseMs = OLED_GRAY_RAISE_MIN_MS;
+        refreshes = 0;
+        flushUs = 0;
+    }
+}
+
+// Planes of a camera frame, shown from the next refresh on
+static void oledGrayRender(const ImageData *image, int threshold, int step) {
+    int planes = oledGrayPlanes;
+    // Twice the dither band, so the levels cover more of the light range
+    int64_t stageStart = perfStageBegin(PERF_STAGE_DITHER);
+    imageGrayPlanes(image, 2 * threshold - step, 2 * step - threshold, oledGrayBitmaps, planes, OLED_WIDTH, OLED_HEIGHT);
+    perfStageEnd(PERF_STAGE_DITHER, stageStart);
+
+    stageStart = perfStageBegin(PERF_STAGE_TRANSPOSE);
+    for (int k = 0; k < planes; k++) {
+        oledGrayBack[k]._flip = oled._flip;
+        _ssd1306_bitmaps(&oledGrayBack[k], 0, 0, oledGrayBitmaps[k], OLED_WIDTH, OLED_HEIGHT, false);
+    }
+    perfStageEnd(PERF_STAGE_TRANSPOSE, stageStart);
+
+    pthread_mutex_lock(&oledLock);
+    bool wake = false;
+    // Levels were lowered while rendering, drop the frame
+    if (planes == oledGrayPlanes) {
+        SSD1306_t *shown = oledGrayFront;
+        oledGrayFront = oledGrayBack;
+        oledGrayBack = shown;
+        if (oledProgressLine < 0) oledClearOverlaysLocked();
+        wake = !oledGrayActive;
+        oledGrayActive = true;
+    }
+    pthread_mutex_unlock(&oledLock);
+    if (wake) xTaskNotifyGive(oledGrayTaskHandle);
+}
+
+esp_err_t oledGrayStart() {
+    oledGrayFront = malloc_spi(sizeof(SSD1306_t) * OLED_GRAY_MAX_PLANES * 2);
+    uint8_t *bitmaps = malloc_spi(OLED_GRAY_MAX_PLANES * BITMAP_ROW_BYTE_COUNT * OLED_HEIGHT);
+    if (!oledGrayFront || !bitmaps ||
+        xTaskCreate(oledGrayTask, "oled_gray", OLED_GRAY_STACK_SIZE, NULL, tskIDLE_PRIORITY + 3, &oledGrayTaskHandle) != pdPASS) {
+        free(oledGrayFront);
+        free(bitmaps);
+        oledGrayFront = NULL;
+        oledGrayPlanes = 0;
+        return ESP_ERR_NO_MEM;
+    }
+    memset(oledGrayFront, 0, sizeof(SSD1306_t) * OLED_GRAY_MAX_PLANES * 2);
+    oledGrayBack = oledGrayFront + OLED_GRAY_MAX_PLANES;
+    for (int k = 0; k < OLED_GRAY_MAX_PLANES; k++)
+        oledGrayBitmaps[k] = bitmaps + k * BITMAP_ROW_BYTE_COUNT * OLED_HEIGHT;
+    return ESP_OK;
+}
+#else
+
+#define oledGrayStart() ESP_OK
+
+#endif  // CONFIG_APP_OLED_GRAY
+
+// Camera frame to the panel. Only preview frames use gray planes, a still stays on one dithered bitmap
+// so the plane refresh task sleeps until the next preview
+void oledUpdateImage(uint8_t *data, size_t len, bool forceCalculateLight, const jpg_scale_t scale, bool preview) {
     ImageData imageData;
-    if (!jpg2bw(data, len, scale, &imageData))
+    int64_t stageStart = perfStageBegin(PERF_STAGE_JPEG_DECODE);
+    bool decoded = jpg2bw(data, len, scale, &imageData);
+    // Close the stage on failure too, the trace pairs every begin with an end
+    perfStageEnd(PERF_STAGE_JPEG_DECODE, stageStart);
+    if (!decoded)
         return;
 
     static int threshold, step;
@@ -67,99 +481,71 @@ void oledUpdateImage(uint8_t *data, size_t len, bool forceCalculateLight, const
     uint64_t now = millis();
     if (now - time > 300 || forceCalculateLight) {
         time = now;
-
-#define W_SCAN 26
-#define H_SCAN 20
-        float wScanScale = (float)imageData.width / W_SCAN;
-        float hScanScale = (float)imageData.height / H_SCAN;
-
-        float avg = 0;
-        int thresholdMin = 255;
-        int thresholdMax = 0;
-        for (int i = 0; i < H_SCAN; i++) {
-            for (int j = 0; j < W_SCAN; j++) {
-                uint8_t level = RGB24_to_BW8(&imageData, j * wScanScale, i * hScanScale);
-                if (level < thresholdMin) thresholdMin = level;
-                if (level > thresholdMax) thresholdMax = level;
-                avg += level;
-            }
-        }
-        int center = thresholdMax * 0.4f +
-                     thresholdMin * 0.3f +
-                     avg / (H_SCAN * W_SCAN) * 0.3f;
-        int gap = (thresholdMax - thresholdMin) * 0.15f;
-        threshold = center - gap;
-        step = center + gap;
+        stageStart = perfStageBegin(PERF_STAGE_THRESHOLD);
+        imageCalcThreshold(&imageData, &threshold, &step);
         ESP_LOGD(TAG_OLED, "%d, %d", threshold, step);
+        perfStageEnd(PERF_STAGE_THRESHOLD, stageStart);
     }
 
-    float widthScale = (float)imageData.width / OLED_WIDTH;
-    float heightScale = (float)imageData.height / OLED_HEIGHT;
-    for (uint16_t i = 0; i < OLED_HEIGHT; i++) {
-        uint8_t *row = oledBitmap + i * BITMAP_ROW_BYTE_COUNT;
-        uint16_t yOff = i * heightScale;
-        for (uint16_t j = 0; j < BITMAP_ROW_BYTE_COUNT; j++) {
-            uint16_t jb = (j << 3);
-
-            uint8_t cache;
-            uint8_t p0 = RGB24_to_BW8(&imageData, (jb + 0) * widthScale, yOff);
-            setIfLess(p0, cache, RGB24_to_BW8(&imageData, (jb + 1) * widthScale, yOff));
-            setIfLess(p0, cache, RGB24_to_BW8(&imageData, (jb + 0) * widthScale, yOff + 1));
-            setIfLess(p0, cache, RGB24_to_BW8(&imageData, (jb + 1) * widthScale, yOff + 1));
-
-            uint8_t p1 = RGB24_to_BW8(&imageData, (jb + 2) * widthScale, yOff);
-            setIfLess(p1, cache, RGB24_to_BW8(&imageData, (jb + 3) * widthScale, yOff));
-            setIfLess(p1, cache, RGB24_to_BW8(&imageData, (jb + 2) * widthScale, yOff + 1));
-            setIfLess(p1, cache, RGB24_to_BW8(&imageData, (jb + 3) * widthScale, yOff + 1));
-
-            uint8_t p2 = RGB24_to_BW8(&imageData, (jb + 4) * widthScale, yOff);
-            setIfLess(p2, cache, RGB24_to_BW8(&imageData, (jb + 5) * widthScale, yOff));
-            setIfLess(p2, cache, RGB24_to_BW8(&imageData, (jb + 4) * widthScale, yOff + 1));
-            setIfLess(p2, cache, RGB24_to_BW8(&imageData, (jb + 5) * widthScale, yOff + 1));
-
-            uint8_t p3 = RGB24_to_BW8(&imageData, (jb + 6) * widthScale, yOff);
-            setIfLess(p3, cache, RGB24_to_BW8(&imageData, (jb + 7) * widthScale, yOff));
-            setIfLess(p3, cache, RGB24_to_BW8(&imageData, (jb + 6) * widthScale, yOff + 1));
-            setIfLess(p3, cache, RGB24_to_BW8(&imageData, (jb + 7) * widthScale, yOff + 1));
-
-            row[j] = (p0 < threshold ? 0 : (p0 < step ? (i % 2 ? 0b1000000 : 0b10000000) : 0b11000000)) |
-                     (p1 < threshold ? 0 : (p1 < step ? (i % 2 ? 0b10000 : 0b100000) : 0b110000)) |
-                     (p2 < threshold ? 0 : (p2 < step ? (i % 2 ? 0b100 : 0b1000) : 0b1100)) |
-                     (p3 < threshold ? 0 : (p3 < step ? (i % 2 ? 0b1 : 0b10) : 0b11));
-        }
+#if CONFIG_APP_OLED_GRAY
+    oledGrayRaise();
+    if (preview && oledGrayPlanes) {
+        oledGrayRender(&imageData, threshold, step);
+        freeImageData(&imageData);
+        return;
     }
+#endif
+
+    stageStart = perfStageBegin(PERF_STAGE_DITHER);
+    imageDitherBitmap(&imageData, threshold, step, oledBitmap, OLED_WIDTH, OLED_HEIGHT);
+    perfStageEnd(PERF_STAGE_DITHER, stageStart);
 
     freeImageData(&imageData);
 
     // fmt2bmp
-    ssd1306_bitmaps(&oled, 0, 0, oledBitmap, 128, 64, false);
+    oledShowBitmap(oledBitmap);
     return;
 }
 
-static inline void oledShowBitmap(uint8_t *bitmap) {
-    ssd1306_bitmaps(&oled, 0, 0, bitmap, 128, 64, false);
+static inline void oledShowStringOffset(int offset, int line, char *str) {
+    pthread_mutex_lock(&oledLock);
+    oledSetStatusLocked(offset, line, str);
+    oledFlushLocked();
+    pthread_mutex_unlock(&oledLock);
 }
 
 static inline void oledShowString(int line, char *str) {
-    ssd1306_display_text(&oled, 0, line, str, false);
-}
-
-static inline void oledShowStringOffset(int offset, int line, char *str) {
-    ssd1306_display_text(&oled, offset, line, str, false);
+    oledShowStringOffset(0, line, str);
 }
 
 static inline void oledClearLine(int line) {
-    ssd1306_clear_line(&oled, line, false);
+    oledShowString(line, "");
 }
 
-static inline void oledDrawLine(int line, int length) {
-    int y = (line << 3) + 4;
-    _ssd1306_line(&oled, 0, y, length, y, false);
-    ssd1306_show_buffer_page(&oled, line, 0);
+// Bar and percentage on one line, hides the content until oledClear
+static void oledShowProgress(int line, float percent) {
+    pthread_mutex_lock(&oledLock);
+    // Content is hidden from now on
+    if (oledProgressLine != line) oledDirtyPages = OLED_ALL_PAGES;
+    oledProgressLine = line;
+    oledProgressLength = (int)(percent * OLED_PROGRESS_WIDTH / 100 + 0.5f);
+    snprintf(oledProgressText, sizeof(oledProgressText), "%.1f%%", percent);
+    oledDirtyPages |= 1 << line;
+    oledFlushLocked();
+    pthread_mutex_unlock(&oledLock);
 }
 
 static inline void oledClear() {
-    ssd1306_clear_screen(&oled, false);
+    oledClearLayers();
+    oledFlush();
+}
+
+// Panel content as last flushed, for diagnostics
+static void oledSnapshot(uint8_t pages[OLED_PAGES][OLED_WIDTH]) {
+    pthread_mutex_lock(&oledLock);
+    for (int page = 0; page < OLED_PAGES; page++)
+        memcpy(pages[page], oled._page[page]._segs, OLED_WIDTH);
+    pthread_mutex_unlock(&oledLock);
 }
 
 #endif
\ No newline at end of file
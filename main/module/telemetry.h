@@ -0,0 +1,373 @@
+#ifndef __TELEMETRY__
+#define __TELEMETRY__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <esp_err.h>
+
+// Result of one capture workflow
+typedef struct {
+    uint8_t failedStep;  // 0 on success, otherwise TelemetryCaptureStep that failed
+    uint32_t captureSwitchUs;
+    uint32_t uploadBytes;
+    uint32_t uploadUs;
+    uint32_t waitProcessUs;
+    uint32_t waitSolveUs;
+    uint32_t resultBytes;
+    uint32_t resultDownloadUs;
+} TelemetryCapture;
+
+typedef enum telemetry_capture_step {
+    TELEMETRY_STEP_OK,
+    TELEMETRY_STEP_WIFI,
+    TELEMETRY_STEP_CAMERA,
+    TELEMETRY_STEP_UPLOAD,
+    TELEMETRY_STEP_WAIT_PROCESS,
+    TELEMETRY_STEP_WAIT_SOLVE,
+    TELEMETRY_STEP_RESULT_DOWNLOAD,
+} TelemetryCaptureStep;
+
+#if CONFIG_APP_TELEMETRY
+
+#include <string.h>
+#include <pthread.h>
+#include <sys/param.h>
+#include <esp_log.h>
+#include <esp_mac.h>
+#include <esp_wifi.h>
+#include <esp_timer.h>
+#include <esp_app_desc.h>
+#include <esp_heap_caps.h>
+#include <esp_http_client.h>
+
+#include "spi_ram.h"
+#include "perf_stats.h"
+#include "frame_scheduler.h"
+#include "http_api_control.h"
+#include "net_scheduler.h"
+#include "wifi_control.h"
+
+#define TELEMETRY_RING_SIZE 64
+#define TELEMETRY_BATCH_BUFFER_SIZE 4096
+#define TELEMETRY_FORMAT_VERSION 1
+// Retry after a failed upload, doubled each failure up to the flush interval
+#define TELEMETRY_BACKOFF_MIN_MS 5000
+
+static const char *TAG_TELEMETRY = "main:telemetry";
+
+typedef enum telemetry_record_type {
+    TELEMETRY_RECORD_CAPTURE = 1,
+    TELEMETRY_RECORD_PERIODIC = 2,
+} TelemetryRecordType;
+
+// Device state sampled every CONFIG_APP_TELEMETRY_SAMPLE_INTERVAL
+typedef struct {
+    uint16_t fpsX10;  // Average frame rate since last sample
+    uint32_t frames;
+    uint32_t missedDeadlines;
+    uint32_t internalFree;
+    uint32_t internalMinFree;
+    uint32_t psramFree;
+    uint32_t psramMinFree;
+    uint32_t wifiDisconnects;
+} TelemetryPeriodic;
+
+typedef struct {
+    uint8_t type;
+    int8_t rssi;
+    uint32_t uptimeS;
+    union {
+        TelemetryCapture capture;
+        TelemetryPeriodic periodic;
+    };
+} TelemetryRecord;
+
+// Records between tail and head, head and tail only increase
+static TelemetryRecord *telemetryRing;
+static uint32_t telemetryHead, telemetryTail, telemetryDropped;
+static pthread_mutex_t telemetryLock = PTHREAD_MUTEX_INITIALIZER;
+static int64_t telemetryLastSampleUs, telemetryLastFlushUs;
+static int telemetryFailures;  // Failed uploads in a row
+static uint32_t telemetryLastIntervalCount;
+static uint64_t telemetryLastIntervalSum;
+
+// Minimal CBOR (RFC 8949) writer, only definite length items
+typedef struct {
+    uint8_t *buf;
+    size_t size;
+    size_t len;
+    bool overflow;
+} CborWriter;
+
+static void cborHead(CborWriter *w, uint8_t major, uint64_t value) {
+    uint8_t head[9];
+    int bytes;
+    if (value < 24) {
+        head[0] = (major << 5) | value;
+        bytes = 0;
+    } else if (value <= UINT8_MAX) {
+        head[0] = (major << 5) | 24;
+        bytes = 1;
+    } else if (value <= UINT16_MAX) {
+        head[0] = (major << 5) | 25;
+        bytes = 2;
+    } else if (value <= UINT32_MAX) {
+        head[0] = (major << 5) | 26;
+        bytes = 4;
+    } else {
+        head[0] = (major << 5) | 27;
+        bytes = 8;
+    }
+    // Big endian argument
+    for (int i = 0; i < bytes; i++)
+        head[1 + i] = value >> ((bytes - 1 - i) * 8);
+
+    if (w->len + 1 + bytes > w->size) {
+        w->overflow = true;
+        return;
+    }
+    memcpy(w->buf + w->len, head, 1 + bytes);
+    w->len += 1 + bytes;
+}
+
+static inline void cborUint(CborWriter *w, uint64_t value) {
+    cborHead(w, 0, value);
+}
+
+static inline void cborInt(CborWriter *w, int64_t value) {
+    if (value < 0)
+        cborHead(w, 1, -1 - value);
+    else
+        cborHead(w, 0, value);
+}
+
+static void cborBytes(CborWriter *w, uint8_t major, const void *data, size_t len) {
+    cborHead(w, major, len);
+    if (w->overflow || w->len + len > w->size) {
+        w->overflow = true;
+        return;
+    }
+    memcpy(w->buf + w->len, data, len);
+    w->len += len;
+}
+
+static inline void cborText(CborWriter *w, const char *text) {
+    cborBytes(w, 3, text, strlen(text));
+}
+
+static inline void cborArray(CborWriter *w, size_t count) {
+    cborHead(w, 4, count);
+}
+
+static inline void cborMap(CborWriter *w, size_t count) {
+    cborHead(w, 5, count);
+}
+
+static int8_t telemetryRssi() {
+    wifi_ap_record_t ap;
+    return esp_wifi_sta_get_ap_info(&ap) == ESP_OK ? ap.rssi : 0;
+}
+
+static void telemetryAdd(TelemetryRecord *record) {
+    if (!telemetryRing) return;
+    record->uptimeS = esp_timer_get_time() / 1000000;
+    record->rssi = telemetryRssi();
+
+    pthread_mutex_lock(&telemetryLock);
+    // Drop oldest record when full
+    if (telemetryHead - telemetryTail == TELEMETRY_RING_SIZE) {
+        telemetryTail++;
+        telemetryDropped++;
+    }
+    telemetryRing[telemetryHead++ % TELEMETRY_RING_SIZE] = *record;
+    pthread_mutex_unlock(&telemetryLock);
+}
+
+void telemetryAddCapture(const TelemetryCapture *capture) {
+    TelemetryRecord record = {
+        .type = TELEMETRY_RECORD_CAPTURE,
+        .capture = *capture,
+    };
+    telemetryAdd(&record);
+}
+
+static void telemetrySamplePeriodic() {
+    PerfHistogram interval;
+    perfHistSnapshot(&frameScheduler.intervalTime, &interval);
+    uint32_t frames = interval.count - telemetryLastIntervalCount;
+    uint64_t frameTime = interval.sum - telemetryLastIntervalSum;
+    telemetryLastIntervalCount = interval.count;
+    telemetryLastIntervalSum = interval.sum;
+
+    TelemetryRecord record = {
+        .type = TELEMETRY_RECORD_PERIODIC,
+        .periodic = {
+            .fpsX10 = frameTime ? frames * 10000000ULL / frameTime : 0,
+            .frames = frameScheduler.frames,
+            .missedDeadlines = frameScheduler.missedDeadlines,
+            .internalFree = heap_caps_get_free_size(MALLOC_CAP_INTERNAL),
+            .internalMinFree = heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL),
+            .psramFree = heap_caps_get_free_size(MALLOC_CAP_SPIRAM),
+            .psramMinFree = heap_caps_get_minimum_free_size(MALLOC_CAP_SPIRAM),
+            .wifiDisconnects = wifiDisconnectCount,
+        },
+    };
+    telemetryAdd(&record);
+}
+
+// Record as array, field order is the wire format
+static void telemetryEncodeRecord(CborWriter *w, const TelemetryRecord *record) {
+    if (record->type == TELEMETRY_RECORD_CAPTURE) {
+        const TelemetryCapture *c = &record->capture;
+        // [type, uptime_s, rssi, failed_step, capture_switch_us, upload_bytes, upload_us,
+        //  wait_process_us, wait_solve_us, result_bytes, result_download_us]
+        cborArray(w, 11);
+        cborUint(w, record->type);
+        cborUint(w, record->uptimeS);
+        cborInt(w, record->rssi);
+        cborUint(w, c->failedStep);
+        cborUint(w, c->captureSwitchUs);
+        cborUint(w, c->uploadBytes);
+        cborUint(w, c->uploadUs);
+        cborUint(w, c->waitProcessUs);
+        cborUint(w, c->waitSolveUs);
+        cborUint(w, c->resultBytes);
+        cborUint(w, c->resultDownloadUs);
+    } else {
+        const TelemetryPeriodic *p = &record->periodic;
+        // [type, uptime_s, rssi, fps_x10, frames, missed_deadlines, internal_free, internal_min_free,
+        //  psram_free, psram_min_free, wifi_disconnects]
+        cborArray(w, 11);
+        cborUint(w, record->type);
+        cborUint(w, record->uptimeS);
+        cborInt(w, record->rssi);
+        cborUint(w, p->fpsX10);
+        cborUint(w, p->frames);
+        cborUint(w, p->missedDeadlines);
+        cborUint(w, p->internalFree);
+        cborUint(w, p->internalMinFree);
+        cborUint(w, p->psramFree);
+        cborUint(w, p->psramMinFree);
+        cborUint(w, p->wifiDisconnects);
+    }
+}
+
+// Encode pending records into one batch, return end sequence of the encoded records
+static uint32_t telemetryEncodeBatch(CborWriter *w) {
+    uint8_t mac[6];
+    esp_read_mac(mac, ESP_MAC_WIFI_STA);
+
+    pthread_mutex_lock(&telemetryLock);
+    uint32_t start = telemetryTail, end = telemetryHead;
+    // {"v": version, "id": mac, "fw": version, "drop": dropped, "r": [records]}
+    cborMap(w, 5);
+    cborText(w, "v");
+    cborUint(w, TELEMETRY_FORMAT_VERSION);
+    cborText(w, "id");
+    cborBytes(w, 2, mac, sizeof(mac));
+    cborText(w, "fw");
+    cborText(w, esp_app_get_description()->version);
+    cborText(w, "drop");
+    cborUint(w, telemetryDropped);
+    cborText(w, "r");
+    cborArray(w, end - start);
+    for (uint32_t i = start; i != end; i++)
+        telemetryEncodeRecord(w, &telemetryRing[i % TELEMETRY_RING_SIZE]);
+    pthread_mutex_unlock(&telemetryLock);
+    return end;
+}
+
+static esp_err_t telemetryFlush() {
+    CborWriter w = {
+        .buf = malloc_spi(TELEMETRY_BATCH_BUFFER_SIZE),
+        .size = TELEMETRY_BATCH_BUFFER_SIZE,
+    };
+    if (!w.buf) return ESP_ERR_NO_MEM;
+    uint32_t end = telemetryEncodeBatch(&w);
+    if (w.overflow) {
+        ESP_LOGE(TAG_TELEMETRY, "Batch too large");
+        free(w.buf);
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    esp_http_client_config_t config = {
+        .host = HTTP_API_HOST,
+        .path = "/telemetry",
+        .port = HTTP_API_PORT,
+        .method = HTTP_METHOD_POST,
+        .timeout_ms = 10000,
+        .event_handler = httpEventHandler,
+    };
+    esp_http_client_handle_t client = esp_http_client_init(&config);
+    esp_http_client_set_header(client, "Content-Type", "application/cbor");
+    esp_http_client_set_post_field(client, (char *)w.buf, w.len);
+    // Background class, waits while a capture is in flight
+    esp_err_t result = netPerform(client, NET_PRIORITY_TELEMETRY);
+    int code = esp_http_client_get_status_code(client);
+    HttpResponseData *responseData;
+    esp_http_client_get_user_data(client, (void **)&responseData);
+    httpResponseDataFree(responseData);
+    esp_http_client_cleanup(client);
+    free(w.buf);
+
+    if (result != ESP_OK || (code != 200 && code != 204)) {
+        ESP_LOGW(TAG_TELEMETRY, "Batch upload failed, code %d", code);
+        return ESP_FAIL;
+    }
+
+    // Records added during upload stay, records dropped during upload are already gone
+    pthread_mutex_lock(&telemetryLock);
+    if ((int32_t)(end - telemetryTail) > 0) {
+        telemetryTail = end;
+        telemetryDropped = 0;
+    }
+    pthread_mutex_unlock(&telemetryLock);
+    ESP_LOGI(TAG_TELEMETRY, "Batch sent, %zu bytes", w.len);
+    return ESP_OK;
+}
+
+// Sample and upload when due, call periodically from a background thread
+void telemetryTick() {
+    if (!telemetryRing) return;
+    int64_t now = esp_timer_get_time();
+    if (now - telemetryLastSampleUs >= CONFIG_APP_TELEMETRY_SAMPLE_INTERVAL * 1000000LL) {
+        telemetryLastSampleUs = now;
+        telemetrySamplePeriodic();
+    }
+
+    uint32_t pending = telemetryHead - telemetryTail;
+    if (!pending || !wifiIsReady()) return;
+    if (telemetryFailures) {
+        // Half full ring waits for the backoff too, failed records are sent again
+        int shift = MIN(telemetryFailures - 1, 16);
+        int64_t backoffMs = MIN((int64_t)TELEMETRY_BACKOFF_MIN_MS << shift, CONFIG_APP_TELEMETRY_FLUSH_INTERVAL * 1000LL);
+        if (now - telemetryLastFlushUs < backoffMs * 1000) return;
+    } else if (pending < TELEMETRY_RING_SIZE / 2 &&
+               now - telemetryLastFlushUs < CONFIG_APP_TELEMETRY_FLUSH_INTERVAL * 1000000LL) {
+        return;
+    }
+    telemetryLastFlushUs = now;
+    if (telemetryFlush() == ESP_OK) {
+        telemetryFailures = 0;
+    } else {
+        telemetryFailures++;
+        ESP_LOGW(TAG_TELEMETRY, "Upload failed %d times in a row", telemetryFailures);
+    }
+}
+
+esp_err_t telemetryInit() {
+    telemetryRing = malloc_spi(sizeof(TelemetryRecord) * TELEMETRY_RING_SIZE);
+    if (!telemetryRing) return ESP_ERR_NO_MEM;
+    telemetryLastSampleUs = telemetryLastFlushUs = esp_timer_get_time();
+    return ESP_OK;
+}
+
+#else
+
+#define telemetryInit() ESP_OK
+#define telemetryAddCapture(capture) ((void)(capture))
+#define telemetryTick() ((void)0)
+
+#endif  // CONFIG_APP_TELEMETRY
+
+#endif
@@ -1,8 +1,23 @@
+#ifndef __WIFI_CONTROL__
+#define __WIFI_CONTROL__
 
+#include <sdkconfig.h>
+
+#if CONFIG_IDF_TARGET_LINUX
+#include "host_wifi.h"
+#else
+
+#include <string.h>
+#include <sys/param.h>
+#include <inttypes.h>
 #include <esp_log.h>
 #include <esp_wifi.h>
+#include <esp_timer.h>
+#include <nvs.h>
 #include <freertos/FreeRTOS.h>
 
+#include "boot_timeline.h"
+
 #define ESP_WIFI_SSID CONFIG_ESP_WIFI_SSID
 #define ESP_WIFI_PASS CONFIG_ESP_WIFI_PASSWORD
 #define ESP_MAXIMUM_RETRY CONFIG_ESP_MAXIMUM_RETRY
@@ -41,61 +56,260 @@
 // #define ESP_WIFI_SSID "DESKTOP-LMSOTLF"
 
 /* The event group allows multiple bits for each event, but we only care about two events:
- * - we are connected to the AP with an IP
- * - we failed to connect after the maximum amount of retries */
+ * - we are connected to the AP with an IP, network is ready
+ * - connection is lost, connection manager should reconnect */
 #define WIFI_CONNECTED_BIT BIT0
-#define WIFI_FAIL_BIT BIT1
+#define WIFI_RECONNECT_BIT BIT1
+
+// Reconnect backoff after CONFIG_ESP_MAXIMUM_RETRY immediate retries, doubled each attempt
+#define WIFI_BACKOFF_MIN_MS 500
+#define WIFI_BACKOFF_MAX_MS 30000
+#define WIFI_MANAGER_STACK_SIZE 3072
+
+#define WIFI_CACHE_NVS_NAMESPACE "wifi"
+#define WIFI_CACHE_NVS_KEY "cache"
 
 static const char *TAG_WIFI = "main:wifi";
 
+typedef enum wifi_link_state {
+    WIFI_LINK_DOWN,
+    WIFI_LINK_CONNECTING,
+    WIFI_LINK_ASSOCIATED,  // Connected to AP, waiting for IP
+    WIFI_LINK_READY,       // Got IP
+} WifiLinkState;
+
+static EventGroupHandle_t s_wifi_event_group;
+volatile WifiLinkState wifiLinkState = WIFI_LINK_DOWN;
+static volatile int wifiRetryNum;
+// Count of connection loss after the network was ready
+uint32_t wifiDisconnectCount;
+static esp_netif_t *wifiNetif;
+static wifi_config_t wifiConfig = {
+    .sta = {
+        .ssid = ESP_WIFI_SSID,
+        .password = ESP_WIFI_PASS,
+        /* Authmode threshold resets to WPA2 as default if password matches WPA2 standards (password len => 8).
+         * If you want to connect the device to deprecated WEP/WPA networks, Please set the threshold value
+         * to WIFI_AUTH_WEP/WIFI_AUTH_WPA_PSK and set the password with length and format matching to
+         * WIFI_AUTH_WEP/WIFI_AUTH_WPA_PSK standards.
+         */
+        .threshold.authmode = ESP_WIFI_SCAN_AUTH_MODE_THRESHOLD,
+        .sae_pwe_h2e = ESP_WIFI_SAE_MODE,
+        .sae_h2e_identifier = ESP_WIFI_H2E_IDENTIFIER,
+        .listen_interval = CONFIG_ESP_WIFI_LISTEN_INTERVAL,
+    },
+};
+
+// Power save profile by application state
+typedef enum wifi_ps_profile {
+    WIFI_PS_PROFILE_SAVE,     // Max modem sleep, for preview and result viewing
+    WIFI_PS_PROFILE_LATENCY,  // No power save, for upload and result download
+    WIFI_PS_PROFILE_COUNT,
+} WifiPsProfile;
+
+static const char *const wifiPsProfileNames[WIFI_PS_PROFILE_COUNT] = {"save", "latency"};
+static WifiPsProfile wifiPsProfile = WIFI_PS_PROFILE_COUNT;
+static int64_t wifiPsProfileSinceUs;
+// Total time spent in each profile, in ms
+uint32_t wifiPsProfileTimeMs[WIFI_PS_PROFILE_COUNT];
+
+// Last successful connection, used to skip scan (and DHCP) on next connect
+typedef struct {
+    char ssid[33];
+    uint8_t bssid[6];
+    uint8_t channel;
+    esp_netif_ip_info_t ipInfo;
+} WifiCache;
+
+static WifiCache wifiCache;
+static bool wifiFastConnecting;  // Connecting to cached AP, not confirmed yet
+static bool wifiStaticIpApplied;
+static int64_t wifiConnectStartUs;
+// Last connect time (start to got IP) in ms, -1 if not connected yet
+int wifiConnectTimeMs = -1;
+bool wifiConnectedFast;
+
+static bool wifiCacheLoad(WifiCache *cache) {
+    nvs_handle_t nvs;
+    if (nvs_open(WIFI_CACHE_NVS_NAMESPACE, NVS_READONLY, &nvs) != ESP_OK)
+        return false;
+    size_t len = sizeof(WifiCache);
+    esp_err_t err = nvs_get_blob(nvs, WIFI_CACHE_NVS_KEY, cache, &len);
+    nvs_close(nvs);
+    if (err != ESP_OK || len != sizeof(WifiCache) || cache->channel == 0)
+        return false;
+    // Cache belongs to another network
+    cache->ssid[sizeof(cache->ssid) - 1] = 0;
+    return strcmp(cache->ssid, ESP_WIFI_SSID) == 0;
+}
+
+static void wifiCacheSave(const WifiCache *cache) {
+    nvs_handle_t nvs;
+    if (nvs_open(WIFI_CACHE_NVS_NAMESPACE, NVS_READWRITE, &nvs) != ESP_OK)
+        return;
+    if (cache) {
+        nvs_set_blob(nvs, WIFI_CACHE_NVS_KEY, cache, sizeof(WifiCache));
+    } else
+        nvs_erase_key(nvs, WIFI_CACHE_NVS_KEY);
+    nvs_commit(nvs);
+    nvs_close(nvs);
+}
+
+// Update cache from current connection, only write NVS if changed
+static void wifiCacheUpdate(const esp_netif_ip_info_t *ipInfo) {
+    wifi_ap_record_t ap;
+    if (esp_wifi_sta_get_ap_info(&ap) != ESP_OK) return;
+
+    WifiCache cache = {0};
+    strncpy(cache.ssid, ESP_WIFI_SSID, sizeof(cache.ssid) - 1);
+    memcpy(cache.bssid, ap.bssid, sizeof(cache.bssid));
+    cache.channel = ap.primary;
+    cache.ipInfo = *ipInfo;
+    if (memcmp(&cache, &wifiCache, sizeof(WifiCache)) == 0) return;
+
+    wifiCache = cache;
+    wifiCacheSave(&wifiCache);
+    ESP_LOGI(TAG_WIFI, "AP cache updated, channel %d", cache.channel);
+}
+
+// Cached AP can't be reached, drop the cache and go back to full scan with DHCP
+static void wifiFastConnectFallback() {
+    ESP_LOGW(TAG_WIFI, "Fast connect failed, fallback to full scan");
+    wifiFastConnecting = false;
+    memset(&wifiCache, 0, sizeof(WifiCache));
+    wifiCacheSave(NULL);
+    wifiConfig.sta.bssid_set = false;
+    wifiConfig.sta.channel = 0;
+    wifiConfig.sta.scan_method = WIFI_ALL_CHANNEL_SCAN;
+    esp_wifi_set_config(WIFI_IF_STA, &wifiConfig);
+}
+
 static void event_handler(void *arg, esp_event_base_t event_base,
                           int32_t event_id, void *event_data) {
-    EventGroupHandle_t s_wifi_event_group = arg;
-
-    static int s_retry_num = 0;
     if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_START) {
+        wifiConnectStartUs = esp_timer_get_time();
+        wifiLinkState = WIFI_LINK_CONNECTING;
         esp_wifi_connect();
+    } else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_CONNECTED) {
+        wifiLinkState = WIFI_LINK_ASSOCIATED;
+#if CONFIG_ESP_WIFI_FAST_CONNECT_STATIC_IP
+        wifi_event_sta_connected_t *event = (wifi_event_sta_connected_t *)event_data;
+        // Reuse last lease and skip DHCP, only on a directed connect to the cached AP
+        if (wifiConfig.sta.bssid_set && wifiCache.ipInfo.ip.addr &&
+            memcmp(event->bssid, wifiCache.bssid, sizeof(wifiCache.bssid)) == 0) {
+            esp_netif_dhcpc_stop(wifiNetif);
+            if (esp_netif_set_ip_info(wifiNetif, &wifiCache.ipInfo) == ESP_OK) {
+                wifiStaticIpApplied = true;
+            } else
+                esp_netif_dhcpc_start(wifiNetif);
+        }
+#endif
     } else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_DISCONNECTED) {
-        if (s_retry_num < CONFIG_ESP_MAXIMUM_RETRY) {
-            esp_wifi_connect();
-            s_retry_num++;
-            ESP_LOGI(TAG_WIFI, "retry to connect to the AP");
-        } else {
-            xEventGroupSetBits(s_wifi_event_group, WIFI_FAIL_BIT);
+        wifi_event_sta_disconnected_t *event = (wifi_event_sta_disconnected_t *)event_data;
+        xEventGroupClearBits(s_wifi_event_group, WIFI_CONNECTED_BIT);
+        if (wifiLinkState == WIFI_LINK_READY || wifiLinkState == WIFI_LINK_ASSOCIATED) {
+            // Measure recovery time from here
+            wifiConnectStartUs = esp_timer_get_time();
+            wifiDisconnectCount++;
+        }
+        wifiLinkState = WIFI_LINK_DOWN;
+        // Next connect may go to another AP, the cached lease is only applied again on a directed one
+        if (wifiStaticIpApplied) {
+            esp_netif_dhcpc_start(wifiNetif);
+            wifiStaticIpApplied = false;
         }
-        ESP_LOGI(TAG_WIFI, "connect to the AP fail");
+        if (wifiFastConnecting) {
+            wifiFastConnectFallback();
+            wifiRetryNum = 0;
+        } else
+            wifiRetryNum++;
+        ESP_LOGI(TAG_WIFI, "connect to the AP fail, reason %d", event->reason);
+        xEventGroupSetBits(s_wifi_event_group, WIFI_RECONNECT_BIT);
     } else if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP) {
         ip_event_got_ip_t *event = (ip_event_got_ip_t *)event_data;
         ESP_LOGI(TAG_WIFI, "got ip:" IPSTR, IP2STR(&event->ip_info.ip));
-        s_retry_num = 0;
+        wifiRetryNum = 0;
+        wifiLinkState = WIFI_LINK_READY;
+        wifiConnectTimeMs = (esp_timer_get_time() - wifiConnectStartUs) / 1000;
+        wifiConnectedFast = wifiFastConnecting;
+        wifiFastConnecting = false;
+        ESP_LOGI(TAG_WIFI, "connected in %d ms (%s)", wifiConnectTimeMs, wifiConnectedFast ? "fast" : "full scan");
+#if CONFIG_ESP_WIFI_FAST_CONNECT
+        wifiCacheUpdate(&event->ip_info);
+#endif
+        bootPhaseEnd(BOOT_PHASE_WIFI_CONNECT);
         xEventGroupSetBits(s_wifi_event_group, WIFI_CONNECTED_BIT);
+    } else if (event_base == IP_EVENT && event_id == IP_EVENT_STA_LOST_IP) {
+        ESP_LOGW(TAG_WIFI, "lost ip");
+        xEventGroupClearBits(s_wifi_event_group, WIFI_CONNECTED_BIT);
+        if (wifiLinkState == WIFI_LINK_READY)
+            wifiLinkState = WIFI_LINK_ASSOCIATED;
     }
 }
 
-static esp_err_t wifi_connect() {
-    wifi_config_t wifiConfig = {
-        .sta = {
-            .ssid = ESP_WIFI_SSID,
-            .password = ESP_WIFI_PASS,
-            /* Authmode threshold resets to WPA2 as default if password matches WPA2 standards (password len => 8).
-             * If you want to connect the device to deprecated WEP/WPA networks, Please set the threshold value
-             * to WIFI_AUTH_WEP/WIFI_AUTH_WPA_PSK and set the password with length and format matching to
-             * WIFI_AUTH_WEP/WIFI_AUTH_WPA_PSK standards.
-             */
-            .threshold.authmode = ESP_WIFI_SCAN_AUTH_MODE_THRESHOLD,
-            .sae_pwe_h2e = ESP_WIFI_SAE_MODE,
-            .sae_h2e_identifier = ESP_WIFI_H2E_IDENTIFIER,
-        },
-    };
-
-    EventGroupHandle_t s_wifi_event_group = xEventGroupCreate();
+// Reconnect after connection loss, with backoff and without retry limit
+static void wifiManagerTask(void *args) {
+    while (1) {
+        xEventGroupWaitBits(s_wifi_event_group, WIFI_RECONNECT_BIT, pdTRUE, pdFALSE, portMAX_DELAY);
+        if (wifiLinkState != WIFI_LINK_DOWN) continue;
+
+        int retry = wifiRetryNum;
+        if (retry > CONFIG_ESP_MAXIMUM_RETRY) {
+            int shift = MIN(retry - CONFIG_ESP_MAXIMUM_RETRY - 1, 16);
+            int backoff = MIN(WIFI_BACKOFF_MIN_MS << shift, WIFI_BACKOFF_MAX_MS);
+            ESP_LOGI(TAG_WIFI, "retry %d in %d ms", retry, backoff);
+            vTaskDelay(pdMS_TO_TICKS(backoff));
+            // AP may be moved to another channel or BSSID
+            if (wifiConfig.sta.bssid_set) {
+                wifiConfig.sta.bssid_set = false;
+                wifiConfig.sta.channel = 0;
+                wifiConfig.sta.scan_method = WIFI_ALL_CHANNEL_SCAN;
+                esp_wifi_set_config(WIFI_IF_STA, &wifiConfig);
+            }
+        }
+        ESP_LOGI(TAG_WIFI, "retry to connect to the AP");
+        wifiLinkState = WIFI_LINK_CONNECTING;
+        esp_wifi_connect();
+    }
+}
+
+static esp_err_t wifiSetPsProfile(WifiPsProfile profile) {
+    if (profile == wifiPsProfile) return ESP_OK;
+#if CONFIG_ESP_WIFI_DYNAMIC_PS
+    wifi_ps_type_t ps = profile == WIFI_PS_PROFILE_LATENCY ? WIFI_PS_NONE : WIFI_PS_MAX_MODEM;
+#else
+    wifi_ps_type_t ps = WIFI_PS_MIN_MODEM;
+#endif
+    int64_t start = esp_timer_get_time();
+    esp_err_t err = esp_wifi_set_ps(ps);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG_WIFI, "Set power save %s failed: %s", wifiPsProfileNames[profile], esp_err_to_name(err));
+        return err;
+    }
+    int64_t now = esp_timer_get_time();
+
+    if (wifiPsProfile != WIFI_PS_PROFILE_COUNT) {
+        uint32_t heldMs = (now - wifiPsProfileSinceUs) / 1000;
+        wifiPsProfileTimeMs[wifiPsProfile] += heldMs;
+        ESP_LOGI(TAG_WIFI, "Power save %s -> %s in %" PRId64 " us, held %" PRIu32 " ms", wifiPsProfileNames[wifiPsProfile],
+                 wifiPsProfileNames[profile], now - start, heldMs);
+    }
+    wifiPsProfile = profile;
+    wifiPsProfileSinceUs = now;
+    return ESP_OK;
+}
+
+// Start connecting to the AP, use wifiWaitReady() to wait for network.
+// Connection is kept by the connection manager from then on.
+static esp_err_t wifiStart() {
+    s_wifi_event_group = xEventGroupCreate();
 
     esp_err_t err;
     err = esp_netif_init();
     if (err != ESP_OK) return err;
     err = esp_event_loop_create_default();
     if (err != ESP_OK) return err;
-    esp_netif_create_default_wifi_sta();
+    wifiNetif = esp_netif_create_default_wifi_sta();
 
     wifi_init_config_t wifiChipConfig = WIFI_INIT_CONFIG_DEFAULT();
     err = esp_wifi_init(&wifiChipConfig);
@@ -106,46 +320,70 @@ static esp_err_t wifi_connect() {
     err = esp_event_handler_instance_register(WIFI_EVENT,
                                               ESP_EVENT_ANY_ID,
                                               &event_handler,
-                                              s_wifi_event_group,
+                                              NULL,
                                               &instance_any_id);
     if (err != ESP_OK) return err;
     err = esp_event_handler_instance_register(IP_EVENT,
                                               IP_EVENT_STA_GOT_IP,
                                               &event_handler,
-                                              s_wifi_event_group,
+                                              NULL,
                                               &instance_got_ip);
     if (err != ESP_OK) return err;
+    esp_event_handler_instance_t instance_lost_ip;
+    err = esp_event_handler_instance_register(IP_EVENT,
+                                              IP_EVENT_STA_LOST_IP,
+                                              &event_handler,
+                                              NULL,
+                                              &instance_lost_ip);
+    if (err != ESP_OK) return err;
+    if (xTaskCreate(wifiManagerTask, "wifi_manager", WIFI_MANAGER_STACK_SIZE, NULL, 5, NULL) != pdPASS)
+        return ESP_ERR_NO_MEM;
 
     err = esp_wifi_set_mode(WIFI_MODE_STA);
     if (err != ESP_OK) return err;
+#if CONFIG_ESP_WIFI_FAST_CONNECT
+    // Connect directly to the last AP
+    if (wifiCacheLoad(&wifiCache)) {
+        memcpy(wifiConfig.sta.bssid, wifiCache.bssid, sizeof(wifiCache.bssid));
+        wifiConfig.sta.bssid_set = true;
+        wifiConfig.sta.channel = wifiCache.channel;
+        wifiConfig.sta.scan_method = WIFI_FAST_SCAN;
+        wifiFastConnecting = true;
+        ESP_LOGI(TAG_WIFI, "Fast connect, channel %d", wifiCache.channel);
+    } else
+        memset(&wifiCache, 0, sizeof(WifiCache));
+#endif
     err = esp_wifi_set_config(WIFI_IF_STA, &wifiConfig);
     if (err != ESP_OK) return err;
+    bootPhaseBegin(BOOT_PHASE_WIFI_CONNECT);
     err = esp_wifi_start();
     if (err != ESP_OK) return err;
-    // err = esp_wifi_set_ps(WIFI_PS_NONE);
-    // if (err != ESP_OK) return err;
+    err = wifiSetPsProfile(WIFI_PS_PROFILE_SAVE);
+    if (err != ESP_OK) return err;
 
     ESP_LOGI(TAG_WIFI, "wifi_init_sta finished.");
+    return ESP_OK;
+}
+
+static inline bool wifiIsReady() {
+    return s_wifi_event_group && (xEventGroupGetBits(s_wifi_event_group) & WIFI_CONNECTED_BIT);
+}
+
+// Wait until network is ready, return false on timeout
+static bool wifiWaitReady(TickType_t timeout) {
+    if (!s_wifi_event_group) return false;
 
-    /* Waiting until either the connection is established (WIFI_CONNECTED_BIT) or connection failed for the maximum
-     * number of re-tries (WIFI_FAIL_BIT). The bits are set by event_handler() (see above) */
     EventBits_t bits = xEventGroupWaitBits(s_wifi_event_group,
-                                           WIFI_CONNECTED_BIT | WIFI_FAIL_BIT,
+                                           WIFI_CONNECTED_BIT,
                                            pdFALSE,
                                            pdFALSE,
-                                           portMAX_DELAY);
+                                           timeout);
+    if (bits & WIFI_CONNECTED_BIT) return true;
 
-    /* xEventGroupWaitBits() returns the bits before the call returned, hence we can test which event actually
-     * happened. */
-    if (bits & WIFI_CONNECTED_BIT) {
-        ESP_LOGI(TAG_WIFI, "connected to ap SSID:%s password:%s", ESP_WIFI_SSID, ESP_WIFI_PASS);
-        return ESP_OK;
-    }
+    ESP_LOGW(TAG_WIFI, "Network not ready, SSID:%s link state %d", ESP_WIFI_SSID, wifiLinkState);
+    return false;
+}
 
-    if (bits & WIFI_FAIL_BIT) {
-        ESP_LOGE(TAG_WIFI, "Failed to connect to SSID:%s, password:%s", ESP_WIFI_SSID, ESP_WIFI_PASS);
-    } else {
-        ESP_LOGE(TAG_WIFI, "UNEXPECTED EVENT (%lx)", bits);
-    }
-    return ESP_FAIL;
-}
\ No newline at end of file
+#endif  // CONFIG_IDF_TARGET_LINUX
+
+#endif
@@ -1,30 +1,41 @@
 #include <stdbool.h>
+#include <sys/param.h>
 #include <esp_log.h>
 #include <pthread.h>
 #include <freertos/FreeRTOS.h>
+#if !CONFIG_IDF_TARGET_LINUX
 #include <esp_ota_ops.h>
+#endif
 
+#include "app_event.h"
+#include "boot_timeline.h"
+#include "trace.h"
 #include "module/http_api_control.h"
 #include "module/oled_control.h"
+#include "module/telemetry.h"
+#include "module/wifi_control.h"
 
 static const char *TAG_OTA = "main:ota";
 
 bool otaUpdating = false;
 pthread_t otaUpdateCheckThreadt;
 
+#if !CONFIG_IDF_TARGET_LINUX
+
 esp_err_t otaHttpEventHandler(esp_http_client_event_t *evt) {
     esp_err_t err = httpEventHandler(evt);
     if (err != ESP_OK) return err;
 
     // Read progress
     static float lastProgress = -1;
-    char text[17];
     switch (evt->event_id) {
     case HTTP_EVENT_ON_DATA:
         size_t contentLen = esp_http_client_get_content_length(evt->client);
         if (contentLen) {
             if (!otaUpdating) {
                 otaUpdating = true;
+                // Wake main task if it is waiting for input
+                appEventPost(APP_EVENT_OTA_START);
                 lastProgress = -1;
                 delay(100);
                 oledClear();
@@ -33,10 +44,7 @@ esp_err_t otaHttpEventHandler(esp_http_client_event_t *evt) {
             esp_http_client_get_user_data(evt->client, (void **)&data);
             float percent = (float)data->len / contentLen * 100;
             if (percent > lastProgress || data->len == contentLen) {
-                int n = (int)(percent * 0.8f + 0.5f);
-                oledDrawLine(0, n);
-                sprintf(text, "%.1f%%", percent);
-                oledShowStringOffset(10, 0, text);
+                oledShowProgress(0, percent);
                 lastProgress = percent + 0.5f;
             }
         }
@@ -55,13 +63,15 @@ static esp_err_t checkOtaUpdate() {
         .method = HTTP_METHOD_GET,
         .event_handler = otaHttpEventHandler,
     };
+    TRACE_BEGIN(TRACE_EVENT_OTA_CHECK, 0);
     esp_http_client_handle_t client = esp_http_client_init(&config);
-    esp_err_t result = esp_http_client_perform(client);
+    esp_err_t result = netPerform(client, NET_PRIORITY_OTA);
     int code = esp_http_client_get_status_code(client);
     // Get user data
     HttpResponseData *data;
     esp_http_client_get_user_data(client, (void **)&data);
     esp_http_client_cleanup(client);
+    TRACE_END(TRACE_EVENT_OTA_CHECK, code);
     // Check state
     if (result != ESP_OK || (code != 200 && code != 204)) {
         ESP_LOGE(TAG_OTA, "OTA check request failed");
@@ -131,25 +141,61 @@ UPDATE_FAILED:
     return ESP_FAIL;
 }
 
+// A failed check is retried after this, doubled each failure in a row
+#define OTA_RETRY_MIN_MS 5000
+#define OTA_RETRY_MAX_MS (10 * 60 * 1000)
+
+static int otaFailures;  // Failed checks in a row
+static int64_t otaNextCheckUs;
+
+static void otaCheck() {
+    if (checkOtaUpdate() == ESP_OK) {
+        otaFailures = 0;
+        return;
+    }
+    if (otaUpdating) {
+        // Download already took the display over and the main loop has ended, only a restart recovers
+        oledShowString(1, "OTA Update Fail");
+        esp_restart();
+    }
+    // Network lost during check is not an OTA failure, check again once it is back
+    if (!wifiIsReady()) return;
+    otaFailures++;
+    int shift = MIN(otaFailures - 1, 16);
+    int backoffMs = MIN((int64_t)OTA_RETRY_MIN_MS << shift, OTA_RETRY_MAX_MS);
+    otaNextCheckUs = esp_timer_get_time() + backoffMs * 1000LL;
+    ESP_LOGW(TAG_OTA, "Check failed %d times in a row, retry in %d ms", otaFailures, backoffMs);
+}
+
 void *otaUpadateCheckThread(void *args) {
+    // First check is deferred until WiFi is connected
+    wifiWaitReady(portMAX_DELAY);
+    bootPhaseBegin(BOOT_PHASE_OTA_CHECK);
+    otaCheck();
+    bootPhaseEnd(BOOT_PHASE_OTA_CHECK);
+    bootTimelineLog();
+
     while (1) {
-        if (checkOtaUpdate() != ESP_OK) {
-            oledShowString(1, "OTA Update Fail");
-            esp_restart();
-            break;
-        }
         delay(500);
+        wifiWaitReady(portMAX_DELAY);
+        if (esp_timer_get_time() >= otaNextCheckUs)
+            otaCheck();
+        // Telemetry rides on the background check loop
+        telemetryTick();
     }
-    pthread_exit(NULL);
-    return NULL;
 }
 
+// Start OTA check in background, call after the UI is live
 void otaUpadateCheckStart() {
-    if (checkOtaUpdate() != ESP_OK) {
-        oledShowString(1, "OTA Check Fail");
-        esp_restart();
-        return;
-    }
     pthread_create(&otaUpdateCheckThreadt, NULL, otaUpadateCheckThread, NULL);
     // pthread_join(otaUpadateCheckThread, NULL);
-}
\ No newline at end of file
+}
+
+#else
+
+// Host build has no OTA partitions, and FreeRTOS can't be called from a host pthread
+void otaUpadateCheckStart() {
+    bootTimelineLog();
+}
+
+#endif  // CONFIG_IDF_TARGET_LINUX
@@ -0,0 +1,165 @@
+#ifndef __PERF_STATS_H__
+#define __PERF_STATS_H__
+
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+
+#include "trace.h"
+
+// Log-linear histogram for microsecond samples.
+// Values below PERF_HIST_SUB_BUCKETS are exact, above that every power of two
+// is split into PERF_HIST_SUB_BUCKETS buckets (max 25% error).
+#define PERF_HIST_SUB_BITS 2
+#define PERF_HIST_SUB_BUCKETS (1 << PERF_HIST_SUB_BITS)
+#define PERF_HIST_BUCKETS (PERF_HIST_SUB_BUCKETS * (33 - PERF_HIST_SUB_BITS))
+
+typedef struct {
+    uint32_t count;
+    uint32_t min;
+    uint32_t max;
+    uint64_t sum;
+    uint32_t buckets[PERF_HIST_BUCKETS];
+} PerfHistogram;
+
+static portMUX_TYPE perfStatsLock = portMUX_INITIALIZER_UNLOCKED;
+
+static inline int perfHistBucket(uint32_t value) {
+    if (value < PERF_HIST_SUB_BUCKETS) return value;
+    int shift = (31 - __builtin_clz(value)) - PERF_HIST_SUB_BITS;
+    return PERF_HIST_SUB_BUCKETS * (shift + 1) + ((value >> shift) & (PERF_HIST_SUB_BUCKETS - 1));
+}
+
+// Lowest value of a bucket
+static inline uint32_t perfHistBucketBase(int bucket) {
+    if (bucket < PERF_HIST_SUB_BUCKETS) return bucket;
+    int shift = bucket / PERF_HIST_SUB_BUCKETS - 1;
+    return (uint32_t)(PERF_HIST_SUB_BUCKETS + bucket % PERF_HIST_SUB_BUCKETS) << shift;
+}
+
+static inline uint32_t perfHistBucketWidth(int bucket) {
+    if (bucket < PERF_HIST_SUB_BUCKETS) return 1;
+    return 1u << (bucket / PERF_HIST_SUB_BUCKETS - 1);
+}
+
+void perfHistRecord(PerfHistogram *hist, uint32_t value) {
+    taskENTER_CRITICAL(&perfStatsLock);
+    if (!hist->count || value < hist->min) hist->min = value;
+    if (value > hist->max) hist->max = value;
+    hist->count++;
+    hist->sum += value;
+    hist->buckets[perfHistBucket(value)]++;
+    taskEXIT_CRITICAL(&perfStatsLock);
+}
+
+void perfHistReset(PerfHistogram *hist) {
+    taskENTER_CRITICAL(&perfStatsLock);
+    memset(hist, 0, sizeof(PerfHistogram));
+    taskEXIT_CRITICAL(&perfStatsLock);
+}
+
+// Consistent copy of a histogram that is being recorded from other tasks
+void perfHistSnapshot(const PerfHistogram *hist, PerfHistogram *out) {
+    taskENTER_CRITICAL(&perfStatsLock);
+    memcpy(out, hist, sizeof(PerfHistogram));
+    taskEXIT_CRITICAL(&perfStatsLock);
+}
+
+static inline uint32_t perfHistAvg(const PerfHistogram *hist) {
+    return hist->count ? hist->sum / hist->count : 0;
+}
+
+// Estimated percentile (0-100), bucket midpoint clamped to min and max
+uint32_t perfHistPercentile(const PerfHistogram *hist, float percentile) {
+    if (!hist->count) return 0;
+    uint32_t rank = (uint32_t)(hist->count * percentile / 100.0f + 0.5f);
+    if (rank < 1) rank = 1;
+    uint32_t seen = 0;
+    for (int i = 0; i < PERF_HIST_BUCKETS; i++) {
+        seen += hist->buckets[i];
+        if (seen < rank) continue;
+        uint32_t value = perfHistBucketBase(i) + perfHistBucketWidth(i) / 2;
+        if (value < hist->min) value = hist->min;
+        if (value > hist->max) value = hist->max;
+        return value;
+    }
+    return hist->max;
+}
+
+static const char *TAG_PERF = "main:perf";
+
+// Pipeline stages with always-on timing, us
+typedef enum perf_stage {
+    PERF_STAGE_CAM_FB_GET,       // Preview frame from camera driver
+    PERF_STAGE_JPEG_DECODE,      // JPEG to RGB
+    PERF_STAGE_THRESHOLD,        // Light level scan for dither threshold
+    PERF_STAGE_DITHER,           // RGB to 1 bit bitmap
+    PERF_STAGE_TRANSPOSE,        // Row major bitmap to display pages
+    PERF_STAGE_FLUSH,            // Display pages to panel
+    PERF_STAGE_CAPTURE_SWITCH,   // Camera frame size change
+    PERF_STAGE_CAMERA_WAKE,      // Sensor standby exit until its first new frame
+    PERF_STAGE_UPLOAD,           // Image upload
+    PERF_STAGE_WAIT_PROCESS,     // Wait image processing
+    PERF_STAGE_WAIT_SOLVE,       // Wait problem solving
+    PERF_STAGE_RESULT_DOWNLOAD,  // Result image download
+    PERF_STAGE_RENDER,           // Result image to frame
+    PERF_STAGE_COUNT,
+} PerfStage;
+
+static const char *const perfStageNames[PERF_STAGE_COUNT] = {
+    "cam_fb_get",
+    "jpeg_decode",
+    "threshold",
+    "dither",
+    "transpose",
+    "flush",
+    "capture_switch",
+    "camera_wake",
+    "upload",
+    "wait_process",
+    "wait_solve",
+    "result_download",
+    "render",
+};
+
+PerfHistogram perfStages[PERF_STAGE_COUNT];
+
+// Start time for perfStageEnd
+static inline int64_t perfStageBegin(PerfStage stage) {
+    TRACE_BEGIN(TRACE_EVENT_STAGE, stage);
+    return esp_timer_get_time();
+}
+
+// Record stage time, return it in us
+static inline uint32_t perfStageEnd(PerfStage stage, int64_t start) {
+    uint32_t time = esp_timer_get_time() - start;
+    perfHistRecord(&perfStages[stage], time);
+    TRACE_END(TRACE_EVENT_STAGE, stage);
+    return time;
+}
+
+static inline void perfStageSnapshot(PerfStage stage, PerfHistogram *out) {
+    perfHistSnapshot(&perfStages[stage], out);
+}
+
+void perfStageReset() {
+    for (int i = 0; i < PERF_STAGE_COUNT; i++)
+        perfHistReset(&perfStages[i]);
+}
+
+void perfStageLog() {
+    PerfHistogram hist;
+    for (int i = 0; i < PERF_STAGE_COUNT; i++) {
+        perfStageSnapshot(i, &hist);
+        if (!hist.count) continue;
+        ESP_LOGI(TAG_PERF, "%-15s n %6" PRIu32 ", min %7" PRIu32 " avg %7" PRIu32 " p50 %7" PRIu32 " p99 %7" PRIu32
+                 " max %7" PRIu32 " us", perfStageNames[i],
+                 hist.count, hist.min, perfHistAvg(&hist), perfHistPercentile(&hist, 50),
+                 perfHistPercentile(&hist, 99), hist.max);
+    }
+}
+
+#endif
@@ -0,0 +1,250 @@
+#ifndef __RESULT_TEXT_H__
+#define __RESULT_TEXT_H__
+
+// Text result, laid out on device instead of downscaling a raster.
+// Payload is "RTX1", record length as 16 bit big endian, then records:
+//   0x20 - 0x7E           ASCII character, 8x8 font
+//   0x0A                  line break
+//   0x01 id               glyph reference
+//   0x02 id w h bitmap    glyph definition, w x h pixels (up to 128 x 32), row major 1 bit,
+//                         rows padded to bytes, 1 is lit. Must come before its references
+// Other bytes are skipped. Lines wrap at spaces to 128 px, a word longer than a line is broken.
+// Glyphs are centered on the tallest glyph of their line.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <esp_err.h>
+#include <esp_log.h>
+
+#include "font8x8_basic.h"
+#include "spi_ram.h"
+#include "image_kernels.h"
+
+#define RESULT_TEXT_MAGIC "RTX1"
+#define RESULT_TEXT_HEADER_SIZE 6
+#define RESULT_TEXT_NEWLINE 0x0A
+#define RESULT_TEXT_GLYPH_REF 0x01
+#define RESULT_TEXT_GLYPH_DEF 0x02
+#define RESULT_TEXT_WIDTH 128
+#define RESULT_TEXT_MAX_GLYPH_HEIGHT 32
+#define RESULT_TEXT_SCALES 2  // Layout at 1x and 2x font size
+
+static const char *TAG_TEXT = "main:text";
+
+typedef struct {
+    uint8_t width, height;                // Unscaled pixels, 0 if not defined
+    const uint8_t *bitmap;                // Glyph definition rows in the payload, NULL for the font
+    uint8_t *scaled[RESULT_TEXT_SCALES];  // Row major by scale, made on first use
+} ResultGlyph;
+
+// Font glyphs stay cached, payload glyphs are dropped with their payload
+static ResultGlyph resultTextFont[128];
+static ResultGlyph resultTextGlyphs[256];
+
+static inline bool resultTextIs(const uint8_t *buff, size_t len) {
+    return len >= RESULT_TEXT_HEADER_SIZE && !memcmp(buff, RESULT_TEXT_MAGIC, 4);
+}
+
+// Payload bytes of a text result, header included
+static inline size_t resultTextSize(const uint8_t *buff) {
+    return RESULT_TEXT_HEADER_SIZE + (buff[4] << 8 | buff[5]);
+}
+
+static void resultGlyphDrop(ResultGlyph *glyph) {
+    for (int i = 0; i < RESULT_TEXT_SCALES; i++)
+        free(glyph->scaled[i]);
+    memset(glyph, 0, sizeof(ResultGlyph));
+}
+
+static bool resultGlyphPixel(const ResultGlyph *glyph, int x, int y) {
+    if (!glyph->bitmap) return font8x8_basic_tr[glyph - resultTextFont][x] >> y & 1;
+    return glyph->bitmap[y * ((glyph->width + 7) >> 3) + (x >> 3)] & (0x80 >> (x & 7));
+}
+
+// Row major bitmap of the glyph at scale, rows of (width * scale + 7) / 8 bytes
+static const uint8_t *resultGlyphRows(ResultGlyph *glyph, int scale) {
+    uint8_t **rows = &glyph->scaled[scale - 1];
+    if (*rows) return *rows;
+
+    int rowBytes = (glyph->width * scale + 7) >> 3;
+    *rows = calloc(rowBytes * glyph->height * scale, 1);
+    if (!*rows) return NULL;
+    for (int y = 0; y < glyph->height * scale; y++) {
+        uint8_t *row = *rows + y * rowBytes;
+        for (int x = 0; x < glyph->width * scale; x++)
+            if (resultGlyphPixel(glyph, x / scale, y / scale)) row[x >> 3] |= 0x80 >> (x & 7);
+    }
+    return *rows;
+}
+
+// Drop payload glyphs, before their payload is freed
+void resultTextUnload() {
+    for (int i = 0; i < 256; i++)
+        resultGlyphDrop(&resultTextGlyphs[i]);
+}
+
+// Register glyph definitions of the payload, before the first layout
+void resultTextLoad(const uint8_t *buff) {
+    const uint8_t *data = buff + RESULT_TEXT_HEADER_SIZE;
+    int len = resultTextSize(buff) - RESULT_TEXT_HEADER_SIZE;
+    resultTextUnload();
+
+    for (int pos = 0; pos < len;) {
+        if (data[pos] == RESULT_TEXT_GLYPH_REF) {
+            pos += 2;
+        } else if (data[pos] == RESULT_TEXT_GLYPH_DEF) {
+            if (pos + 4 > len) break;
+            int w = data[pos + 2], h = data[pos + 3];
+            int size = ((w + 7) >> 3) * h;
+            if (pos + 4 + size > len) break;
+            if (w && w <= RESULT_TEXT_WIDTH && h && h <= RESULT_TEXT_MAX_GLYPH_HEIGHT) {
+                ResultGlyph *glyph = &resultTextGlyphs[data[pos + 1]];
+                glyph->width = w;
+                glyph->height = h;
+                glyph->bitmap = data + pos + 4;
+            }
+            pos += 4 + size;
+        } else {
+            pos++;
+        }
+    }
+}
+
+typedef enum {
+    RESULT_ITEM_SKIP,
+    RESULT_ITEM_NEWLINE,
+    RESULT_ITEM_GLYPH,
+} ResultItem;
+
+// Item at pos, returns the position after it
+static int resultTextItem(const uint8_t *data, int len, int pos, ResultItem *item, ResultGlyph **glyph) {
+    uint8_t code = data[pos];
+    *item = RESULT_ITEM_SKIP;
+    if (code >= 0x20 && code < 0x7F) {
+        *item = RESULT_ITEM_GLYPH;
+        *glyph = &resultTextFont[code];
+        (*glyph)->width = (*glyph)->height = 8;
+        return pos + 1;
+    }
+    if (code == RESULT_TEXT_NEWLINE) {
+        *item = RESULT_ITEM_NEWLINE;
+        return pos + 1;
+    }
+    if (code == RESULT_TEXT_GLYPH_REF) {
+        if (pos + 2 > len) return len;
+        *glyph = &resultTextGlyphs[data[pos + 1]];
+        if ((*glyph)->width) *item = RESULT_ITEM_GLYPH;
+        return pos + 2;
+    }
+    if (code == RESULT_TEXT_GLYPH_DEF) {
+        if (pos + 4 > len) return len;
+        int next = pos + 4 + ((data[pos + 2] + 7) >> 3) * data[pos + 3];
+        return next < len ? next : len;
+    }
+    return pos + 1;
+}
+
+// Line from pos, sets where it ends and where the next one starts. Returns its height
+static int resultTextLine(const uint8_t *data, int len, int pos, int scale, int *end, int *next) {
+    int x = 0, height = 8 * scale;
+    int wrap = -1, wrapHeight = height;
+    ResultItem item;
+    ResultGlyph *glyph;
+    while (pos < len) {
+        int after = resultTextItem(data, len, pos, &item, &glyph);
+        if (item == RESULT_ITEM_NEWLINE) {
+            *end = pos;
+            *next = after;
+            return height;
+        }
+        if (item == RESULT_ITEM_SKIP) {
+            pos = after;
+            continue;
+        }
+
+        bool space = glyph == &resultTextFont[' '];
+        int w = glyph->width * scale;
+        if (x && x + w > RESULT_TEXT_WIDTH) {
+            if (space) {
+                // Space at the wrap is dropped
+                *end = pos;
+                *next = after;
+            } else if (wrap >= 0) {
+                *end = *next = wrap;
+                height = wrapHeight;
+            } else {
+                *end = *next = pos;
+            }
+            return height;
+        }
+        x += w;
+        if (glyph->height * scale > height) height = glyph->height * scale;
+        if (space) {
+            wrap = after;
+            wrapHeight = height;
+        }
+        pos = after;
+    }
+    *end = *next = len;
+    return height;
+}
+
+static void resultTextBlit(ImageData *out, int x, int y, ResultGlyph *glyph, int scale) {
+    const uint8_t *rows = resultGlyphRows(glyph, scale);
+    if (!rows) return;
+    int rowBytes = (glyph->width * scale + 7) >> 3;
+    int outByteWidth = out->width >> 3;
+    int shift = x & 7;
+    for (int i = 0; i < glyph->height * scale; i++) {
+        uint8_t *dst = out->output + 4 + (y + i) * outByteWidth + (x >> 3);
+        int room = outByteWidth - (x >> 3);
+        const uint8_t *src = rows + i * rowBytes;
+        for (int j = 0; j < rowBytes && j < room; j++) {
+            dst[j] |= src[j] >> shift;
+            if (shift && j + 1 < room) dst[j + 1] |= src[j] << (8 - shift);
+        }
+    }
+}
+
+// Lay out the text payload at 1x or 2x font size into a 128 px wide raster result.
+// out->output has the same 4 byte width header as a raster result
+esp_err_t resultTextLayout(const uint8_t *buff, int scale, ImageData *out) {
+    const uint8_t *data = buff + RESULT_TEXT_HEADER_SIZE;
+    int dataLen = resultTextSize(buff) - RESULT_TEXT_HEADER_SIZE;
+
+    int end, next, height = 0;
+    for (int pos = 0; pos < dataLen; pos = next)
+        height += resultTextLine(data, dataLen, pos, scale, &end, &next);
+
+    int byteWidth = RESULT_TEXT_WIDTH >> 3;
+    out->width = RESULT_TEXT_WIDTH;
+    out->height = height;
+    out->output = malloc_spi(4 + byteWidth * height);
+    if (!out->output) {
+        out->width = out->height = 0;
+        ESP_LOGE(TAG_TEXT, "No memory for %d text rows", height);
+        return ESP_ERR_NO_MEM;
+    }
+    memset(out->output, 0, 4 + byteWidth * height);
+    out->output[3] = RESULT_TEXT_WIDTH;
+
+    ResultItem item;
+    ResultGlyph *glyph;
+    int y = 0;
+    for (int pos = 0; pos < dataLen; pos = next) {
+        int lineHeight = resultTextLine(data, dataLen, pos, scale, &end, &next);
+        int x = 0;
+        while (pos < end) {
+            pos = resultTextItem(data, dataLen, pos, &item, &glyph);
+            if (item != RESULT_ITEM_GLYPH) continue;
+            resultTextBlit(out, x, y + ((lineHeight - glyph->height * scale) >> 1), glyph, scale);
+            x += glyph->width * scale;
+        }
+        y += lineHeight;
+    }
+    return ESP_OK;
+}
+
+#endif
@@ -0,0 +1,135 @@
+#ifndef __RESULT_TILES_H__
+#define __RESULT_TILES_H__
+
+// Zoomed result cut in 128x64 tiles in display page format. A tile is rendered the first time
+// a viewport touches it and kept until the result changes, so panning only assembles the viewport
+// from up to four cached tiles. Tiles outside the image are blank.
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <esp_log.h>
+
+#include "spi_ram.h"
+#include "image_kernels.h"
+
+#define RESULT_TILE_WIDTH 128
+#define RESULT_TILE_HEIGHT 64
+#define RESULT_TILE_PAGES (RESULT_TILE_HEIGHT >> 3)
+#define RESULT_TILE_BYTES (RESULT_TILE_WIDTH * RESULT_TILE_PAGES)
+
+static const char *TAG_TILES = "main:tiles";
+
+typedef struct {
+    const ImageData *image;  // Result with the 4 byte width header in output
+    uint8_t zoom;            // Image pixels per display pixel, 1, 2 or 4
+    int cols, rows;          // Grid size, 0 until first use
+    uint8_t **tiles;         // cols * rows, NULL until rendered
+} ResultTiles;
+
+// Display size of the zoomed image
+static inline int resultTilesWidth(const ResultTiles *t) {
+    return t->image->width / t->zoom;
+}
+
+static inline int resultTilesHeight(const ResultTiles *t) {
+    return t->image->height / t->zoom;
+}
+
+// Drop all tiles, they are rendered again from the image on next use
+void resultTilesReset(ResultTiles *t) {
+    for (int i = 0; i < t->cols * t->rows; i++)
+        free(t->tiles[i]);
+    free(t->tiles);
+    t->tiles = NULL;
+    t->cols = t->rows = 0;
+}
+
+static uint8_t *resultTileRender(const ResultTiles *t, int col, int row) {
+    // Only the main task renders results
+    static uint8_t bitmap[RESULT_TILE_BYTES];
+    uint8_t *tile = malloc_spi(RESULT_TILE_BYTES);
+    if (!tile) {
+        ESP_LOGE(TAG_TILES, "No memory for tile %d,%d", col, row);
+        return NULL;
+    }
+
+    const ImageData *image = t->image;
+    int imgByteWidth = image->width >> 3;
+    int y = row * RESULT_TILE_HEIGHT * t->zoom;
+    int lines = (image->height - y) / t->zoom;
+    if (lines > RESULT_TILE_HEIGHT) lines = RESULT_TILE_HEIGHT;
+
+    const uint8_t *img = image->output + 4 + y * imgByteWidth;
+    int x = col * RESULT_TILE_WIDTH * t->zoom;
+    if (t->zoom == 1) {
+        for (int i = 0; i < lines; i++)
+            imageShiftRow(bitmap + i * (RESULT_TILE_WIDTH >> 3), img + i * imgByteWidth, imgByteWidth, x, RESULT_TILE_WIDTH >> 3);
+    } else if (t->zoom == 2)
+        imageZoom2x(bitmap, RESULT_TILE_WIDTH >> 3, lines, img, imgByteWidth, x);
+    else
+        imageZoom4x(bitmap, RESULT_TILE_WIDTH >> 3, lines, img, imgByteWidth, x);
+    memset(bitmap + lines * (RESULT_TILE_WIDTH >> 3), 0, (RESULT_TILE_HEIGHT - lines) * (RESULT_TILE_WIDTH >> 3));
+
+    imageBitmapToPages(tile, bitmap, RESULT_TILE_WIDTH >> 3, RESULT_TILE_HEIGHT);
+    return tile;
+}
+
+// Tile at grid position, NULL outside the image
+static const uint8_t *resultTileGet(ResultTiles *t, int col, int row) {
+    if (!t->tiles) {
+        t->cols = (resultTilesWidth(t) + RESULT_TILE_WIDTH - 1) / RESULT_TILE_WIDTH;
+        t->rows = (resultTilesHeight(t) + RESULT_TILE_HEIGHT - 1) / RESULT_TILE_HEIGHT;
+        t->tiles = calloc(t->cols * t->rows, sizeof(uint8_t *));
+        if (!t->tiles) {
+            t->cols = t->rows = 0;
+            return NULL;
+        }
+    }
+    if (col < 0 || row < 0 || col >= t->cols || row >= t->rows)
+        return NULL;
+
+    uint8_t **tile = &t->tiles[row * t->cols + col];
+    if (!*tile) *tile = resultTileRender(t, col, row);
+    return *tile;
+}
+
+// Display page of the zoomed image from column x on, zero outside the image
+static void resultTilesPage(ResultTiles *t, int page, int x, uint8_t *segs, int width) {
+    int row = page >= 0 ? page / RESULT_TILE_PAGES : -1;
+    int tilePage = page - row * RESULT_TILE_PAGES;
+    for (int i = 0; i < width;) {
+        int col = x + i >= 0 ? (x + i) / RESULT_TILE_WIDTH : -1;
+        int start = x + i - col * RESULT_TILE_WIDTH;
+        int len = RESULT_TILE_WIDTH - start;
+        if (len > width - i) len = width - i;
+
+        const uint8_t *tile = resultTileGet(t, col, row);
+        if (tile)
+            memcpy(segs + i, tile + tilePage * RESULT_TILE_WIDTH + start, len);
+        else
+            memset(segs + i, 0, len);
+        i += len;
+    }
+}
+
+// Viewport of pages * 8 rows and width columns with its top left at display pixel x, y of the
+// zoomed image, which can be outside the image. Rows are shifted within the page pair they span
+void resultTilesView(ResultTiles *t, int x, int y, uint8_t *pages, int width, int pageCount) {
+    static uint8_t upper[RESULT_TILE_WIDTH], lower[RESULT_TILE_WIDTH];
+    int page = y >= 0 ? y >> 3 : -((7 - y) >> 3);
+    int shift = y - page * 8;
+    for (int p = 0; p < pageCount; p++, page++) {
+        uint8_t *segs = pages + p * width;
+        resultTilesPage(t, page, x, upper, width);
+        if (!shift) {
+            memcpy(segs, upper, width);
+            continue;
+        }
+        resultTilesPage(t, page + 1, x, lower, width);
+        for (int i = 0; i < width; i++)
+            segs[i] = upper[i] >> shift | lower[i] << (8 - shift);
+    }
+}
+
+#endif
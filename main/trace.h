@@ -0,0 +1,208 @@
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include <stdint.h>
+#include <inttypes.h>
+
+// Trace event ids, see traceEventNames
+typedef enum trace_event {
+    TRACE_EVENT_STAGE,         // Pipeline stage, arg is PerfStage
+    TRACE_EVENT_FRAME,         // Main loop frame, arg is FrameRateClass on end
+    TRACE_EVENT_APP_POST,      // App event posted, arg is AppEventType
+    TRACE_EVENT_APP_HANDLE,    // App event handled, arg is AppEventType
+    TRACE_EVENT_HTTP,          // esp_http_client event, arg is event id
+    TRACE_EVENT_NET_REQUEST,   // Network request, arg is NetPriority
+    TRACE_EVENT_OTA_CHECK,     // OTA update check
+    TRACE_EVENT_COUNT,
+} TraceEvent;
+
+typedef enum trace_phase {
+    TRACE_PHASE_BEGIN = 'B',
+    TRACE_PHASE_END = 'E',
+    TRACE_PHASE_INSTANT = 'i',
+} TracePhase;
+
+#if CONFIG_APP_TRACE
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/param.h>
+#include <esp_err.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <esp_heap_caps.h>
+
+#include "spi_ram.h"
+
+#define TRACE_MAX_TASKS 32
+#define TRACE_CONSOLE_STACK_SIZE 3072
+#define TRACE_CONSOLE_POLL_MS 100
+// Thread local storage slot caching a task's trace id + 1, slot 0 belongs to pthread.
+// With a single slot configured, tasks are looked up in traceTasks on every record
+#define TRACE_TLS_INDEX (CONFIG_FREERTOS_THREAD_LOCAL_STORAGE_POINTERS - 1)
+
+#define TRACE_BEGIN(event, arg) traceRecord(event, TRACE_PHASE_BEGIN, arg)
+#define TRACE_END(event, arg) traceRecord(event, TRACE_PHASE_END, arg)
+#define TRACE_INSTANT(event, arg) traceRecord(event, TRACE_PHASE_INSTANT, arg)
+
+static const char *const traceEventNames[TRACE_EVENT_COUNT] = {
+    "stage",
+    "frame",
+    "app_post",
+    "app_handle",
+    "http",
+    "net_request",
+    "ota_check",
+};
+
+typedef struct {
+    int64_t timeUs;
+    uint16_t event;
+    uint8_t phase;
+    uint8_t task;  // Index in traceTasks, bit 7 is core
+    uint32_t arg;
+} TraceEntry;
+
+// Tasks seen by trace, a deleted task's handle may be reused by a new task
+static struct {
+    TaskHandle_t handle;
+    char name[configMAX_TASK_NAME_LEN];
+} traceTasks[TRACE_MAX_TASKS];
+static volatile int traceTaskCount;
+static portMUX_TYPE traceTaskLock = portMUX_INITIALIZER_UNLOCKED;
+
+// Optional names for event args, e.g. stage names
+static const char *const *traceArgNames[TRACE_EVENT_COUNT];
+static int traceArgNameCount[TRACE_EVENT_COUNT];
+
+static TraceEntry *traceRing;
+static uint32_t traceMask;
+static uint32_t traceHead;
+static volatile bool traceEnabled;
+
+static uint8_t traceTaskId() {
+#if TRACE_TLS_INDEX > 0
+    void *cached = pvTaskGetThreadLocalStoragePointer(NULL, TRACE_TLS_INDEX);
+    if (cached) return (uintptr_t)cached - 1;
+#endif
+    TaskHandle_t task = xTaskGetCurrentTaskHandle();
+#if TRACE_TLS_INDEX <= 0
+    // Entries are only appended, lookup without lock
+    int count = traceTaskCount;
+    for (int i = 0; i < count; i++)
+        if (traceTasks[i].handle == task) return i;
+#endif
+
+    taskENTER_CRITICAL(&traceTaskLock);
+    int id = traceTaskCount;
+    if (id < TRACE_MAX_TASKS) {
+        traceTasks[id].handle = task;
+        strlcpy(traceTasks[id].name, pcTaskGetName(task), configMAX_TASK_NAME_LEN);
+        __atomic_store_n(&traceTaskCount, id + 1, __ATOMIC_RELEASE);
+    } else {
+        id = TRACE_MAX_TASKS - 1;
+    }
+    taskEXIT_CRITICAL(&traceTaskLock);
+#if TRACE_TLS_INDEX > 0
+    vTaskSetThreadLocalStoragePointer(NULL, TRACE_TLS_INDEX, (void *)(uintptr_t)(id + 1));
+#endif
+    return id;
+}
+
+void traceRecord(TraceEvent event, TracePhase phase, uint32_t arg) {
+    if (!traceEnabled) return;
+    uint32_t index = __atomic_fetch_add(&traceHead, 1, __ATOMIC_RELAXED);
+    TraceEntry *entry = &traceRing[index & traceMask];
+    entry->timeUs = esp_timer_get_time();
+    entry->event = event;
+    entry->phase = phase;
+    entry->task = traceTaskId() | (xPortGetCoreID() << 7);
+    entry->arg = arg;
+}
+
+static inline void traceNameArgs(TraceEvent event, const char *const *names, int count) {
+    traceArgNames[event] = names;
+    traceArgNameCount[event] = count;
+}
+
+void traceClear() {
+    traceEnabled = false;
+    traceHead = 0;
+    traceEnabled = true;
+}
+
+// Print the ring as text, convert on host with tools/trace_to_chrome.py
+void traceDump() {
+    traceEnabled = false;
+    // Let writers that already passed the check finish
+    vTaskDelay(1);
+
+    uint32_t head = traceHead;
+    uint32_t count = MIN(head, traceMask + 1);
+    printf("\n# trace v1 entries %" PRIu32 " dropped %" PRIu32 "\n", count, head - count);
+    for (int i = 0; i < traceTaskCount; i++)
+        printf("task %d %s\n", i, traceTasks[i].name);
+    for (int i = 0; i < TRACE_EVENT_COUNT; i++) {
+        printf("event %d %s\n", i, traceEventNames[i]);
+        for (int j = 0; j < traceArgNameCount[i]; j++)
+            printf("arg %d %d %s\n", i, j, traceArgNames[i][j]);
+    }
+    for (uint32_t i = head - count; i != head; i++) {
+        TraceEntry *entry = &traceRing[i & traceMask];
+        printf("%" PRId64 " %u %c %u %u %" PRIu32 "\n", entry->timeUs, entry->event, entry->phase,
+               entry->task & 0x7F, entry->task >> 7, entry->arg);
+    }
+    printf("# end\n");
+    fflush(stdout);
+    traceEnabled = true;
+}
+
+// Serial console commands: "trace" dumps the ring, "trace clear" empties it
+static void traceConsoleTask(void *args) {
+    char line[32];
+    int len = 0;
+    for (;;) {
+        int c = fgetc(stdin);
+        if (c == EOF) {
+            clearerr(stdin);
+            vTaskDelay(pdMS_TO_TICKS(TRACE_CONSOLE_POLL_MS));
+            continue;
+        }
+        if (c != '\n' && c != '\r') {
+            if (len < (int)sizeof(line) - 1) line[len++] = c;
+            continue;
+        }
+        line[len] = 0;
+        len = 0;
+        if (!strcmp(line, "trace"))
+            traceDump();
+        else if (!strcmp(line, "trace clear"))
+            traceClear();
+    }
+}
+
+esp_err_t traceInit() {
+    // Round down to power of two for index masking
+    uint32_t entries = 1u << (31 - __builtin_clz(CONFIG_APP_TRACE_ENTRIES));
+    traceRing = malloc_spi(entries * sizeof(TraceEntry));
+    if (!traceRing) return ESP_ERR_NO_MEM;
+    traceMask = entries - 1;
+    traceEnabled = true;
+    if (xTaskCreate(traceConsoleTask, "trace", TRACE_CONSOLE_STACK_SIZE, NULL, tskIDLE_PRIORITY + 1, NULL) != pdPASS)
+        return ESP_ERR_NO_MEM;
+    return ESP_OK;
+}
+
+#else
+
+#define TRACE_BEGIN(event, arg) ((void)0)
+#define TRACE_END(event, arg) ((void)0)
+#define TRACE_INSTANT(event, arg) ((void)0)
+
+#define traceNameArgs(event, names, count) ((void)0)
+#define traceInit() ESP_OK
+
+#endif  // CONFIG_APP_TRACE
+
+#endif
@@ -0,0 +1,374 @@
+// Host benchmark of the preview and result pixel kernels, build with tools/bench/CMakeLists.txt.
+//   image_bench [--iterations n] [--update] <corpus dir> <golden dir>
+// Preview frames (*.jpg) go through decode, light threshold, dither, gray planes and transpose like
+// oledUpdateImage does. Raster results (*.pbm) go through the zoom kernels and result tiles like
+// renderResultImage does, text results (*.txt) through layout and tiles. Every stage output is compared
+// with <golden dir>/<input>.<stage>.bin, --update writes them instead. Exits with 1 when an output differs.
+
+#include <dirent.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <jpeglib.h>
+
+#include "image_kernels.h"
+#include "result_tiles.h"
+#include "result_text.h"
+#include "ssd1306.h"
+
+#define OLED_WIDTH 128
+#define OLED_HEIGHT 64
+#define OLED_PAGES (OLED_HEIGHT >> 3)
+#define OLED_BYTES (OLED_WIDTH * OLED_PAGES)
+#define BITMAP_ROW_BYTE_COUNT (OLED_WIDTH >> 3)
+#define BENCH_GRAY_PLANES 3  // CONFIG_APP_OLED_GRAY_LEVELS default
+#define BENCH_MAX_STAGES 16
+#define BENCH_MAX_INPUTS 256
+#define BENCH_SCROLL_X 13  // Result pixels, not aligned to bytes
+// Viewport position for panning over cached tiles, not aligned to bytes or pages
+#define BENCH_PAN_X 37
+#define BENCH_PAN_Y 13
+
+typedef struct {
+    const char *name;
+    uint64_t ns;  // Per frame, mean over the iterations
+    uint8_t *out;
+    size_t len;
+} BenchStage;
+
+typedef struct {
+    BenchStage stages[BENCH_MAX_STAGES];
+    int count;
+} BenchRun;
+
+static int benchIterations = 100;
+
+static uint64_t benchNowNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// Time body over benchIterations runs, ns gets the mean
+#define BENCH_TIME(ns, body)                                                \
+    do {                                                                    \
+        uint64_t start = benchNowNs();                                      \
+        for (int iteration = 0; iteration < benchIterations; iteration++) { \
+            body;                                                           \
+        }                                                                   \
+        ns = (benchNowNs() - start) / benchIterations;                      \
+    } while (0)
+
+// Keep a copy of the stage output for the golden check
+static void benchRecord(BenchRun *run, const char *name, uint64_t ns, const void *out, size_t len) {
+    if (run->count == BENCH_MAX_STAGES) {
+        fprintf(stderr, "Too many stages, %s dropped\n", name);
+        return;
+    }
+    BenchStage *stage = &run->stages[run->count++];
+    stage->name = name;
+    stage->ns = ns;
+    stage->len = len;
+    stage->out = malloc(len);
+    memcpy(stage->out, out, len);
+}
+
+static void benchRunFree(BenchRun *run) {
+    for (int i = 0; i < run->count; i++)
+        free(run->stages[i].out);
+    run->count = 0;
+}
+
+static uint8_t *benchReadFile(const char *path, size_t *len) {
+    FILE *file = fopen(path, "rb");
+    if (!file) return NULL;
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    uint8_t *buf = size >= 0 ? malloc(size + 1) : NULL;
+    if (buf && fread(buf, 1, size, file) != (size_t)size) {
+        free(buf);
+        buf = NULL;
+    }
+    fclose(file);
+    *len = size;
+    return buf;
+}
+
+// Preview decode like esp_jpg_decode with JPG_SCALE_2X, RGB888 into image->output.
+// Integer DCT, so the output is the same on every host
+static bool benchDecode(const uint8_t *jpeg, size_t len, ImageData *image) {
+    struct jpeg_decompress_struct cinfo;
+    struct jpeg_error_mgr err;
+    cinfo.err = jpeg_std_error(&err);
+    jpeg_create_decompress(&cinfo);
+    jpeg_mem_src(&cinfo, jpeg, len);
+    if (jpeg_read_header(&cinfo, TRUE) != JPEG_HEADER_OK) {
+        jpeg_destroy_decompress(&cinfo);
+        return false;
+    }
+    cinfo.out_color_space = JCS_RGB;
+    cinfo.scale_num = 1;
+    cinfo.scale_denom = 2;
+    cinfo.dct_method = JDCT_ISLOW;
+    jpeg_start_decompress(&cinfo);
+
+    image->width = cinfo.output_width;
+    image->height = cinfo.output_height;
+    free(image->output);
+    image->output = malloc(image->width * image->height * 3);
+    while (cinfo.output_scanline < cinfo.output_height) {
+        JSAMPROW row = image->output + cinfo.output_scanline * image->width * 3;
+        jpeg_read_scanlines(&cinfo, &row, 1);
+    }
+    jpeg_finish_decompress(&cinfo);
+    jpeg_destroy_decompress(&cinfo);
+    return true;
+}
+
+static bool benchPreview(BenchRun *run, const uint8_t *jpeg, size_t len) {
+    uint64_t ns;
+    ImageData image = {0};
+    bool decoded = true;
+    BENCH_TIME(ns, decoded &= benchDecode(jpeg, len, &image));
+    if (!decoded) return false;
+    benchRecord(run, "jpeg_decode", ns, image.output, image.width * image.height * 3);
+
+    int threshold, step;
+    BENCH_TIME(ns, imageCalcThreshold(&image, &threshold, &step));
+    int16_t levels[2] = {threshold, step};
+    benchRecord(run, "threshold", ns, levels, sizeof(levels));
+
+    static uint8_t bitmap[OLED_BYTES];
+    BENCH_TIME(ns, imageDitherBitmap(&image, threshold, step, bitmap, OLED_WIDTH, OLED_HEIGHT));
+    benchRecord(run, "dither", ns, bitmap, sizeof(bitmap));
+
+    // Same band as oledGrayRender
+    static uint8_t gray[BENCH_GRAY_PLANES][OLED_BYTES];
+    uint8_t *planes[BENCH_GRAY_PLANES];
+    for (int i = 0; i < BENCH_GRAY_PLANES; i++)
+        planes[i] = gray[i];
+    BENCH_TIME(ns, imageGrayPlanes(&image, 2 * threshold - step, 2 * step - threshold, planes, BENCH_GRAY_PLANES,
+                                   OLED_WIDTH, OLED_HEIGHT));
+    benchRecord(run, "gray_planes", ns, gray, sizeof(gray));
+
+    static uint8_t pages[OLED_BYTES];
+    BENCH_TIME(ns, imageBitmapToPages(pages, bitmap, OLED_WIDTH >> 3, OLED_HEIGHT));
+    benchRecord(run, "transpose", ns, pages, sizeof(pages));
+
+    // Display library path of the same transpose, one bit at a time
+    static SSD1306_t dev = {._width = OLED_WIDTH, ._height = OLED_HEIGHT, ._pages = OLED_PAGES};
+    BENCH_TIME(ns, _ssd1306_bitmaps(&dev, 0, 0, bitmap, OLED_WIDTH, OLED_HEIGHT, false));
+    for (int page = 0; page < OLED_PAGES; page++)
+        memcpy(pages + page * OLED_WIDTH, dev._page[page]._segs, OLED_WIDTH);
+    benchRecord(run, "ssd1306_bitmaps", ns, pages, sizeof(pages));
+
+    free(image.output);
+    return true;
+}
+
+// First view renders the tiles it touches, the panned view only assembles cached tiles
+static void benchTiles(BenchRun *run, ImageData *image, int zoom, const char *renderName, const char *panName) {
+    static uint8_t view[OLED_BYTES];
+    uint64_t ns;
+    ResultTiles tiles = {.image = image, .zoom = zoom};
+    BENCH_TIME(ns, {
+        resultTilesReset(&tiles);
+        resultTilesView(&tiles, 0, 0, view, OLED_WIDTH, OLED_PAGES);
+    });
+    benchRecord(run, renderName, ns, view, sizeof(view));
+
+    BENCH_TIME(ns, resultTilesView(&tiles, BENCH_PAN_X, BENCH_PAN_Y, view, OLED_WIDTH, OLED_PAGES));
+    benchRecord(run, panName, ns, view, sizeof(view));
+    resultTilesReset(&tiles);
+}
+
+// Binary PBM to a raster result, 4 byte big endian width then rows with 1 lit like the API server sends
+static bool benchRaster(BenchRun *run, const uint8_t *pbm, size_t len) {
+    int width, height, header;
+    if (sscanf((const char *)pbm, "P4 %d %d%n", &width, &height, &header) != 2 || width % 8) {
+        fprintf(stderr, "Only binary PBM with a width multiple of 8\n");
+        return false;
+    }
+    size_t size = width / 8 * height;
+    if (header + 1 + size > len || height < OLED_HEIGHT * 2) return false;
+    ImageData image = {.width = width, .height = height, .output = malloc(4 + size)};
+    image.output[0] = width >> 24;
+    image.output[1] = width >> 16;
+    image.output[2] = width >> 8;
+    image.output[3] = width;
+    uint8_t *result = image.output + 4;
+    for (size_t i = 0; i < size; i++)
+        result[i] = ~pbm[header + 1 + i];
+    int imgByteWidth = width >> 3;
+
+    // Zoom levels of renderResultImage, scrolled to the start, by a few pixels and to the end of the result
+    uint64_t ns;
+    static uint8_t frame[BITMAP_ROW_BYTE_COUNT * OLED_HEIGHT];
+    int end = (imgByteWidth - BITMAP_ROW_BYTE_COUNT * 4) << 3;
+    BENCH_TIME(ns, imageZoom4x(frame, BITMAP_ROW_BYTE_COUNT, OLED_HEIGHT / 2, result, imgByteWidth, 0));
+    benchRecord(run, "zoom4x", ns, frame, sizeof(frame) / 2);
+    BENCH_TIME(ns, imageZoom4x(frame, BITMAP_ROW_BYTE_COUNT, OLED_HEIGHT / 2, result, imgByteWidth, BENCH_SCROLL_X));
+    benchRecord(run, "zoom4x_scroll", ns, frame, sizeof(frame) / 2);
+    BENCH_TIME(ns, imageZoom4x(frame, BITMAP_ROW_BYTE_COUNT, OLED_HEIGHT / 2, result, imgByteWidth, end > 0 ? end : 0));
+    benchRecord(run, "zoom4x_end", ns, frame, sizeof(frame) / 2);
+
+    end = (imgByteWidth - BITMAP_ROW_BYTE_COUNT * 2) << 3;
+    BENCH_TIME(ns, imageZoom2x(frame, BITMAP_ROW_BYTE_COUNT, OLED_HEIGHT, result, imgByteWidth, 0));
+    benchRecord(run, "zoom2x", ns, frame, sizeof(frame));
+    BENCH_TIME(ns, imageZoom2x(frame, BITMAP_ROW_BYTE_COUNT, OLED_HEIGHT, result, imgByteWidth, BENCH_SCROLL_X));
+    benchRecord(run, "zoom2x_scroll", ns, frame, sizeof(frame));
+    BENCH_TIME(ns, imageZoom2x(frame, BITMAP_ROW_BYTE_COUNT, OLED_HEIGHT, result, imgByteWidth, end > 0 ? end : 0));
+    benchRecord(run, "zoom2x_end", ns, frame, sizeof(frame));
+
+    benchTiles(run, &image, 4, "tiles_zoom4", "pan_zoom4");
+    benchTiles(run, &image, 2, "tiles_zoom2", "pan_zoom2");
+    free(image.output);
+    return true;
+}
+
+// Text file to a text result payload like tools/host_server.py --text
+static bool benchText(BenchRun *run, const uint8_t *text, size_t len) {
+    if (len > 0xFFFF) return false;
+    uint8_t *payload = malloc(RESULT_TEXT_HEADER_SIZE + len);
+    memcpy(payload, RESULT_TEXT_MAGIC, 4);
+    payload[4] = len >> 8;
+    payload[5] = len;
+    for (size_t i = 0; i < len; i++)
+        payload[RESULT_TEXT_HEADER_SIZE + i] = text[i] == '\n' || (text[i] >= 0x20 && text[i] < 0x7F) ? text[i] : '?';
+    resultTextLoad(payload);
+
+    // 2x font size, the layout zoom level 1 shows
+    uint64_t ns;
+    ImageData layout = {0};
+    BENCH_TIME(ns, {
+        free(layout.output);
+        resultTextLayout(payload, 2, &layout);
+    });
+    benchRecord(run, "text_layout", ns, layout.output, 4 + (layout.width >> 3) * layout.height);
+
+    benchTiles(run, &layout, 1, "tiles_zoom1", "pan_zoom1");
+    free(layout.output);
+    resultTextUnload();
+    free(payload);
+    return true;
+}
+
+// Compare or write the stage outputs, returns false on a difference
+static bool benchGolden(const BenchRun *run, const char *goldenDir, const char *input, bool update) {
+    bool same = true;
+    for (int i = 0; i < run->count; i++) {
+        const BenchStage *stage = &run->stages[i];
+        char path[1024];
+        snprintf(path, sizeof(path), "%s/%s.%s.bin", goldenDir, input, stage->name);
+        if (update) {
+            FILE *file = fopen(path, "wb");
+            if (!file || fwrite(stage->out, 1, stage->len, file) != stage->len) {
+                fprintf(stderr, "Can't write %s\n", path);
+                same = false;
+            }
+            if (file) fclose(file);
+            continue;
+        }
+
+        size_t len;
+        uint8_t *golden = benchReadFile(path, &len);
+        if (!golden) {
+            printf("FAIL %s: no golden file %s\n", input, path);
+            same = false;
+            continue;
+        }
+        if (len != stage->len) {
+            printf("FAIL %s: %s is %zu bytes, golden %zu\n", input, stage->name, stage->len, len);
+            same = false;
+        } else {
+            for (size_t j = 0; j < len; j++) {
+                if (stage->out[j] != golden[j]) {
+                    printf("FAIL %s: %s differs at byte %zu\n", input, stage->name, j);
+                    same = false;
+                    break;
+                }
+            }
+        }
+        free(golden);
+    }
+    return same;
+}
+
+static int benchCompareNames(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+int main(int argc, char **argv) {
+    bool update = false;
+    int arg = 1;
+    for (; arg < argc && argv[arg][0] == '-'; arg++) {
+        if (!strcmp(argv[arg], "--update")) {
+            update = true;
+        } else if (!strcmp(argv[arg], "--iterations") && arg + 1 < argc) {
+            benchIterations = atoi(argv[++arg]);
+            if (benchIterations < 1) benchIterations = 1;
+        } else {
+            break;
+        }
+    }
+    if (argc - arg != 2) {
+        fprintf(stderr, "Usage: %s [--iterations n] [--update] <corpus dir> <golden dir>\n", argv[0]);
+        return 2;
+    }
+    const char *corpusDir = argv[arg], *goldenDir = argv[arg + 1];
+
+    DIR *dir = opendir(corpusDir);
+    if (!dir) {
+        fprintf(stderr, "Can't open %s\n", corpusDir);
+        return 2;
+    }
+    char *names[BENCH_MAX_INPUTS];
+    int nameCount = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) && nameCount < BENCH_MAX_INPUTS) {
+        const char *ext = strrchr(entry->d_name, '.');
+        if (ext && (!strcmp(ext, ".jpg") || !strcmp(ext, ".pbm") || !strcmp(ext, ".txt")))
+            names[nameCount++] = strdup(entry->d_name);
+    }
+    closedir(dir);
+    qsort(names, nameCount, sizeof(char *), benchCompareNames);
+
+    int failed = 0;
+    printf("%-24s %-16s %12s\n", "input", "stage", "ns/frame");
+    for (int i = 0; i < nameCount; i++) {
+        char path[1024];
+        snprintf(path, sizeof(path), "%s/%s", corpusDir, names[i]);
+        size_t len;
+        uint8_t *data = benchReadFile(path, &len);
+        BenchRun run = {0};
+        const char *ext = strrchr(names[i], '.');
+        bool ok = data && (!strcmp(ext, ".jpg")   ? benchPreview(&run, data, len)
+                           : !strcmp(ext, ".pbm") ? benchRaster(&run, data, len)
+                                                  : benchText(&run, data, len));
+        free(data);
+        if (!ok) {
+            printf("FAIL %s: can't read input\n", names[i]);
+            failed++;
+            free(names[i]);
+            continue;
+        }
+
+        for (int j = 0; j < run.count; j++)
+            printf("%-24s %-16s %12" PRIu64 "\n", names[i], run.stages[j].name, run.stages[j].ns);
+        if (!benchGolden(&run, goldenDir, names[i], update))
+            failed++;
+        benchRunFree(&run);
+        free(names[i]);
+    }
+
+    if (update)
+        printf("Golden files written to %s\n", goldenDir);
+    else
+        printf("%d of %d inputs match their golden files\n", nameCount - failed, nameCount);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,85 @@
+// Check of the ssd1306 mock transport, build with tools/bench/CMakeLists.txt.
+//   mock_check
+// Renders a known frame through the library on both mock buses and compares transactions, bytes,
+// bus time and the rebuilt GDDRAM with what the i2c and spi backends send. Exits with 1 on a mismatch.
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "ssd1306.h"
+
+#define OLED_WIDTH 128
+#define OLED_HEIGHT 64
+#define OLED_PAGES (OLED_HEIGHT >> 3)
+#define OLED_BYTES (OLED_WIDTH * OLED_PAGES)
+#define MOCK_I2C_CLOCK_HZ 400000
+#define MOCK_SPI_CLOCK_HZ 10000000
+
+typedef struct {
+    const char *name;
+    ssd1306_mock_bus_t bus;
+    uint32_t clockHz;
+    uint32_t transactions;
+    uint32_t commandBytes;
+    uint32_t dataBytes;
+    uint64_t busTimeNs;
+} MockCase;
+
+// i2c: one batch of 8 pages, cursor command (3 bytes) and 128 data bytes each, 16 blocks behind
+// a repeated start with address and control byte, one stop.
+// spi: address window (6 bytes) and the frame, one transaction each
+static const MockCase mockCases[] = {
+    {"i2c", MOCK_BUS_I2C, MOCK_I2C_CLOCK_HZ, 1, OLED_PAGES * 3, OLED_BYTES,
+     (1 + OLED_PAGES * 2 + (OLED_PAGES * (3 + 128) + OLED_PAGES * 2 * 2) * 9) * 1000000000ull / MOCK_I2C_CLOCK_HZ},
+    {"spi", MOCK_BUS_SPI, MOCK_SPI_CLOCK_HZ, 2, 6, OLED_BYTES,
+     6 * 8 * 1000000000ull / MOCK_SPI_CLOCK_HZ + OLED_BYTES * 8 * 1000000000ull / MOCK_SPI_CLOCK_HZ},
+};
+
+static bool mockCheckValue(const char *bus, const char *name, uint64_t value, uint64_t expected) {
+    if (value == expected) return true;
+    printf("%s: %s %" PRIu64 ", expected %" PRIu64 "\n", bus, name, value, expected);
+    return false;
+}
+
+static bool mockCheck(const MockCase *test, uint8_t *frame) {
+    SSD1306_t dev;
+    static ssd1306_mock_t mock;
+    memset(&dev, 0, sizeof(dev));
+    mock_master_init(&dev, &mock, test->bus, test->clockHz);
+    ssd1306_init(&dev, OLED_WIDTH, OLED_HEIGHT);
+    mock_reset_stats(&mock);
+
+    ssd1306_set_buffer(&dev, frame);
+    ssd1306_show_buffer(&dev);
+
+    bool ok = true;
+    ok &= mockCheckValue(test->name, "transactions", mock.transactions, test->transactions);
+    ok &= mockCheckValue(test->name, "command bytes", mock.command_bytes, test->commandBytes);
+    ok &= mockCheckValue(test->name, "data bytes", mock.data_bytes, test->dataBytes);
+    ok &= mockCheckValue(test->name, "bus time ns", mock.bus_time_ns, test->busTimeNs);
+    for (int page = 0; page < OLED_PAGES; page++) {
+        if (memcmp(mock.gddram[page], &frame[page * OLED_WIDTH], OLED_WIDTH)) {
+            printf("%s: GDDRAM page %d differs from the frame\n", test->name, page);
+            ok = false;
+        }
+    }
+    printf("%-3s %s, %" PRIu32 " transactions, %" PRIu32 " + %" PRIu32 " bytes, %" PRIu64 " us\n",
+           test->name, ok ? "ok" : "FAIL", mock.transactions, mock.command_bytes, mock.data_bytes,
+           mock.bus_time_ns / 1000);
+    return ok;
+}
+
+int main(int argc, char **argv) {
+    // Every byte different within a page and between pages, catches wrong column or page order
+    uint8_t frame[OLED_BYTES];
+    for (int i = 0; i < OLED_BYTES; i++)
+        frame[i] = (uint8_t)(i * 7 + (i >> 7));
+
+    bool ok = true;
+    for (size_t i = 0; i < sizeof(mockCases) / sizeof(mockCases[0]); i++)
+        ok &= mockCheck(&mockCases[i], frame);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,8 @@
+#pragma once
+
+#include "FreeRTOS.h"
+
+// Only used by the animated text functions of the display library, not benchmarked
+static inline void vTaskDelay(TickType_t ticks) {
+    (void)ticks;
+}
@@ -0,0 +1,5 @@
+#pragma once
+
+// Configuration of the benchmark build, the display library takes its host path
+#define CONFIG_IDF_TARGET_LINUX 1
+#define CONFIG_OFFSETX 0
@@ -0,0 +1,147 @@
+#!/usr/bin/env python3
+"""Local stand-in for the backend API, for the linux host build.
+
+Accepts the image upload, waits the given processing and solving time on the two
+wait requests, then returns the result bitmap. OTA check always answers up to date.
+
+    python tools/host_server.py [--port 25569] [--result result.pbm | --text result.txt] [--process 1.0] [--solve 1.0]
+
+The result is a binary PBM (P4) with a width multiple of 8, white pixels are lit like
+/framebuffer.pbm. Without --result a test pattern is returned. --text returns a text
+result instead, see main/result_text.h. Characters outside printable ASCII become '?'.
+"""
+import argparse
+import struct
+import threading
+import time
+import uuid
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+
+
+def read_pbm(path):
+    with open(path, 'rb') as f:
+        data = f.read()
+    # Header is magic, width and height separated by whitespace, comments start with #
+    fields, pos = [], 0
+    while len(fields) < 3:
+        while data[pos:pos + 1].isspace():
+            pos += 1
+        if data[pos:pos + 1] == b'#':
+            pos = data.index(b'\n', pos)
+            continue
+        end = pos
+        while not data[end:end + 1].isspace():
+            end += 1
+        fields.append(data[pos:end])
+        pos = end
+    if fields[0] != b'P4':
+        raise ValueError('%s is not a binary PBM' % path)
+    width, height = int(fields[1]), int(fields[2])
+    if width % 8:
+        raise ValueError('PBM width must be a multiple of 8')
+    pixels = data[pos + 1:pos + 1 + width // 8 * height]
+    # PBM 1 is black, device 1 is lit
+    return width, bytes(~b & 0xFF for b in pixels)
+
+
+def encode_text(path):
+    with open(path, encoding='utf-8') as f:
+        text = f.read()
+    records = bytes(c if c == 0x0A or 0x20 <= c < 0x7F else ord('?') for c in map(ord, text))
+    if len(records) > 0xFFFF:
+        raise ValueError('text result is limited to 65535 bytes')
+    return b'RTX1' + struct.pack('>H', len(records)) + records
+
+
+def test_pattern(width=256, height=128):
+    rows = []
+    for y in range(height):
+        row = bytearray(width // 8)
+        for x in range(width):
+            border = x in (0, width - 1) or y in (0, height - 1)
+            if border or (x + y) % 16 == 0 or (x // 32 + y // 16) % 2 and x % 4 == 0:
+                row[x // 8] |= 0x80 >> (x % 8)
+        rows.append(bytes(row))
+    return width, b''.join(rows)
+
+
+class ApiHandler(BaseHTTPRequestHandler):
+    protocol_version = 'HTTP/1.1'
+    processes = {}
+    lock = threading.Lock()
+
+    def reply(self, code, body=b'', content_type='application/octet-stream'):
+        self.send_response(code)
+        self.send_header('Content-Type', content_type)
+        self.send_header('Content-Length', str(len(body)))
+        self.end_headers()
+        self.wfile.write(body)
+
+    def read_body(self):
+        return self.rfile.read(int(self.headers.get('Content-Length', 0)))
+
+    def do_POST(self):
+        body = self.read_body()
+        if self.path == '/img':
+            process_id = str(uuid.uuid4())
+            with self.lock:
+                self.processes[process_id] = 0
+            print('upload %d bytes, id %s' % (len(body), process_id))
+            self.reply(200, process_id.encode(), 'text/plain')
+        elif self.path == '/telemetry':
+            print('telemetry %d bytes' % len(body))
+            self.reply(204)
+        else:
+            self.reply(404)
+
+    def do_GET(self):
+        if self.path == '/ota':
+            self.reply(204)
+            return
+        if self.path != '/img':
+            self.reply(404)
+            return
+
+        process_id = self.headers.get('id')
+        with self.lock:
+            step = self.processes.get(process_id)
+            if step is not None:
+                self.processes[process_id] = step + 1
+        if step is None:
+            self.reply(400)
+        elif step < 2:
+            # Process wait then solve wait
+            time.sleep(self.server.delays[step])
+            self.reply(200)
+        else:
+            with self.lock:
+                self.processes.pop(process_id, None)
+            self.reply(200, self.server.result)
+
+    def log_message(self, format, *args):
+        print('%s %s' % (self.address_string(), format % args))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--port', type=int, default=25569)
+    result = parser.add_mutually_exclusive_group()
+    result.add_argument('--result', help='binary PBM returned as result')
+    result.add_argument('--text', help='text file returned as text result')
+    parser.add_argument('--process', type=float, default=1.0, help='processing wait in seconds')
+    parser.add_argument('--solve', type=float, default=1.0, help='solving wait in seconds')
+    args = parser.parse_args()
+
+    server = ThreadingHTTPServer(('', args.port), ApiHandler)
+    if args.text:
+        server.result = encode_text(args.text)
+    else:
+        width, pixels = read_pbm(args.result) if args.result else test_pattern()
+        server.result = struct.pack('>I', width) + pixels
+    server.delays = (args.process, args.solve)
+    print('Listening on port %d' % args.port)
+    server.serve_forever()
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,81 @@
+#!/usr/bin/env python3
+"""Convert a trace dump from the device serial log to Chrome trace JSON.
+
+Enable CONFIG_APP_TRACE, send "trace" over the serial console and save the output,
+then open the converted file in chrome://tracing or https://ui.perfetto.dev
+
+    python tools/trace_to_chrome.py serial.log trace.json
+"""
+import json
+import sys
+
+
+def parse_dump(lines):
+    tasks, events, args, entries = {}, {}, {}, []
+    in_dump = False
+    for line in lines:
+        line = line.strip()
+        if line.startswith('# trace'):
+            # Keep the last dump in the log
+            tasks, events, args, entries = {}, {}, {}, []
+            in_dump = True
+            continue
+        if not in_dump:
+            continue
+        if line.startswith('# end'):
+            in_dump = False
+            continue
+
+        parts = line.split(' ')
+        if parts[0] == 'task':
+            tasks[int(parts[1])] = ' '.join(parts[2:])
+        elif parts[0] == 'event':
+            events[int(parts[1])] = parts[2]
+        elif parts[0] == 'arg':
+            args[(int(parts[1]), int(parts[2]))] = parts[3]
+        elif len(parts) == 6:
+            time_us, event, phase, task, core, arg = parts
+            entries.append((int(time_us), int(event), phase, int(task), int(core), int(arg)))
+    return tasks, events, args, entries
+
+
+def to_chrome(tasks, events, args, entries):
+    trace = []
+    for task, name in tasks.items():
+        trace.append({'name': 'thread_name', 'ph': 'M', 'pid': 0, 'tid': task, 'args': {'name': name}})
+
+    for time_us, event, phase, task, core, arg in entries:
+        name = events.get(event, 'event_%d' % event)
+        # Events with arg names are split by arg, e.g. each pipeline stage
+        if (event, arg) in args:
+            name = args[(event, arg)]
+        item = {
+            'name': name,
+            'ph': phase,
+            'ts': time_us,
+            'pid': 0,
+            'tid': task,
+            'args': {'arg': arg, 'core': core},
+        }
+        if phase == 'i':
+            item['s'] = 't'
+        trace.append(item)
+    return {'traceEvents': trace, 'displayTimeUnit': 'ms'}
+
+
+def main():
+    if len(sys.argv) != 3:
+        print(__doc__)
+        sys.exit(1)
+    with open(sys.argv[1], encoding='utf-8', errors='replace') as f:
+        tasks, events, args, entries = parse_dump(f)
+    if not entries:
+        print('No trace dump found')
+        sys.exit(1)
+    with open(sys.argv[2], 'w') as f:
+        json.dump(to_chrome(tasks, events, args, entries), f)
+    print('%d entries, %d tasks' % (len(entries), len(tasks)))
+
+
+if __name__ == '__main__':
+    main()